@@ -61,9 +61,189 @@ static void log_write(const char *method, SV *message) {
 }
 
 #include "uicontext.c"
+#include "vkswapchain.c"
+#include "vertexstream.c"
+
+// The parts of the interface that deal in perl data structures.  The C files
+// above don't use perl at all, apart from croak and the log functions.
+
+static void UIContext_xs_fatal_handler(void) {
+	dSP;
+	PUSHMARK(SP);
+	call_pv("X11::MinimalOpenGLContext::_X11_error_fatal", G_VOID|G_DISCARD|G_NOARGS|G_EVAL|G_KEEPERR);
+}
+
+// Cut off the scalar returned by pixmap_buffer, which perl code might still
+// reference, before the memory it aliases is freed
+static void UIContext_xs_membuf_released(void *arg) {
+	SV *buf= (SV*) arg;
+	SvPV_set(buf, NULL);
+	SvCUR_set(buf, 0);
+	SvOK_off(buf);
+	SvREFCNT_dec(buf);
+}
+
+// The UIContext holds a weak reference to the perl object that owns it
+static void UIContext_xs_set_owner(UIContext *cx, SV *owner) {
+	SV *prev= (SV*) UIContext_get_user_data(cx);
+	UIContext_set_user_data(cx, NULL);
+	if (prev) SvREFCNT_dec(prev);
+	if (owner && SvROK(owner)) {
+		SV *weak= newSVsv(owner);
+		sv_rvweaken(weak);
+		UIContext_set_user_data(cx, weak);
+	}
+}
+
+static void UIContext_xs_get_xlib_error_codes(HV* dest) {
+	#define E(x) hv_stores(dest, #x, newSViv(x));
+	E(BadAccess)
+	E(BadAlloc)
+	E(BadAtom)
+	E(BadColor)
+	E(BadCursor)
+	E(BadDrawable)
+	E(BadFont)
+	E(BadGC)
+	E(BadIDChoice)
+	E(BadImplementation)
+	E(BadLength)
+	E(BadMatch)
+	E(BadName)
+	E(BadPixmap)
+	E(BadRequest)
+	E(BadValue)
+	E(BadWindow)
+	#undef E
+}
+
+static void UIContext_xs_load_size_hints(HV *hints, XSizeHints *sh) {
+	SV** pval;
+	memset(sh, 0, sizeof(*sh));
+	#define LOADFIELD(field, bitflag) if (\
+		(pval= hv_fetch(hints, #field, strlen(#field), 0)) && SvOK(*pval) \
+		) { sh->flags |= bitflag; sh->field = SvIV(*pval); }
+	LOADFIELD(x,            PPosition);
+	LOADFIELD(y,            PPosition);
+	LOADFIELD(width,        PSize);
+	LOADFIELD(height,       PSize);
+	LOADFIELD(min_width,    PMinSize);
+	LOADFIELD(min_height,   PMinSize);
+	LOADFIELD(max_width,    PMaxSize);
+	LOADFIELD(max_height,   PMaxSize);
+	LOADFIELD(width_inc,    PResizeInc);
+	LOADFIELD(height_inc,   PResizeInc);
+	LOADFIELD(min_aspect.x, PAspect);
+	LOADFIELD(min_aspect.y, PAspect);
+	LOADFIELD(max_aspect.x, PAspect);
+	LOADFIELD(max_aspect.y, PAspect);
+	LOADFIELD(base_width,   PBaseSize);
+	LOADFIELD(base_height,  PBaseSize);
+	LOADFIELD(win_gravity,  PWinGravity);
+	#undef LOADFIELD
+}
+
+// Move up to 'max' debug messages (all, if max <= 0) into 'dest' as
+// hashrefs.  Returns the number of messages dropped since the last call.
+static unsigned UIContext_xs_drain_debug_messages(UIContext *cx, int max, AV *dest) {
+	UIContext_debug_msg m;
+	HV *msg;
+	int n= 0;
+	
+	while ((max <= 0 || n < max) && UIContext_next_debug_message(cx, &m)) {
+		msg= newHV();
+		hv_stores(msg, "source",   newSVpv(UIContext_debug_source_name(m.source), 0));
+		hv_stores(msg, "type",     newSVpv(UIContext_debug_type_name(m.type), 0));
+		hv_stores(msg, "id",       newSVuv(m.id));
+		hv_stores(msg, "severity", newSVpv(UIContext_debug_severity_name(m.severity), 0));
+		hv_stores(msg, "message",  newSVpv(m.text, 0));
+		av_push(dest, newRV_noinc((SV*) msg));
+		n++;
+	}
+	return UIContext_debug_dropped(cx);
+}
+
+// Move the queued X errors into 'dest' as pairs of (owner, hashref), oldest
+// first.  The owner is undef if the UIContext for the display has none.
+// Returns the number of errors dropped because the queue was full.
+static unsigned UIContext_xs_drain_x_errors(AV *dest) {
+	UIContext_x_error q[UICONTEXT_X_ERROR_QUEUE_SIZE];
+	UIContext *cx;
+	SV *owner;
+	unsigned dropped;
+	HV *err;
+	int i, n;
+	
+	n= UIContext_take_x_errors(q, &dropped);
+	for (i= 0; i < n; i++) {
+		cx= UIContext_dpy_map_get(q[i].dpy);
+		owner= cx? (SV*) UIContext_get_user_data(cx) : NULL;
+		av_push(dest, owner? newSVsv(owner) : newSV(0));
+		err= newHV();
+		hv_stores(err, "type",         newSViv(0)); // always X_Error
+		hv_stores(err, "display",      newSVpvf("%p", (void*) q[i].dpy));
+		hv_stores(err, "serial",       newSVuv(q[i].serial));
+		hv_stores(err, "first_serial", newSVuv(q[i].first_serial));
+		hv_stores(err, "error_code",   newSViv(q[i].error_code));
+		hv_stores(err, "request_code", newSViv(q[i].request_code));
+		hv_stores(err, "minor_code",   newSViv(q[i].minor_code));
+		hv_stores(err, "resourceid",   newSVuv(q[i].resourceid));
+		hv_stores(err, "count",        newSVuv(q[i].count));
+		if (q[i].op)
+			hv_stores(err, "operation", newSVpv(q[i].op, 0));
+		av_push(dest, newRV_noinc((SV*) err));
+	}
+	return dropped;
+}
+
+// Empty the scalar from stream_reserve, so that perl can't write into the
+// mapping after it belongs to the GPU again
+static void UIContext_xs_release_reserved(void *arg) {
+	SV *sv= (SV*) arg;
+	if (SvPOK(sv) && !SvLEN(sv)) {
+		SvPV_set(sv, NULL);
+		SvCUR_set(sv, 0);
+	}
+	SvOK_off(sv);
+	SvREFCNT_dec(sv);
+}
+
+// Hand out 'len' bytes of the stream as a scalar whose string buffer is the
+// mapped memory itself (SvLEN of 0 tells perl it doesn't own the buffer),
+// or an ordinary zero-filled scalar without a persistent mapping.
+static SV *UIContext_xs_stream_reserve(UIContext *cx, size_t len) {
+	SV *sv= sv_2mortal(newSV(0));
+	char *ptr= (char*) UIContext_stream_reserve(cx, len, UIContext_xs_release_reserved, sv);
+	SvREFCNT_inc_simple_void_NN(sv); // held until released
+	sv_upgrade(sv, SVt_PV);
+	if (ptr) {
+		SvPV_set(sv, ptr);
+		SvLEN_set(sv, 0);
+	}
+	else {
+		SvGROW(sv, len+1);
+		Zero(SvPVX(sv), len+1, char);
+	}
+	SvCUR_set(sv, len);
+	SvPOK_only(sv);
+	return newRV_inc(sv);
+}
+
+static int UIContext_xs_draw_reserved(UIContext *cx, GLenum mode, const char *format) {
+	UIContext_stream *s= cx->stream;
+	SV *sv= s && s->reserved? (SV*) s->reserved_arg : NULL;
+	if (!sv)
+		croak("No vertices reserved; call stream_reserve first");
+	if ((SvPOK(sv)? SvCUR(sv) : 0) != s->reserved_len)
+		croak("Reserved scalar changed length; write it with substr or vec");
+	return UIContext_draw_reserved(cx, mode, format, SvPVX(sv), SvCUR(sv));
+}
 
 MODULE = X11::MinimalOpenGLContext		PACKAGE = X11::MinimalOpenGLContext::UIContext
 
+BOOT:
+	UIContext_set_fatal_handler(UIContext_xs_fatal_handler);
+
 SV *
 new(pkg)
 	const char * pkg
@@ -79,6 +259,7 @@ void
 DESTROY(cx)
 	UIContext * cx
 	CODE:
+		UIContext_xs_set_owner(cx, NULL);
 		UIContext_free(cx);
 
 void
@@ -93,12 +274,46 @@ screen_metrics(cx)
 		XPUSHs(sv_2mortal(newSViv(w_mm)));
 		XPUSHs(sv_2mortal(newSViv(h_mm)));
 
+int
+client_resources(cx, dest)
+	UIContext * cx
+	HV * dest
+	INIT:
+		UIContext_resource_count counts[UICONTEXT_RESOURCE_TYPES_MAX];
+		int i;
+	CODE:
+		RETVAL= UIContext_client_resources(cx, counts, UICONTEXT_RESOURCE_TYPES_MAX);
+		for (i= 0; i < RETVAL && i < UICONTEXT_RESOURCE_TYPES_MAX; i++)
+			hv_store(dest, counts[i].name, strlen(counts[i].name), newSVuv(counts[i].count), 0);
+	OUTPUT:
+		RETVAL
+
+void
+set_owner(cx, owner)
+	UIContext * cx
+	SV * owner
+	CODE:
+		UIContext_xs_set_owner(cx, owner);
+
 void
-connect(cx, display)
+connect(cx, display, software= 0)
 	UIContext * cx
 	const char * display 
+	int software
 	CODE:
-		UIContext_connect(cx, display);
+		UIContext_connect(cx, display, software);
+
+void
+connect_egl(cx)
+	UIContext * cx
+	CODE:
+		UIContext_connect_egl(cx);
+
+void
+connect_osmesa(cx)
+	UIContext * cx
+	CODE:
+		UIContext_connect_osmesa(cx);
 
 void
 disconnect(cx)
@@ -121,12 +336,62 @@ XFlush(cx)
 		XFlush(cx->dpy);
 
 void
-setup_glcontext(cx, link_to, direct)
+setup_glcontext(cx, direct, link_to)
 	UIContext * cx
-	int link_to
 	int direct
+	int link_to
+	CODE:
+		UIContext_setup_glcontext(cx, direct, link_to);
+
+void
+set_fb_prefs(cx, depth, stencil, samples, srgb, single_buffer)
+	UIContext * cx
+	int depth
+	int stencil
+	int samples
+	int srgb
+	int single_buffer
 	CODE:
-		UIContext_setup_glcontext(cx, link_to, direct);
+		UIContext_set_fb_prefs(cx, depth, stencil, samples, srgb, single_buffer);
+
+void
+set_fbconfig_cache(cx, path)
+	UIContext * cx
+	const char *path
+	CODE:
+		UIContext_set_fbconfig_cache(cx, path);
+
+void
+fbconfig_attribs(cx, for_pixmaps= 0)
+	UIContext * cx
+	int for_pixmaps
+	PPCODE:
+		EXTEND(SP, 14);
+		PUSHs(sv_2mortal(newSVpvs("id")));
+		PUSHs(sv_2mortal(newSViv(UIContext_get_fbconfig_attrib(cx, for_pixmaps, GLX_FBCONFIG_ID))));
+		PUSHs(sv_2mortal(newSVpvs("depth")));
+		PUSHs(sv_2mortal(newSViv(UIContext_get_fbconfig_attrib(cx, for_pixmaps, GLX_DEPTH_SIZE))));
+		PUSHs(sv_2mortal(newSVpvs("stencil")));
+		PUSHs(sv_2mortal(newSViv(UIContext_get_fbconfig_attrib(cx, for_pixmaps, GLX_STENCIL_SIZE))));
+		PUSHs(sv_2mortal(newSVpvs("samples")));
+		PUSHs(sv_2mortal(newSViv(UIContext_get_fbconfig_attrib(cx, for_pixmaps, GLX_SAMPLES))));
+		PUSHs(sv_2mortal(newSVpvs("srgb")));
+		PUSHs(sv_2mortal(newSViv(UIContext_get_fbconfig_attrib(cx, for_pixmaps, GLX_FRAMEBUFFER_SRGB_CAPABLE_ARB))));
+		PUSHs(sv_2mortal(newSVpvs("double_buffer")));
+		PUSHs(sv_2mortal(newSViv(UIContext_get_fbconfig_attrib(cx, for_pixmaps, GLX_DOUBLEBUFFER))));
+		PUSHs(sv_2mortal(newSVpvs("drawable_type")));
+		PUSHs(sv_2mortal(newSViv(UIContext_get_fbconfig_attrib(cx, for_pixmaps, GLX_DRAWABLE_TYPE))));
+
+void
+set_context_attribs(cx, major, minor, profile, no_error, robust)
+	UIContext * cx
+	int major
+	int minor
+	const char *profile
+	int no_error
+	int robust
+	CODE:
+		UIContext_set_context_attribs(cx, major, minor, UIContext_profile_by_name(profile), no_error, robust);
 
 void
 teardown_glcontext(cx)
@@ -144,6 +409,46 @@ create_pixmap(cx, w, h)
 	OUTPUT:
 		RETVAL
 
+int
+create_mapped_pixmap(cx, w, h, path)
+	UIContext * cx
+	int w
+	int h
+	const char * path
+	CODE:
+		if (cx->backend != UICONTEXT_BACKEND_OSMESA)
+			croak("Memory-mapped pixmaps require the OSMesa backend");
+		RETVAL= UIContext_create_membuf(cx, w, h, path);
+	OUTPUT:
+		RETVAL
+
+SV*
+pixmap_buffer(cx, xid)
+	UIContext * cx
+	int xid
+	INIT:
+		UIContext_membuf *mb;
+		SV *buf;
+	PPCODE:
+		if (cx->backend != UICONTEXT_BACKEND_OSMESA)
+			croak("Pixmap memory is only available with the OSMesa backend");
+		mb= UIContext_get_membuf(cx, xid);
+		// Return a ref to a read-only scalar aliasing the pixels, rather than a copy.
+		// SvLEN of 0 tells perl it doesn't own the buffer.  The membuf holds
+		// one reference, and empties the scalar before the memory goes away.
+		if (!(buf= (SV*) mb->on_release_arg)) {
+			buf= newSV(0);
+			sv_upgrade(buf, SVt_PV);
+			SvPV_set(buf, (char*) mb->pixels);
+			SvCUR_set(buf, mb->size);
+			SvLEN_set(buf, 0);
+			SvPOK_only(buf);
+			SvREADONLY_on(buf);
+			mb->on_release= UIContext_xs_membuf_released;
+			mb->on_release_arg= buf;
+		}
+		XPUSHs(sv_2mortal(newRV_inc(buf)));
+
 void
 destroy_pixmap(cx, xid)
 	UIContext * cx
@@ -151,6 +456,40 @@ destroy_pixmap(cx, xid)
 	CODE:
 		UIContext_destroy_pixmap(cx, xid);
 
+void
+release_pixmap(cx, xid, w, h)
+	UIContext * cx
+	int xid
+	int w
+	int h
+	CODE:
+		UIContext_release_pixmap(cx, xid, w, h);
+
+void
+set_pixmap_pool(cx, limit)
+	UIContext * cx
+	int limit
+	CODE:
+		UIContext_set_pixmap_pool(cx, limit);
+
+void
+pixmap_pool_stats(cx)
+	UIContext * cx
+	INIT:
+		int count, limit;
+		unsigned long hits, misses;
+	PPCODE:
+		UIContext_get_pixmap_pool_stats(cx, &count, &limit, &hits, &misses);
+		EXTEND(SP, 8);
+		PUSHs(sv_2mortal(newSVpvs("count")));
+		PUSHs(sv_2mortal(newSViv(count)));
+		PUSHs(sv_2mortal(newSVpvs("limit")));
+		PUSHs(sv_2mortal(newSViv(limit)));
+		PUSHs(sv_2mortal(newSVpvs("hits")));
+		PUSHs(sv_2mortal(newSVuv(hits)));
+		PUSHs(sv_2mortal(newSVpvs("misses")));
+		PUSHs(sv_2mortal(newSVuv(misses)));
+
 int
 create_window(cx, x, y, w, h)
 	UIContext * cx
@@ -184,6 +523,17 @@ window_rect(cx, wnd)
 		XPUSHs(sv_2mortal(newSViv(w)));
 		XPUSHs(sv_2mortal(newSViv(h)));
 
+UV
+window_pixel(cx, wnd, x, y)
+	UIContext * cx
+	int wnd
+	int x
+	int y
+	CODE:
+		RETVAL= UIContext_get_window_pixel(cx, wnd, x, y);
+	OUTPUT:
+		RETVAL
+
 void
 window_set_blank_cursor(cx, wnd)
 	UIContext * cx
@@ -196,8 +546,11 @@ XSetWMNormalHints(cx, wnd, hints)
 	UIContext * cx
 	int wnd
 	HV* hints
+	INIT:
+		XSizeHints sh;
 	CODE:
-		UIContext_XSetWMNormalHints(cx, wnd, hints);
+		UIContext_xs_load_size_hints(hints, &sh);
+		UIContext_XSetWMNormalHints(cx, wnd, &sh);
 
 void
 XMapWindow(cx, wnd, wait_msec)
@@ -214,18 +567,285 @@ glXMakeCurrent(cx, xid)
 	CODE:
 		UIContext_glXMakeCurrent(cx, xid);
 
+void
+make_context_current(cx, draw, read)
+	UIContext * cx
+	int draw
+	int read
+	CODE:
+		UIContext_make_context_current(cx, draw, read);
+
+void
+blit(cx, src, sx, sy, sw, sh, dst, dx, dy, dw, dh, linear= 1)
+	UIContext * cx
+	int src
+	int sx
+	int sy
+	int sw
+	int sh
+	int dst
+	int dx
+	int dy
+	int dw
+	int dh
+	int linear
+	CODE:
+		UIContext_blit(cx, src, sx, sy, sw, sh, dst, dx, dy, dw, dh, linear);
+
+void
+_set_gl_can_blit(cx, can_blit)
+	UIContext * cx
+	int can_blit
+	CODE:
+		// For tests: 0 forces blit's glCopyPixels path, -1 detects support again
+		cx->gl_can_blit= can_blit;
+
 void
 glXSwapBuffers(cx)
 	UIContext * cx
 	CODE:
 		UIContext_glXSwapBuffers(cx);
 
+int
+present(cx, check_errors= 1, flush= 1, damage= NULL)
+	UIContext * cx
+	int check_errors
+	int flush
+	SV * damage
+	INIT:
+		const char *rects= NULL;
+		STRLEN len= 0;
+	CODE:
+		// damage is a packed string of native int x,y,w,h
+		if (damage && SvOK(damage))
+			rects= SvPVbyte(damage, len);
+		RETVAL= UIContext_present_damage(cx,
+			(check_errors? UICONTEXT_PRESENT_CHECK_ERRORS : 0)
+			| (flush? UICONTEXT_PRESENT_FLUSH : 0),
+			(const int*) rects, len / (4 * sizeof(int)));
+	OUTPUT:
+		RETVAL
+
+int
+buffer_age(cx)
+	UIContext * cx
+	CODE:
+		RETVAL= UIContext_buffer_age(cx);
+	OUTPUT:
+		RETVAL
+
+void
+set_gl_debug(cx, enable)
+	UIContext * cx
+	int enable
+	CODE:
+		UIContext_set_gl_debug(cx, enable);
+
+unsigned
+drain_debug_messages(cx, dest, max= 0)
+	UIContext * cx
+	AV * dest
+	int max
+	CODE:
+		RETVAL= UIContext_xs_drain_debug_messages(cx, max, dest);
+	OUTPUT:
+		RETVAL
+
+void
+present_error_names(cx, status)
+	UIContext * cx
+	int status
+	INIT:
+		int i;
+	PPCODE:
+		PERL_UNUSED_VAR(cx);
+		for (i= 0; i < 8; i++)
+			if (status & (1 << i))
+				XPUSHs(sv_2mortal(newSVpv(UIContext_present_err_names[i], 0)));
+
+SV*
+project_frustum(cx, target_w, target_h, viewport, frustum, pixel_aspect, depth, mirror_x, mirror_y, apply)
+	UIContext * cx
+	int target_w
+	int target_h
+	AV * viewport
+	AV * frustum
+	double pixel_aspect
+	double depth
+	int mirror_x
+	int mirror_y
+	int apply
+	INIT:
+		UIContext_projection p;
+		double m[16];
+		float packed[16];
+		int vp[4];
+		double fr[4]= { NAN, NAN, 0, 0 };
+		SV **el;
+		int i;
+	CODE:
+		// Elements of the rects may be undef, meaning "use the default"
+		for (i= 0; i < 4; i++) {
+			vp[i]= (el= av_fetch(viewport, i, 0)) && SvOK(*el)? SvIV(*el) : 0;
+			if ((el= av_fetch(frustum, i, 0)) && SvOK(*el))
+				fr[i]= SvNV(*el);
+		}
+		p.x= vp[0]; p.y= vp[1]; p.w= vp[2]; p.h= vp[3];
+		p.fx= fr[0]; p.fy= fr[1]; p.fw= fr[2]; p.fh= fr[3];
+		p.pixel_aspect= pixel_aspect > 0? pixel_aspect : 1;
+		p.depth= depth;
+		p.mirror_x= mirror_x;
+		p.mirror_y= mirror_y;
+		UIContext_frustum_matrix(&p, target_w, target_h, m);
+		if (apply)
+			UIContext_project_frustum(cx, &p, m);
+		for (i= 0; i < 16; i++)
+			packed[i]= (float) m[i];
+		RETVAL= newSVpvn((const char*) packed, sizeof(packed));
+	OUTPUT:
+		RETVAL
+
+int
+draw_vertices(cx, mode, format, data)
+	UIContext * cx
+	unsigned mode
+	const char *format
+	SV * data
+	INIT:
+		STRLEN len;
+		const char *buf= SvPVbyte(data, len);
+	CODE:
+		RETVAL= UIContext_draw_vertices(cx, mode, format, buf, len);
+	OUTPUT:
+		RETVAL
+
+SV*
+stream_reserve(cx, len)
+	UIContext * cx
+	UV len
+	CODE:
+		RETVAL= UIContext_xs_stream_reserve(cx, len);
+	OUTPUT:
+		RETVAL
+
+int
+draw_reserved(cx, mode, format)
+	UIContext * cx
+	unsigned mode
+	const char *format
+	CODE:
+		RETVAL= UIContext_xs_draw_reserved(cx, mode, format);
+	OUTPUT:
+		RETVAL
+
+void
+set_stream_persistent(cx, enable)
+	UIContext * cx
+	int enable
+	CODE:
+		cx->stream_orphan= !enable;
+
+void
+stream_stats(cx)
+	UIContext * cx
+	PPCODE:
+		EXTEND(SP, 14);
+		PUSHs(sv_2mortal(newSVpvs("draws")));
+		PUSHs(sv_2mortal(newSVuv(cx->stream? cx->stream->draws : 0)));
+		PUSHs(sv_2mortal(newSVpvs("bytes")));
+		PUSHs(sv_2mortal(newSVuv(cx->stream? cx->stream->bytes : 0)));
+		PUSHs(sv_2mortal(newSVpvs("orphans")));
+		PUSHs(sv_2mortal(newSVuv(cx->stream? cx->stream->orphans : 0)));
+		PUSHs(sv_2mortal(newSVpvs("buffer_size")));
+		PUSHs(sv_2mortal(newSVuv(cx->stream? cx->stream->size : 0)));
+		PUSHs(sv_2mortal(newSVpvs("persistent")));
+		PUSHs(sv_2mortal(newSViv(cx->stream && cx->stream->map)));
+		PUSHs(sv_2mortal(newSVpvs("region_size")));
+		PUSHs(sv_2mortal(newSVuv(cx->stream? cx->stream->region_size : 0)));
+		PUSHs(sv_2mortal(newSVpvs("fence_waits")));
+		PUSHs(sv_2mortal(newSVuv(cx->stream? cx->stream->fence_waits : 0)));
+
+void
+present_stats(cx)
+	UIContext * cx
+	PPCODE:
+		EXTEND(SP, 12);
+		PUSHs(sv_2mortal(newSVpvs("count")));
+		PUSHs(sv_2mortal(newSVuv(cx->present_count)));
+		PUSHs(sv_2mortal(newSVpvs("interval")));
+		PUSHs(sv_2mortal(newSVnv(cx->present_interval)));
+		PUSHs(sv_2mortal(newSVpvs("duration")));
+		PUSHs(sv_2mortal(newSVnv(cx->present_duration)));
+		PUSHs(sv_2mortal(newSVpvs("make_current")));
+		PUSHs(sv_2mortal(newSVuv(cx->make_current_count)));
+		PUSHs(sv_2mortal(newSVpvs("make_current_skipped")));
+		PUSHs(sv_2mortal(newSVuv(cx->make_current_skipped)));
+		PUSHs(sv_2mortal(newSVpvs("partial")));
+		PUSHs(sv_2mortal(newSVuv(cx->present_partial_count)));
+
+void
+vk_setup(cx, wnd, present_mode, image_count, frames_in_flight)
+	UIContext * cx
+	int wnd
+	const char * present_mode
+	int image_count
+	int frames_in_flight
+	CODE:
+		UIContext_vk_setup(cx, wnd, UIContext_vk_present_mode_by_name(present_mode),
+			image_count, frames_in_flight);
+
+int
+vk_present(cx, pixels= NULL)
+	UIContext * cx
+	SV * pixels
+	INIT:
+		const char *buf= NULL;
+		STRLEN len= 0;
+	CODE:
+		if (pixels && SvOK(pixels))
+			buf= SvPV(pixels, len);
+		RETVAL= UIContext_vk_present(cx, buf, len);
+	OUTPUT:
+		RETVAL
+
+void
+vk_info(cx)
+	UIContext * cx
+	INIT:
+		int w, h, image_count, frames_in_flight;
+		const char *present_mode;
+	PPCODE:
+		UIContext_vk_get_info(cx, &w, &h, &image_count, &frames_in_flight, &present_mode);
+		EXTEND(SP, 10);
+		PUSHs(sv_2mortal(newSVpvs("width")));
+		PUSHs(sv_2mortal(newSViv(w)));
+		PUSHs(sv_2mortal(newSVpvs("height")));
+		PUSHs(sv_2mortal(newSViv(h)));
+		PUSHs(sv_2mortal(newSVpvs("image_count")));
+		PUSHs(sv_2mortal(newSViv(image_count)));
+		PUSHs(sv_2mortal(newSVpvs("frames_in_flight")));
+		PUSHs(sv_2mortal(newSViv(frames_in_flight)));
+		PUSHs(sv_2mortal(newSVpvs("present_mode")));
+		PUSHs(sv_2mortal(newSVpv(present_mode, 0)));
+
+void
+vk_teardown(cx)
+	UIContext * cx
+	CODE:
+		UIContext_vk_teardown(cx);
+
 SV*
 display(cx)
 	UIContext * cx
 	PPCODE:
 		XPUSHs(sv_2mortal(newSVpvf("%p", cx->dpy)));
 
+SV*
+backend(cx)
+	UIContext * cx
+	PPCODE:
+		XPUSHs(sv_2mortal(newSVpv(UIContext_backend_names[cx->backend], 0)));
+
 SV*
 glctx_id(cx)
 	UIContext * cx
@@ -236,7 +856,7 @@ SV*
 has_glcontext(cx)
 	UIContext * cx
 	PPCODE:
-		XPUSHs(sv_2mortal(newSViv(cx->glctx? 1 : 0)));
+		XPUSHs(sv_2mortal(newSViv(UIContext_has_glcontext(cx))));
 
 SV*
 current_gl_target(cx)
@@ -257,8 +877,216 @@ glx_extensions(cx)
 	PPCODE:
 		XPUSHs(sv_2mortal(newSVpv(cx->glx_extensions? cx->glx_extensions : "", 0)));
 
+int
+has_glx_extension(cx, name)
+	UIContext * cx
+	const char *name
+	CODE:
+		RETVAL= UIContext_has_glx_extension(cx, name);
+	OUTPUT:
+		RETVAL
+
+void
+startup_phase_times(cx)
+	UIContext * cx
+	INIT:
+		int i;
+	PPCODE:
+		for (i= 0; i < UICONTEXT_PHASE_COUNT; i++) {
+			if (cx->phase_time[i] < 0) continue;
+			XPUSHs(sv_2mortal(newSVpv(UIContext_phase_names[i], 0)));
+			XPUSHs(sv_2mortal(newSVnv(cx->phase_time[i])));
+		}
+
 void
 get_xlib_error_codes(dest)
 	HV * dest
 	CODE:
-		UIContext_get_xlib_error_codes(dest);
+		UIContext_xs_get_xlib_error_codes(dest);
+
+int
+x_errors_pending()
+	CODE:
+		RETVAL= UIContext_x_errors_pending();
+	OUTPUT:
+		RETVAL
+
+unsigned
+drain_x_errors(dest)
+	AV * dest
+	CODE:
+		RETVAL= UIContext_xs_drain_x_errors(dest);
+	OUTPUT:
+		RETVAL
+
+MODULE = X11::MinimalOpenGLContext		PACKAGE = X11::MinimalOpenGLContext::GL
+
+unsigned
+glGetError()
+	CODE:
+		RETVAL= UIContext_get_current_gl()->GetError();
+	OUTPUT:
+		RETVAL
+
+SV*
+glGetString(name)
+	unsigned name
+	INIT:
+		const char *str;
+	CODE:
+		str= (const char*) UIContext_get_current_gl()->GetString(name);
+		RETVAL= str? newSVpv(str, 0) : &PL_sv_undef;
+	OUTPUT:
+		RETVAL
+
+void
+glEnable(cap)
+	unsigned cap
+	CODE:
+		UIContext_get_current_gl()->Enable(cap);
+
+void
+glDisable(cap)
+	unsigned cap
+	CODE:
+		UIContext_get_current_gl()->Disable(cap);
+
+void
+glFlush()
+	CODE:
+		UIContext_get_current_gl()->Flush();
+
+void
+glFinish()
+	CODE:
+		UIContext_get_current_gl()->Finish();
+
+void
+glViewport(x, y, w, h)
+	int x
+	int y
+	int w
+	int h
+	CODE:
+		UIContext_get_current_gl()->Viewport(x, y, w, h);
+
+void
+glClearColor(r, g, b, a)
+	double r
+	double g
+	double b
+	double a
+	CODE:
+		UIContext_get_current_gl()->ClearColor(r, g, b, a);
+
+void
+glClear(mask)
+	unsigned mask
+	CODE:
+		UIContext_get_current_gl()->Clear(mask);
+
+void
+glFrontFace(mode)
+	unsigned mode
+	CODE:
+		UIContext_get_current_gl()->FrontFace(mode);
+
+void
+glPixelStorei(pname, param)
+	unsigned pname
+	int param
+	CODE:
+		UIContext_get_current_gl()->PixelStorei(pname, param);
+
+SV*
+glReadPixels(x, y, w, h, format, type)
+	int x
+	int y
+	int w
+	int h
+	unsigned format
+	unsigned type
+	INIT:
+		UIContext_gl_fn *gl= UIContext_get_current_gl();
+		size_t pixel_size= UIContext_gl_pixel_size(format, type), row_size;
+		GLint align= 4;
+	CODE:
+		if (!pixel_size)
+			croak("Unsupported glReadPixels format 0x%X / type 0x%X", format, type);
+		if (w < 0 || h < 0)
+			croak("Invalid glReadPixels dimensions %dx%d", w, h);
+		// rows are padded to GL_PACK_ALIGNMENT, like the GL will write them
+		gl->GetIntegerv(GL_PACK_ALIGNMENT, &align);
+		row_size= (w * pixel_size + align - 1) / align * align;
+		RETVAL= newSV(row_size * h + 1);
+		SvPOK_on(RETVAL);
+		gl->ReadPixels(x, y, w, h, format, type, SvPVX(RETVAL));
+		SvCUR_set(RETVAL, row_size * h);
+	OUTPUT:
+		RETVAL
+
+void
+glMatrixMode(mode)
+	unsigned mode
+	INIT:
+		UIContext_gl_fn *gl= UIContext_get_current_gl();
+	CODE:
+		if (!gl->MatrixMode) croak("glMatrixMode is not supported by this GL");
+		gl->MatrixMode(mode);
+
+void
+glLoadIdentity()
+	INIT:
+		UIContext_gl_fn *gl= UIContext_get_current_gl();
+	CODE:
+		if (!gl->LoadIdentity) croak("glLoadIdentity is not supported by this GL");
+		gl->LoadIdentity();
+
+void
+glLoadMatrixd(...)
+	INIT:
+		UIContext_gl_fn *gl= UIContext_get_current_gl();
+		GLdouble m[16];
+		STRLEN len;
+		const char *packed;
+		int i;
+	CODE:
+		if (!gl->LoadMatrixd) croak("glLoadMatrixd is not supported by this GL");
+		// Either 16 numbers, or one string from pack('d16')
+		if (items == 1) {
+			packed= SvPVbyte(ST(0), len);
+			if (len != sizeof(m))
+				croak("Expected packed matrix of %d bytes", (int) sizeof(m));
+			memcpy(m, packed, sizeof(m));
+		}
+		else if (items == 16) {
+			for (i= 0; i < 16; i++)
+				m[i]= SvNV(ST(i));
+		}
+		else croak("Expected 16 matrix elements");
+		gl->LoadMatrixd(m);
+
+void
+glFrustum(left, right, bottom, top, near, far)
+	double left
+	double right
+	double bottom
+	double top
+	double near
+	double far
+	INIT:
+		UIContext_gl_fn *gl= UIContext_get_current_gl();
+	CODE:
+		if (!gl->Frustum) croak("glFrustum is not supported by this GL");
+		gl->Frustum(left, right, bottom, top, near, far);
+
+void
+glTranslated(x, y, z)
+	double x
+	double y
+	double z
+	INIT:
+		UIContext_gl_fn *gl= UIContext_get_current_gl();
+	CODE:
+		if (!gl->Translated) croak("glTranslated is not supported by this GL");
+		gl->Translated(x, y, z);
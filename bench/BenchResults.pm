@@ -0,0 +1,52 @@
+package BenchResults;
+use strict;
+use warnings;
+use JSON::PP;
+
+# Results of the scripts in bench/.  Each one is printed as a
+# "name TAB value TAB unit" line as it is recorded, unless the JSON goes to
+# stdout, and they can all be written out as JSON along with whatever else
+# the script wants to include.
+#
+#   my $results= BenchResults->new(json => $opt{json});
+#   $results->record(swap => $frames_per_s, 'frames/s');
+#   $results->write_json(env => \%env);
+
+sub new {
+	my ($class, %opt)= @_;
+	return bless { json => $opt{json}, results => {} }, $class;
+}
+
+sub results { $_[0]{results} }
+
+# Rates (anything per second) are better when higher, everything else
+# (times, growth, leaks, errors) when lower.
+sub record {
+	my ($self, $name, $value, $unit)= @_;
+	$self->{results}{$name}= {
+		value  => 0+sprintf('%.6g', $value),
+		unit   => $unit,
+		better => ($unit =~ m{/s\z}? 'higher' : 'lower'),
+	};
+	printf "%s\t%.6g\t%s\n", $name, $value, $unit
+		unless defined $self->{json} && $self->{json} eq '-';
+}
+
+sub json_codec { JSON::PP->new->canonical->pretty }
+
+# Write { %extra, results => ... } to the --json file (or stdout for '-')
+sub write_json {
+	my ($self, %extra)= @_;
+	my $path= $self->{json};
+	return unless defined $path;
+	my $out= $self->json_codec->encode({ %extra, results => $self->{results} });
+	if ($path eq '-') {
+		print $out;
+	} else {
+		open my $fh, '>', $path or die "Can't write $path: $!\n";
+		print $fh $out;
+		close $fh or die "Can't write $path: $!\n";
+	}
+}
+
+1;
@@ -0,0 +1,53 @@
+package BenchXvfb;
+use strict;
+use warnings;
+use POSIX ();
+use Time::HiRes 'sleep';
+
+# A private Xvfb for the scripts in bench/, so their numbers don't depend on
+# the desktop, compositor or GPU of the machine running them.  Mesa is told
+# to render with llvmpipe.  The server is stopped when the object goes away.
+#
+#   my $xvfb= BenchXvfb->start;
+#   $glc->connect($xvfb->display);
+
+sub start {
+	my $class= shift;
+	my $num= 99;
+	$num++ while -e "/tmp/.X11-unix/X$num" || -e "/tmp/.X$num-lock";
+	my @cmd= ('Xvfb', ":$num", -screen => 0, '1280x1024x24', '+extension', 'GLX',
+		'-nolisten', 'tcp', '-noreset');
+	defined(my $pid= fork) or die "fork: $!\n";
+	if (!$pid) {
+		open STDOUT, '>', '/dev/null';
+		open STDERR, '>', '/dev/null';
+		exec @cmd or POSIX::_exit(127);
+	}
+	my $self= bless { pid => $pid, display => ":$num" }, $class;
+	for (1 .. 100) {
+		if (-S "/tmp/.X11-unix/X$num") {
+			$ENV{LIBGL_ALWAYS_SOFTWARE}= 1;
+			$ENV{GALLIUM_DRIVER}= 'llvmpipe';
+			return $self;
+		}
+		if (waitpid($pid, POSIX::WNOHANG()) == $pid) {
+			delete $self->{pid};
+			die "Xvfb failed to start (is it installed?)  Use --display to run against another X server\n";
+		}
+		sleep .1;
+	}
+	die "Xvfb did not create its socket within 10 seconds\n";
+}
+
+sub display { $_[0]{display} }
+
+sub stop {
+	my $self= shift;
+	my $pid= delete $self->{pid} or return;
+	kill TERM => $pid;
+	waitpid($pid, 0);
+}
+
+sub DESTROY { $_[0]->stop }
+
+1;
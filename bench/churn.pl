@@ -0,0 +1,222 @@
+#! /usr/bin/env perl
+use strict;
+use warnings;
+use Getopt::Long;
+use Pod::Usage;
+use JSON::PP ();
+use POSIX ();
+use Time::HiRes qw( clock_gettime CLOCK_MONOTONIC );
+use FindBin;
+use lib $FindBin::Bin;
+use BenchXvfb;
+use BenchResults;
+use X11::MinimalOpenGLContext;
+use X11::MinimalOpenGLContext::GL ':all';
+
+=head1 NAME
+
+bench/churn.pl - Create and destroy rendering targets and contexts, looking for leaks
+
+=head1 SYNOPSIS
+
+  perl -Mblib bench/churn.pl [OPTIONS]
+  perl -Mblib bench/churn.pl --count 10000 --rounds 5 --json churn.json
+
+=head1 DESCRIPTION
+
+Long-running programs that create targets all day need both the create and
+the destroy to be cheap, and need the destroy to actually free everything on
+the X server.  This runs several rounds of:
+
+  windows   create a Window, render to it once, destroy it
+  pixmaps   create a Pixmap, render to it once, destroy it
+  contexts  setup_glcontext followed by teardown_glcontext
+
+and reports the operations per second of each.  After each round it asks the
+X server for the number of resources of each type owned by the connection
+(L<X11::MinimalOpenGLContext/client_resources>, using the X-Resource
+extension), and the resident size of this process.  The first round is
+allowed to grow (caches, fbconfigs, the blank cursor...), but any resource
+type that keeps growing after that is reported as a leak, and the exit code
+is 3.
+
+For the C<glx> and C<xshm> backends a private Xvfb is started unless
+C<--display> is given (see bench/run.pl).  With C<egl> and C<osmesa> there are
+no server resources, and only the speed and process size are reported.
+
+Output is one C<name E<lt>TABE<gt> value E<lt>TABE<gt> unit> line per result,
+or JSON (including every round) with C<--json>.
+
+=head1 OPTIONS
+
+=over
+
+=item --backend NAME
+
+glx (default), xshm, egl or osmesa
+
+=item --display DISPLAY
+
+Use an existing X server instead of starting Xvfb
+
+=item --count N
+
+Operations per phase in each round, default 2000
+
+=item --rounds N
+
+Default 3, at least 2
+
+=item --size WxH
+
+Size of the targets, default 64x64
+
+=item --phases LIST
+
+Comma-separated subset of C<windows,pixmaps,contexts>
+
+=item --pixmap-pool N
+
+Set L<X11::MinimalOpenGLContext/pixmap_pool>, to measure the pixmaps phase
+with recycling
+
+=item --json FILE
+
+Write the results as JSON to FILE, or C<-> for stdout (instead of the text
+lines)
+
+=back
+
+=cut
+
+my %opt= (
+	backend => 'glx',
+	count   => 2000,
+	rounds  => 3,
+	size    => '64x64',
+	phases  => 'windows,pixmaps,contexts',
+);
+GetOptions(\%opt, 'backend=s', 'display=s', 'count=i', 'rounds=i', 'size=s',
+	'phases=s', 'pixmap-pool=i', 'json=s', 'help')
+	or pod2usage(2);
+pod2usage(1) if $opt{help};
+my ($w, $h)= ($opt{size} =~ /^(\d+)x(\d+)$/) or pod2usage("Invalid --size '$opt{size}'");
+$opt{backend} =~ /^(glx|xshm|egl|osmesa)$/ or pod2usage("Unknown --backend '$opt{backend}'");
+$opt{count} > 0 && $opt{rounds} >= 2 or pod2usage("--count must be positive and --rounds at least 2");
+my $uses_x11= $opt{backend} eq 'glx' || $opt{backend} eq 'xshm';
+my @phases= split /,/, $opt{phases};
+/^(windows|pixmaps|contexts)$/ or pod2usage("Unknown phase '$_'") for @phases;
+@phases= grep $_ ne 'windows', @phases unless $uses_x11;
+
+my $display= $opt{display};
+my $xvfb;
+if ($uses_x11 && !defined $display) {
+	$xvfb= BenchXvfb->start;
+	$display= $xvfb->display;
+}
+$SIG{INT}= $SIG{TERM}= sub { $xvfb->stop if $xvfb; exit 130 };
+
+my $x_errors= 0;
+my $glc= X11::MinimalOpenGLContext->new(
+	backend     => $opt{backend},
+	display     => $display,
+	pixmap_pool => $opt{'pixmap-pool'},
+	on_error    => sub { $x_errors += $_[1]{count} || 1 },
+);
+$glc->setup_glcontext;
+my $keep= $glc->create_pixmap($w, $h);
+$glc->set_gl_target($keep);
+
+# Draw something, so that the GL side of the target is really created
+sub touch {
+	glClear(GL_COLOR_BUFFER_BIT);
+	glFlush();
+}
+
+my %churn= (
+	windows => sub {
+		my $wnd= $glc->create_window([0, 0, $w, $h]);
+		$glc->set_gl_target($wnd);
+		touch();
+		$glc->set_gl_target($keep);
+	},
+	pixmaps => sub {
+		my $pxm= $glc->create_pixmap($w, $h);
+		$glc->set_gl_target($pxm);
+		touch();
+		$glc->set_gl_target($keep);
+	},
+	contexts => sub {
+		$glc->_ui_context->teardown_glcontext;
+		$glc->setup_glcontext;
+		$glc->set_gl_target($keep);
+		touch();
+	},
+);
+
+# Resident set size in KiB, from /proc
+sub rss_kib {
+	open my $fh, '<', '/proc/self/statm' or return 0;
+	my (undef, $pages)= split ' ', scalar <$fh>;
+	return $pages * POSIX::sysconf(POSIX::_SC_PAGESIZE()) / 1024;
+}
+
+# Also a round trip, so everything queued has been processed by the server
+sub snapshot {
+	glFinish();
+	$glc->process_x_errors;
+	my $res= $uses_x11? $glc->client_resources : undef;
+	return { rss_kib => rss_kib(), ($res? (resources => $res) : ()) };
+}
+
+my %rounds;
+for my $round (1 .. $opt{rounds}) {
+	for my $phase (@phases) {
+		my $code= $churn{$phase};
+		my $t= clock_gettime(CLOCK_MONOTONIC);
+		$code->() for 1 .. $opt{count};
+		my $after= snapshot();
+		$after->{ops_per_s}= $opt{count} / (clock_gettime(CLOCK_MONOTONIC) - $t);
+		push @{ $rounds{$phase} }, $after;
+	}
+}
+my $resources_available= grep $_->{resources}, map @$_, values %rounds;
+warn "X-Resource is not available; only checking process size\n"
+	if $uses_x11 && !$resources_available;
+
+my $results= BenchResults->new(json => $opt{json});
+$|= 1;
+my $leaks= 0;
+for my $phase (@phases) {
+	my ($first, $last)= @{ $rounds{$phase} }[0, -1];
+	my @rates= sort { $a <=> $b } map $_->{ops_per_s}, @{ $rounds{$phase} };
+	$results->record($phase, $rates[$#rates/2], 'ops/s');
+	$results->record("$phase.rss_growth", ($last->{rss_kib} - $first->{rss_kib}) * 1000
+		/ ($opt{count} * ($opt{rounds}-1)), 'KiB/1000ops');
+	next unless $first->{resources} && $last->{resources};
+	my %types= map +($_ => 1), keys %{ $first->{resources} }, keys %{ $last->{resources} };
+	for my $type (sort keys %types) {
+		my $growth= ($last->{resources}{$type} || 0) - ($first->{resources}{$type} || 0);
+		next unless $growth > 0;
+		$results->record("$phase.leaked.$type", $growth, 'resources');
+		$leaks++;
+	}
+}
+$results->record(x_errors => $x_errors, 'errors');
+
+$results->write_json(
+	env => {
+		backend     => $opt{backend},
+		size        => "${w}x${h}",
+		count       => $opt{count},
+		rounds      => $opt{rounds},
+		pixmap_pool => $opt{'pixmap-pool'} || 0,
+		xvfb        => $xvfb? JSON::PP::true : JSON::PP::false,
+		gl_renderer => glGetString(GL_RENDERER),
+	},
+	rounds => \%rounds,
+);
+
+undef $keep;
+$glc->disconnect;
+exit($leaks? 3 : 0);
@@ -0,0 +1,271 @@
+#! /usr/bin/env perl
+use strict;
+use warnings;
+use Getopt::Long;
+use Pod::Usage;
+use JSON::PP ();
+use POSIX ();
+use Time::HiRes qw( clock_gettime CLOCK_MONOTONIC );
+use FindBin;
+use lib $FindBin::Bin;
+use BenchXvfb;
+use BenchResults;
+use X11::MinimalOpenGLContext;
+use X11::MinimalOpenGLContext::GL ':all';
+
+=head1 NAME
+
+bench/run.pl - Performance regression benchmark for X11::MinimalOpenGLContext
+
+=head1 SYNOPSIS
+
+  make bench BENCH_ARGS="[OPTIONS]"  # includes --c-bench ./uicontext-bench
+  # or
+  perl -Mblib bench/run.pl [OPTIONS]
+
+  perl -Mblib bench/run.pl --json base.json
+  ... change things, rebuild ...
+  perl -Mblib bench/run.pl --json new.json --baseline base.json
+
+=head1 DESCRIPTION
+
+Measures the operations whose cost matters to long-running programs, through
+the public perl API:
+
+  connect                ms        new + connect + disconnect
+  setup_glcontext        ms        creating (and replacing) the GL context
+  target_create_destroy  ops/s     Window (or Pixmap) object created and dropped
+  make_current_switch    us        set_gl_target alternating between two targets
+  swap                   frames/s  glClear + show
+  draw_vertices          draws/s   one small triangle per draw_vertices
+  readback               MiB/s     glReadPixels of the whole target
+
+For the C<glx> and C<xshm> backends, a private Xvfb is started unless
+C<--display> is given, and Mesa is told to use llvmpipe, so that numbers
+don't depend on the desktop, the compositor or the GPU of the machine running
+it.  C<egl> and C<osmesa> run without an X server.
+
+Each measurement is repeated C<--repeat> times and the median is reported.
+Results are printed one per line as C<name E<lt>TABE<gt> value E<lt>TABE<gt>
+unit>, and can also be written as JSON with C<--json>.  Given a
+C<--baseline> JSON file from an earlier run, any result that is worse than
+the baseline by more than C<--tolerance> is listed on stderr, and the exit
+code is 3.
+
+=head1 OPTIONS
+
+=over
+
+=item --backend NAME
+
+glx (default), xshm, egl or osmesa
+
+=item --display DISPLAY
+
+Use an existing X server instead of starting Xvfb
+
+=item --size WxH
+
+Size of the targets, default 640x480
+
+=item --iterations N
+
+Number of operations per measurement, default 200.  Connect and context
+creation use a tenth of that.
+
+=item --repeat N
+
+Number of times each measurement is repeated, default 5
+
+=item --json FILE
+
+Write the results as JSON to FILE, or C<-> for stdout (instead of the text
+lines)
+
+=item --baseline FILE
+
+Compare against the JSON results of an earlier run
+
+=item --tolerance FRACTION
+
+Allowed difference from the baseline, default 0.2
+
+=item --c-bench PATH
+
+Also run the C benchmark (C<make uicontext-bench>) against the same display,
+and report its results with a C<c.> prefix
+
+=back
+
+=cut
+
+my %opt= (
+	backend    => 'glx',
+	size       => '640x480',
+	iterations => 200,
+	repeat     => 5,
+	tolerance  => 0.2,
+);
+GetOptions(\%opt, 'backend=s', 'display=s', 'size=s', 'iterations=i', 'repeat=i',
+	'json=s', 'baseline=s', 'tolerance=f', 'c-bench=s', 'help')
+	or pod2usage(2);
+pod2usage(1) if $opt{help};
+my ($w, $h)= ($opt{size} =~ /^(\d+)x(\d+)$/) or pod2usage("Invalid --size '$opt{size}'");
+$opt{backend} =~ /^(glx|xshm|egl|osmesa)$/ or pod2usage("Unknown --backend '$opt{backend}'");
+$opt{iterations} > 0 && $opt{repeat} > 0 or pod2usage("--iterations and --repeat must be positive");
+my $uses_x11= $opt{backend} eq 'glx' || $opt{backend} eq 'xshm';
+
+my $display= $opt{display};
+my $xvfb;
+if ($uses_x11 && !defined $display) {
+	$xvfb= BenchXvfb->start;
+	$display= $xvfb->display;
+}
+$SIG{INT}= $SIG{TERM}= sub { $xvfb->stop if $xvfb; exit 130 };
+
+my $n= $opt{iterations};
+my $results= BenchResults->new(json => $opt{json});
+
+sub now { clock_gettime(CLOCK_MONOTONIC) }
+
+# Run $code (which performs $count operations) --repeat times, and record the
+# median as a rate or as the time per operation.
+sub measure {
+	my ($name, $unit, $count, $code)= @_;
+	my @samples;
+	for (1 .. $opt{repeat}) {
+		my $t= now();
+		$code->();
+		my $elapsed= now() - $t;
+		push @samples,
+			$unit eq 'ms'? $elapsed / $count * 1000
+			: $unit eq 'us'? $elapsed / $count * 1000000
+			: $count / $elapsed;
+	}
+	@samples= sort { $a <=> $b } @samples;
+	$results->record($name, $samples[$#samples/2], $unit);
+}
+
+sub new_context {
+	X11::MinimalOpenGLContext->new(
+		backend  => $opt{backend},
+		display  => $display,
+		on_error => sub { warn "X11 error during benchmark: $_[1]{error_code_name} from ".($_[1]{operation}||'?')."\n" },
+	);
+}
+
+sub create_target {
+	my $glc= shift;
+	return $glc->create_pixmap($w, $h) unless $uses_x11;
+	my $wnd= $glc->create_window([0, 0, $w, $h]);
+	$wnd->map_window(2);
+	return $wnd;
+}
+
+$|= 1;
+my $few= int($n/10) + 1;
+
+measure(connect => 'ms', $few, sub {
+	for (1 .. $few) {
+		my $glc= new_context();
+		$glc->connect;
+		$glc->disconnect;
+	}
+});
+
+my $glc= new_context();
+$glc->connect;
+measure(setup_glcontext => 'ms', $few, sub {
+	$glc->setup_glcontext for 1 .. $few;
+});
+
+# A round trip at the end of each run, so destroys still queued in the
+# client are counted
+my $keep= create_target($glc);
+measure(target_create_destroy => 'ops/s', $n, sub {
+	if ($uses_x11) {
+		for (1 .. $n) { my $wnd= $glc->create_window([0, 0, $w, $h]); }
+	} else {
+		for (1 .. $n) { my $pxm= $glc->create_pixmap($w, $h); }
+	}
+	$keep->get_rect;
+});
+
+my @targets= ($keep, create_target($glc));
+$glc->set_gl_target($targets[0]);
+my %env= (
+	backend     => $opt{backend},
+	size        => "${w}x${h}",
+	iterations  => $n,
+	repeat      => $opt{repeat},
+	xvfb        => $xvfb? JSON::PP::true : JSON::PP::false,
+	gl_vendor   => glGetString(GL_VENDOR),
+	gl_renderer => glGetString(GL_RENDERER),
+	gl_version  => glGetString(GL_VERSION),
+	perl        => sprintf('%vd', $^V),
+	time        => POSIX::strftime('%Y-%m-%dT%H:%M:%SZ', gmtime),
+);
+glViewport(0, 0, $w, $h);
+
+glFinish();
+measure(make_current_switch => 'us', $n, sub {
+	$glc->set_gl_target($targets[$_ & 1]) for 1 .. $n;
+});
+$glc->set_gl_target($targets[0]);
+
+measure(swap => 'frames/s', $n, sub {
+	for (1 .. $n) {
+		glClearColor($_ & 1, 0, 0, 1);
+		glClear(GL_COLOR_BUFFER_BIT);
+		$glc->show;
+	}
+	glFinish();
+});
+
+my $triangle= pack 'f6', -1, -1, 1, -1, 0, 1;
+measure(draw_vertices => 'draws/s', $n*10, sub {
+	$glc->draw_vertices(GL_TRIANGLES, 'v2f', $triangle) for 1 .. $n*10;
+	glFinish();
+});
+
+glFinish();
+measure(readback => 'MiB/s', $few * $w * $h * 4 / (1024*1024), sub {
+	glReadPixels(0, 0, $w, $h, GL_RGBA, GL_UNSIGNED_BYTE) for 1 .. $few;
+});
+
+@targets= ();
+undef $keep;
+$glc->disconnect;
+
+if (defined $opt{'c-bench'}) {
+	local $ENV{DISPLAY}= $display if defined $display;
+	my @cmd= ($opt{'c-bench'}, -b => $opt{backend}, -n => $n, -s => "${w}x${h}",
+		(defined $display? (-d => $display) : ()));
+	open my $fh, '-|', @cmd or die "Can't run $opt{'c-bench'}: $!\n";
+	while (<$fh>) {
+		chomp;
+		my ($name, $value, $unit)= split /\t/;
+		$results->record("c.$name", $value, $unit) if defined $unit;
+	}
+	close $fh or die "$opt{'c-bench'} failed: ".($! || "exit status ".($? >> 8))."\n";
+}
+
+$results->write_json(env => \%env);
+
+if (defined $opt{baseline}) {
+	open my $fh, '<', $opt{baseline} or die "Can't read $opt{baseline}: $!\n";
+	my $base= BenchResults->json_codec->decode(do { local $/; <$fh> })->{results};
+	my $regressions= 0;
+	for my $name (sort keys %{ $results->results }) {
+		my ($cur, $old)= ($results->results->{$name}, $base->{$name});
+		next unless $old && $old->{value} && $old->{unit} eq $cur->{unit};
+		my $ratio= $cur->{value} / $old->{value};
+		if ($cur->{better} eq 'higher'? $ratio < 1 - $opt{tolerance} : $ratio > 1 + $opt{tolerance}) {
+			printf STDERR "REGRESSION %s: %.6g -> %.6g %s (%+.1f%%)\n",
+				$name, $old->{value}, $cur->{value}, $cur->{unit}, ($ratio-1)*100;
+			$regressions++;
+		}
+	}
+	exit 3 if $regressions;
+}
+exit 0;
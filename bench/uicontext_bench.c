@@ -0,0 +1,173 @@
+// Benchmark of the uicontext core, linked against libuicontext, with no perl
+// involved.  Build with "make uicontext-bench" and run
+//
+//   ./uicontext-bench [-b glx|xshm|egl|osmesa] [-d display] [-n count] [-s WxH]
+//
+// Each result is printed as one line of "name<TAB>value<TAB>unit".  The
+// glx and xshm backends need an X server; egl and osmesa do not.
+
+#include "../uicontext.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef GL_COLOR_BUFFER_BIT
+ #define GL_COLOR_BUFFER_BIT 0x00004000
+#endif
+
+typedef void (APIENTRY *bench_clear_fn)(GLbitfield mask);
+typedef void (APIENTRY *bench_clear_color_fn)(GLclampf r, GLclampf g, GLclampf b, GLclampf a);
+typedef void (APIENTRY *bench_viewport_fn)(GLint x, GLint y, GLsizei w, GLsizei h);
+typedef void (APIENTRY *bench_finish_fn)(void);
+typedef void (APIENTRY *bench_read_pixels_fn)(GLint x, GLint y, GLsizei w, GLsizei h, GLenum format, GLenum type, GLvoid *pixels);
+
+static const char *backend_names[]= { "glx", "egl", "osmesa", "xshm", NULL };
+
+static void report(const char *name, double value, const char *unit) {
+	printf("%s\t%.6g\t%s\n", name, value, unit);
+	fflush(stdout);
+}
+
+static void connect_backend(UIContext *cx, int backend, const char *display) {
+	switch (backend) {
+	case UICONTEXT_BACKEND_EGL:    UIContext_connect_egl(cx); break;
+	case UICONTEXT_BACKEND_OSMESA: UIContext_connect_osmesa(cx); break;
+	default: UIContext_connect(cx, display, backend == UICONTEXT_BACKEND_XSHM);
+	}
+}
+
+// A window for the X11 backends, or an offscreen target for the others
+static int create_target(UIContext *cx, int backend, int w, int h) {
+	Window wnd;
+	if (backend == UICONTEXT_BACKEND_GLX || backend == UICONTEXT_BACKEND_XSHM) {
+		wnd= UIContext_create_window(cx, 0, 0, w, h);
+		UIContext_XMapWindow(cx, wnd, 2000);
+		return (int) wnd;
+	}
+	return UIContext_create_pixmap(cx, w, h);
+}
+
+static void destroy_target(UIContext *cx, int backend, int xid) {
+	if (backend == UICONTEXT_BACKEND_GLX || backend == UICONTEXT_BACKEND_XSHM)
+		UIContext_destroy_window(cx, xid);
+	else
+		UIContext_destroy_pixmap(cx, xid);
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [-b glx|xshm|egl|osmesa] [-d display] [-n count] [-s WxH]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	const char *display= getenv("DISPLAY");
+	int backend= UICONTEXT_BACKEND_GLX, n= 200, w= 640, h= 480;
+	int opt, i, target[2];
+	double t, elapsed;
+	size_t bytes;
+	char *pixels;
+	UIContext *cx;
+	bench_clear_fn Clear;
+	bench_clear_color_fn ClearColor;
+	bench_viewport_fn Viewport;
+	bench_finish_fn Finish;
+	bench_read_pixels_fn ReadPixels;
+	float tri[3*2];
+
+	while ((opt= getopt(argc, argv, "b:d:n:s:")) != -1) {
+		switch (opt) {
+		case 'b':
+			for (backend= 0; backend_names[backend] && strcmp(backend_names[backend], optarg); backend++);
+			if (!backend_names[backend]) usage(argv[0]);
+			break;
+		case 'd': display= optarg; break;
+		case 'n': n= atoi(optarg); break;
+		case 's': if (sscanf(optarg, "%dx%d", &w, &h) != 2) usage(argv[0]); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (n < 1) usage(argv[0]);
+	if (!display) display= ":0";
+
+	// Connection, including the GLX version and extension queries
+	cx= UIContext_new();
+	t= UIContext_monotonic_now();
+	for (i= 0; i < n/10+1; i++) {
+		connect_backend(cx, backend, display);
+		UIContext_disconnect(cx);
+	}
+	report("connect", (UIContext_monotonic_now() - t) / (n/10+1) * 1000, "ms");
+	connect_backend(cx, backend, display);
+
+	t= UIContext_monotonic_now();
+	for (i= 0; i < n/10+1; i++)
+		UIContext_setup_glcontext(cx, 1, 0);
+	report("setup_glcontext", (UIContext_monotonic_now() - t) / (n/10+1) * 1000, "ms");
+
+	// Target churn
+	t= UIContext_monotonic_now();
+	for (i= 0; i < n; i++)
+		destroy_target(cx, backend, create_target(cx, backend, w, h));
+	report("target_create_destroy", n / (UIContext_monotonic_now() - t), "ops/s");
+
+	target[0]= create_target(cx, backend, w, h);
+	target[1]= create_target(cx, backend, w, h);
+	UIContext_glXMakeCurrent(cx, target[0]);
+	Clear=      (bench_clear_fn) UIContext_get_proc_address(cx, "glClear");
+	ClearColor= (bench_clear_color_fn) UIContext_get_proc_address(cx, "glClearColor");
+	Viewport=   (bench_viewport_fn) UIContext_get_proc_address(cx, "glViewport");
+	Finish=     (bench_finish_fn) UIContext_get_proc_address(cx, "glFinish");
+	ReadPixels= (bench_read_pixels_fn) UIContext_get_proc_address(cx, "glReadPixels");
+	if (!Clear || !ClearColor || !Viewport || !Finish || !ReadPixels) {
+		fprintf(stderr, "GL library is missing core functions\n");
+		return 2;
+	}
+	Viewport(0, 0, w, h);
+
+	// Switching between two targets of the same context
+	Finish();
+	t= UIContext_monotonic_now();
+	for (i= 0; i < n; i++)
+		UIContext_glXMakeCurrent(cx, target[i & 1]);
+	report("make_current_switch", (UIContext_monotonic_now() - t) / n * 1000000, "us");
+	UIContext_glXMakeCurrent(cx, target[0]);
+
+	// Clear and present, as fast as the backend allows
+	t= UIContext_monotonic_now();
+	for (i= 0; i < n; i++) {
+		ClearColor((i & 1), 0, 0, 1);
+		Clear(GL_COLOR_BUFFER_BIT);
+		// Swaps (or flushes, for pixmaps) and ends the stream's frame
+		UIContext_present(cx, UICONTEXT_PRESENT_FLUSH);
+	}
+	Finish();
+	report("swap", n / (UIContext_monotonic_now() - t), "frames/s");
+
+	// Small draws through the vertex stream
+	tri[0]= -1; tri[1]= -1; tri[2]= 1; tri[3]= -1; tri[4]= 0; tri[5]= 1;
+	t= UIContext_monotonic_now();
+	for (i= 0; i < n * 10; i++)
+		UIContext_draw_vertices(cx, GL_TRIANGLES, "v2f", tri, sizeof(tri));
+	Finish();
+	report("draw_vertices", n * 10 / (UIContext_monotonic_now() - t), "draws/s");
+
+	// Readback of the whole target
+	bytes= (size_t) w * h * 4;
+	if (!(pixels= malloc(bytes))) {
+		fprintf(stderr, "Out of memory\n");
+		return 2;
+	}
+	Finish();
+	t= UIContext_monotonic_now();
+	for (i= 0; i < n/10+1; i++)
+		ReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	elapsed= UIContext_monotonic_now() - t;
+	report("readback", bytes * (n/10+1) / elapsed / (1024*1024), "MiB/s");
+	free(pixels);
+
+	destroy_target(cx, backend, target[0]);
+	destroy_target(cx, backend, target[1]);
+	UIContext_free(cx);
+	return 0;
+}
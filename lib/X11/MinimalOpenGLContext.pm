@@ -2,9 +2,9 @@ package X11::MinimalOpenGLContext;
 use Moo 2;
 use Log::Any '$log';
 use Try::Tiny;
-use Scalar::Util 'weaken';
+use Scalar::Util 'weaken', 'blessed';
 use Carp;
-require OpenGL;
+use X11::MinimalOpenGLContext::GL qw( glGetError GL_NO_ERROR );
 use X11::MinimalOpenGLContext::Rect;
 use X11::MinimalOpenGLContext::Window;
 use X11::MinimalOpenGLContext::Pixmap;
@@ -51,12 +51,48 @@ than more complete solutions like SDL or GTK.  (but while I claim that, I
 haven't actually tested on that many platforms yet, so the module might need
 patches if you run on a non-standard system.)
 
+The module itself doesn't need the L<OpenGL> (POGL) module.  The handful of
+GL calls that a basic frame needs (viewport, projection, clear, error checks,
+readback) are provided by L<X11::MinimalOpenGLContext::GL>, and anything
+beyond that is up to you.
+
 This module might eventually be extended to provide more support for the X11
 objects, or it could be rewritten to use XCB instead of XLib, but I probably
 won't do that any time soon unless someone wants to assist.
 
 =head1 ATTRIBUTES
 
+=head2 backend
+
+One of C<'glx'> (the default), C<'egl'>, C<'osmesa'>, or C<'xshm'>.
+
+The C<'egl'> backend renders without any X server, using EGL's surfaceless
+platform (C<EGL_MESA_platform_surfaceless>) or else the first
+C<EGL_EXT_platform_device> device.  It has no windows; L</create_pixmap> and
+L</setup_pixmap> create OpenGL framebuffer objects instead of GLX pixmaps,
+and L</show> just flushes the rendering commands.  C<libEGL.so.1> is loaded
+the first time this backend is used, so it is not a requirement of the
+module.  Shared contexts are not supported.
+
+  my $glc= X11::MinimalOpenGLContext->new(backend => 'egl');
+  $glc->setup_pixmap(640, 480);
+
+The C<'osmesa'> backend renders in software, in-process, with Mesa's OSMesa
+library (C<libOSMesa.so>, also loaded on first use).  Its pixmaps are plain
+memory buffers owned by this module, so the rendered pixels can be read with
+L<X11::MinimalOpenGLContext::Pixmap/pixels> as soon as L</show> returns,
+without C<glReadPixels>.  A pixmap can also be backed by a memory-mapped
+file; see L</create_pixmap>.  Like C<'egl'>, it has no windows.
+
+The C<'xshm'> backend connects to an X server, but renders windows with OSMesa
+and presents each frame with C<XShmPutImage> from one of two MIT-SHM shared
+memory images, so rendering of the next frame overlaps the server's copy of the
+previous one.  If the server can't attach the shared memory (for instance
+over the network), the images are sent with C<XPutImage> instead.  This is
+what C<'glx'> automatically falls back to when the X server does not support
+GLX.  It does not support pixmaps, and if a window is
+resized you must call L</set_gl_target> again to resize the images.
+
 =head2 display
 
 Default value for L</connect>.  Otherwise connect defaults to C<$ENV{DISPLAY}>.
@@ -104,6 +140,109 @@ Default value for L</project_frustum>'s second argument.
 
 Default value for the depth of C<glFrustum>, when L</project_frustum> is called.
 
+=head2 depth_bits
+
+Minimum number of depth buffer bits for the framebuffer chosen by
+L</setup_glcontext>.  Default is 0 (no depth buffer).  C<16> is a good choice
+for fill-rate-bound hardware, C<24> otherwise.
+
+=head2 stencil_bits
+
+Minimum number of stencil buffer bits.  Default 0.
+
+=head2 samples
+
+Number of samples per pixel for hardware multisample anti-aliasing.  Default 0.
+The FBConfig with the closest sample count is chosen, preferring more samples
+over fewer, so this doesn't fail on servers without MSAA.
+
+=head2 srgb
+
+If true, require an sRGB-capable framebuffer (C<GLX_ARB_framebuffer_sRGB>),
+and enable C<GL_FRAMEBUFFER_SRGB> when the context is first made current.
+
+=head2 double_buffer
+
+Default true.  Set to false for a single-buffered window, where L</show>
+flushes the commands instead of swapping buffers.
+
+Among the FBConfigs that meet these, the one with the fewest extra depth
+and stencil bits is chosen, and slow (unaccelerated) configs are avoided.
+On the C<'egl'> backend, depth and stencil buffers are attached to each
+framebuffer object but C<samples> and C<srgb> are ignored; the OSMesa-based
+backends only use C<depth_bits> and C<stencil_bits>.
+
+=head2 fbconfig_cache
+
+  fbconfig_cache => "$ENV{HOME}/.cache/myviewer-fbconfig"
+
+Path of a file in which to remember the FBConfig chosen for each host, client
+GLX library, display, GLX vendor and version, and set of framebuffer
+attributes above, so one file can be shared by machines with a common home
+directory.  On the next run, the cached FBConfig ID is checked with a single
+C<glXChooseFBConfig> query, skipping the enumeration and scoring of every
+config, which can take tens of milliseconds on some servers.  If the cached ID
+is no longer valid, the full search runs and the file is updated.  Default is
+no cache.
+
+=head2 gl_version
+
+  gl_version => '3.3'
+
+Request a specific OpenGL version for the context created by
+L</setup_glcontext>.  This (and the next three attributes) use
+C<GLX_ARB_create_context>, or C<EGL_KHR_create_context> on the C<'egl'>
+backend, and setup_glcontext dies if it isn't available.  They are ignored by
+the OSMesa-based backends.
+
+=head2 gl_profile
+
+C<'core'> or C<'compat'>.  Note that L</project_frustum> uses the fixed
+function pipeline, which does not exist in a core profile.
+
+=head2 gl_no_error
+
+If true, request a C<GL_KHR_no_error> context, where the driver skips
+validating each GL call.  This can save significant CPU time per draw call
+in production, but a GL error becomes undefined behavior, so only enable it
+for code that is known to be correct.  It can't be combined with
+L</gl_debug> or L</gl_robust>, and is skipped with a log message if the
+driver doesn't support it.
+
+=head2 gl_robust
+
+If true, request robust buffer access, and that the context be lost (rather
+than the process crashed) on a GPU reset.
+
+=head2 gl_debug
+
+If true, L</setup_glcontext> requests a debug context (where supported), and
+OpenGL's debug output (C<GL_KHR_debug>) is captured from the time the context
+is first made current.  Messages are queued in C as the driver reports them,
+and L</show> logs them to Log::Any in one batch at the end of the frame,
+instead of polling C<glGetError>.  When nothing is wrong this costs nothing
+per frame.  See L</drain_gl_debug>.
+
+=head2 stream_persistent
+
+If true (the default), L</draw_vertices> uses a persistently mapped buffer
+(C<GL_ARB_buffer_storage>, or GL 4.4) when the context supports it, so
+vertices are copied straight into GPU-visible memory with no GL call per
+upload.  Set it false before L</setup_glcontext> to always use
+C<glBufferSubData> with buffer orphaning instead.
+
+=head2 pixmap_pool
+
+Number of released pixmaps to keep for reuse, default 0 (off).  When a
+L<Pixmap|X11::MinimalOpenGLContext::Pixmap> object is destroyed, its drawable
+(or framebuffer object, or osmesa buffer) goes into the pool instead of being
+freed, and the next L</create_pixmap> of the same width and height gets it
+back without any allocation on the server.  When the pool is full, the oldest
+one is freed.  A recycled pixmap still holds whatever was last rendered to it,
+so clear it first.  The pool is emptied when the GL context is torn down, and
+the setting takes effect at L</setup_glcontext> (up to 64).  See
+L</pixmap_pool_stats>.
+
 =head2 on_error
 
   $glc->on_error(sub {
@@ -116,6 +255,18 @@ error to its source.  This callback lets you know that an error was
 associated with this particular connection, and gives you the XErrorInfo to
 help track things down.
 
+Non-fatal errors are not delivered from inside XLib.  They are queued in C
+and delivered in a batch by L</show>, L</disconnect>, or
+L</process_x_errors>.  Repeats of the same C<error_code>, C<request_code>
+and C<minor_code> are coalesced into one report, where C<count> is the
+number of occurrences, C<first_serial> and C<serial> are the request serial
+numbers of the first and last one, and C<resourceid> is from the last one.
+
+Each error also has C<operation>, the name of the UIContext C function that
+sent the failing request (like C<"UIContext_destroy_window">), found by
+request serial number.  It is missing if that call was so many calls ago
+that it is no longer remembered.
+
 If the error was fatal, then C<$is_fatal> is true, C<$x_error_info> will be
 C<undef>, and you won't be able to make any more XLib calls for the remaindr
 of your program!  In this case you should clean up and exit.
@@ -132,18 +283,37 @@ Called any time you disconnect from the X server for any reason.
 
 # This is our interface to XS
 has _ui_context       => ( is => 'lazy', predicate => 1 );
-sub _build__ui_context   { X11::MinimalOpenGLContext::UIContext->new; }
+sub _build__ui_context {
+	my $self= shift;
+	my $cx= X11::MinimalOpenGLContext::UIContext->new;
+	$cx->set_owner($self); # weak, for routing X errors
+	return $cx;
+}
 
 # We hold a reference to whatever Drawable is targeted, so that the application
 # doesn't have to bother maintaining it.
 has _gl_target        => ( is => 'rw' );
 
 # used by connect
+has backend           => ( is => 'rw', default => sub { 'glx' } );
 has display           => ( is => 'rw' );
 
 # used by setup_glcontext
 has direct_render     => ( is => 'rw' );
 has shared_context_id => ( is => 'rw' );
+has depth_bits        => ( is => 'rw' );
+has stencil_bits      => ( is => 'rw' );
+has samples           => ( is => 'rw' );
+has srgb              => ( is => 'rw' );
+has double_buffer     => ( is => 'rw', default => sub { 1 } );
+has fbconfig_cache    => ( is => 'rw' );
+has gl_version        => ( is => 'rw' );
+has gl_profile        => ( is => 'rw' );
+has gl_no_error       => ( is => 'rw' );
+has gl_robust         => ( is => 'rw' );
+has gl_debug          => ( is => 'rw' );
+has stream_persistent => ( is => 'rw', default => sub { 1 } );
+has pixmap_pool       => ( is => 'rw' );
 
 # used by setup_pixmap
 has pixmap_w          => ( is => 'rw' );
@@ -171,15 +341,33 @@ Standard Moo constructor.  No attributes are required.
   $glc->connect();  # defaults to $ENV{DISPLAY}, else ":0"
   $glc->connect( $display_string );
 
-Connect to X server.  Dies if it can't connect.
+Connect to X server.  Dies if it can't connect.  If the server does not support
+GLX, this falls back to the C<'xshm'> software rendering backend (see
+L</backend>) if libOSMesa is available, and dies otherwise.
+
+If L</backend> is C<'egl'> or C<'osmesa'>, this initializes that library
+instead, and C<$display_string> is ignored.
 
 =cut
 
 sub connect {
 	my ($self, $display)= @_;
-	$display= $ENV{DISPLAY} unless defined $display;
-	$display= ':0' unless defined $display;
-	$self->_ui_context->connect($display);
+	my $backend= $self->backend || 'glx';
+	if ($backend eq 'egl') {
+		$self->_ui_context->connect_egl;
+	}
+	elsif ($backend eq 'osmesa') {
+		$self->_ui_context->connect_osmesa;
+	}
+	elsif ($backend eq 'glx' || $backend eq 'xshm') {
+		$display= $self->display unless defined $display;
+		$display= $ENV{DISPLAY} unless defined $display;
+		$display= ':0' unless defined $display;
+		$self->_ui_context->connect($display, $backend eq 'xshm'? 1 : 0);
+	}
+	else {
+		croak "Unknown backend '$backend'";
+	}
 	weaken( $_ConnectedInstances{$self}= $self );
 }
 
@@ -202,6 +390,8 @@ Graceful teardown of OpenGL context, window, and X11 connection
 
 sub disconnect {
 	my $self= shift;
+	# Deliver anything queued for this connection while it can still be matched
+	_X11_dispatch_errors() if X11::MinimalOpenGLContext::UIContext::x_errors_pending();
 	$self->_gl_target(undef);
 	$self->_ui_context->disconnect;
 	delete $_ConnectedInstances{$self};
@@ -217,6 +407,7 @@ sub DESTROY {
 }
 
 sub _rect { X11::MinimalOpenGLContext::Rect->new(@_) }
+sub _is_rect { ref $_[0] eq 'ARRAY' || (blessed($_[0]) && $_[0]->isa('X11::MinimalOpenGLContext::Rect')) }
 
 =head2 setup_glcontext
 
@@ -246,6 +437,20 @@ sub setup_glcontext {
 	$direct= $self->direct_render unless defined $direct;
 	$direct= 1 unless defined $direct;
 	$shared_cx_id= $self->shared_context_id unless defined $shared_cx_id;
+	my ($major, $minor)= (0, 0);
+	if (defined $self->gl_version) {
+		($major, $minor)= ($self->gl_version =~ /^(\d+)(?:\.(\d+))?$/)
+			or croak "Invalid gl_version '".$self->gl_version."'";
+		$minor ||= 0;
+	}
+	$self->_ui_context->set_fb_prefs($self->depth_bits||0, $self->stencil_bits||0,
+		$self->samples||0, $self->srgb? 1 : 0, $self->double_buffer? 0 : 1);
+	$self->_ui_context->set_fbconfig_cache(defined $self->fbconfig_cache? $self->fbconfig_cache : '');
+	$self->_ui_context->set_gl_debug($self->gl_debug? 1 : 0);
+	$self->_ui_context->set_stream_persistent($self->stream_persistent? 1 : 0);
+	$self->_ui_context->set_pixmap_pool($self->pixmap_pool || 0);
+	$self->_ui_context->set_context_attribs($major, $minor, $self->gl_profile || '',
+		$self->gl_no_error? 1 : 0, $self->gl_robust? 1 : 0);
 	$self->_ui_context->setup_glcontext($direct, $shared_cx_id||0);
 	$log->debug("gl context is ".$self->glcontext_id);
 	return $self;
@@ -265,6 +470,64 @@ sub glcontext_id {
 	return shift->_ui_context->glctx_id;
 }
 
+=head2 has_glx_extension
+
+  if ($glc->has_glx_extension('GLX_EXT_swap_control')) { ... }
+
+True if the connected X server supports the named GLX extension.  The
+extension string is parsed once at L</connect>, so for the extensions this
+module knows about, this is a single bit test.
+
+=cut
+
+sub has_glx_extension {
+	my ($self, $name)= @_;
+	return $self->_ui_context->has_glx_extension($name);
+}
+
+=head2 startup_report
+
+  my $report= $glc->startup_report;
+  # {
+  #   phases => [
+  #     { name => 'XOpenDisplay', seconds => 0.0021 },
+  #     { name => 'glXQueryVersion', seconds => 0.0004 },
+  #     ...
+  #   ],
+  #   total => 0.2913,
+  # }
+
+Returns the monotonic time spent in each step of bringing up the display,
+in the order they happen: C<XOpenDisplay>, C<glXQueryVersion>,
+C<glXQueryExtensionsString>, C<glXChooseVisual>, C<glXCreateContext>,
+C<XCreateColormap>, C<XCreateWindow>, and C<XMapWindow>.  Steps which have not
+been run yet are omitted.  (For the C<'egl'> backend, the display setup is
+reported as C<XOpenDisplay> and the config and context creation as
+C<glXChooseVisual> and C<glXCreateContext>.)  The window steps describe the most recent window
+created.
+
+The times are measured on the client.  C<XCreateColormap> and
+C<XCreateWindow> are only queued by Xlib, so they don't include the server's
+work (which shows up in the next step that waits for a reply), and
+C<XMapWindow> includes waiting for the window to appear only if
+C<map_window> was asked to wait.  The other steps wait for replies, so they
+include the network and the X server as well as the GL driver, without
+telling them apart.
+
+=cut
+
+sub startup_report {
+	my $self= shift;
+	my @times= $self->_has_ui_context? $self->_ui_context->startup_phase_times : ();
+	my @phases;
+	my $total= 0;
+	while (my ($name, $sec)= splice(@times, 0, 2)) {
+		push @phases, { name => $name, seconds => $sec };
+		$total += $sec;
+	}
+	return { phases => \@phases, total => $total };
+}
+
 =head2 create_window
 
   $glc->create_window(); # defaults to $ENV{GEOMETRY}, else size of screen
@@ -316,19 +579,28 @@ sub setup_window {
 
 =head2 create_pixmap
 
+  $glc->create_pixmap($w, $h);
+  $glc->create_pixmap($w, $h, $mmap_file); # osmesa backend only
+
 Instead of a window, you can render to an offscreen pixmap, and then
 fetch the results to use for other purposes.  This method creates a
 pixmap which you can then pass to L</set_gl_target>.
 
+With the C<'osmesa'> backend, if C<$mmap_file> is given, the pixels are
+stored in that file (created or resized as needed) with a shared mapping, so
+other processes can read the rendered image directly.
+
 =head2 setup_pixmap
 
+  $glc->setup_pixmap($w, $h, $mmap_file);
+
 Convenience method for C<connect>, C<setup_glcontext>, C<create_pixmap>,
 and C<set_gl_target>.  Returns C<$self> for method chaining.
 
 =cut
 
 sub create_pixmap {
-	my ($self, $w, $h)= @_;
+	my ($self, $w, $h, $mmap_file)= @_;
 
 	$w ||= $self->pixmap_w;
 	$h ||= $self->pixmap_h;
@@ -336,15 +608,15 @@ sub create_pixmap {
 	$w ||= $h;
 	defined $w or croak "Dimensions for pixmap are required";
 
-	return X11::MinimalOpenGLContext::Pixmap->new($self, $w, $h);
+	return X11::MinimalOpenGLContext::Pixmap->new($self, $w, $h, $mmap_file);
 }
 
 sub setup_pixmap {
-	my ($self, $w, $h)= @_;
+	my ($self, $w, $h, $mmap_file)= @_;
 
 	$self->connect unless $self->is_connected;
 	$self->setup_glcontext unless $self->_ui_context->has_glcontext;
-	my $pxm= $self->create_pixmap($w, $h);
+	my $pxm= $self->create_pixmap($w, $h, $mmap_file);
 	$self->set_gl_target($pxm);
 	return $self;
 }
@@ -392,16 +664,103 @@ sub screen_pixel_aspect_ratio {
 	return ($screen_w_mm * $screen_h) / ($screen_h_mm * $screen_w);
 }
 
+=head2 client_resources
+
+  my $counts= $glc->client_resources;
+  # { WINDOW => 2, PIXMAP => 1, GLXContext => 1, ... }
+
+Ask the X server how many resources of each type this connection owns,
+using the X-Resource extension.  Comparing these before and after some work
+shows whether windows, pixmaps or GLX objects are left behind on the server.
+Returns undef if libXRes or the server extension are not available.
+
+Throws an exception without an X11 display.
+
+=cut
+
+sub client_resources {
+	my $self= shift;
+	my %counts;
+	return $self->_ui_context->client_resources(\%counts) < 0? undef : \%counts;
+}
+
 =head2 set_gl_target
 
+  $glc->set_gl_target($window_or_pixmap);
+
+Make this object's GL context current in the calling thread, rendering to the
+given L<Window|X11::MinimalOpenGLContext::Window> or
+L<Pixmap|X11::MinimalOpenGLContext::Pixmap>.  If that context and target are
+already current (checked without a server round trip), nothing is called, so
+it is cheap to call this before every piece of rendering when several
+contexts or targets are in use.  On the C<'egl'> backend, switching between
+targets of the same context only changes the framebuffer binding.  See
+C<make_current_skipped> in L</present_stats>.
+
+  $glc->set_gl_target($window, $pixmap);
+
+With a second target, rendering goes to the first while C<glReadPixels>,
+C<glCopyPixels> and C<glBlitFramebuffer> read from the second.  This uses
+C<glXMakeContextCurrent> and needs GLX 1.3 on the C<'glx'> backend; on
+C<'egl'> it binds the draw and read framebuffers.  Other backends throw an
+exception.  See L</blit> for the common use.
+
+On C<'glx'>, C<glReadBuffer> is set to where the read target's rendering is:
+the back buffer of a double-buffered window, or the front buffer of a pixmap
+(pixmaps are single-buffered).
+
 =cut
 
 sub set_gl_target {
-	my ($self, $drawable)= @_;
-	$self->_ui_context->glXMakeCurrent($drawable->xid);
+	my ($self, $drawable, $read)= @_;
+	if ($read) {
+		$self->_ui_context->make_context_current($drawable->xid, $read->xid);
+	} else {
+		$self->_ui_context->glXMakeCurrent($drawable->xid);
+	}
 	$self->_gl_target($drawable);
 }
 
+=head2 blit
+
+  $glc->blit($pixmap, $window);
+  $glc->blit($pixmap, [ 0, 0, 320, 240 ], $window, [ 0, 0, 1280, 960 ], linear => 0);
+  $glc->show;
+
+Copy a rectangle of C<$src> (usually a L<Pixmap|X11::MinimalOpenGLContext::Pixmap>
+rendered at a fixed resolution) into a rectangle of C<$dst> (usually the
+window), scaling it to fit.  The pixels never leave the GPU.  Rectangles are
+L<Rect|X11::MinimalOpenGLContext::Rect> objects or C<[x,y,w,h]> arrays in
+GL coordinates (origin at the bottom left), and default to all of the
+target.  Pass the window's rectangle if you know it, since finding its size
+is a round trip to the X server.
+
+Scaling is bilinear unless C<< linear => 0 >> is given.  The copy uses
+C<glBlitFramebuffer> when the context has it (GL 3.0 or
+C<GL_ARB_framebuffer_object>), and otherwise C<glCopyPixels> with
+C<glPixelZoom>, which always scales to the nearest pixel and is affected by
+the fragment state (texturing, blending, shaders) like other drawing.  The
+scissor test applies to both.
+
+Afterward C<$dst> is the GL target and C<$src> the read target, as with
+C<< set_gl_target($dst, $src) >>, so L</show> presents C<$dst>.  Call
+L</set_gl_target> with C<$src> to render the next frame.  Supported by the
+C<'glx'> (GLX 1.3) and C<'egl'> backends.
+
+=cut
+
+sub blit {
+	my ($self, $src, @args)= @_;
+	my $src_rect= _is_rect($args[0])? shift @args : undef;
+	my $dst= shift @args or croak "Missing blit destination";
+	my $dst_rect= _is_rect($args[0])? shift @args : undef;
+	my %opts= @args;
+	my @src_xywh= $src_rect? _rect($src_rect)->x_y_w_h : (0, 0, ($src->get_rect->x_y_w_h)[2,3]);
+	my @dst_xywh= $dst_rect? _rect($dst_rect)->x_y_w_h : (0, 0, ($dst->get_rect->x_y_w_h)[2,3]);
+	$self->_ui_context->blit($src->xid, @src_xywh, $dst->xid, @dst_xywh, $opts{linear} // 1);
+	$self->_gl_target($dst);
+}
+
 =head2 project_frustum
 
   $glc->viewport_rect( ... );  # default is size of window
@@ -420,52 +779,43 @@ Throws an exception if called before L</create_window>
 
 sub project_frustum {
 	my ($self, $viewport_rect, $frustum_rect)= @_;
-	my $pixel_aspect= $self->screen_pixel_aspect_ratio();
-	my $window_rect= $self->_gl_target->get_rect;
-	my $mirror_x= $self->mirror_x? 1 : 0;
-	my $mirror_y= $self->mirror_y? 1 : 0;
-	
-	$log->debug("initializing viewport");
-	my ($x, $y, $w, $h)= _rect($viewport_rect || $self->viewport_rect || {})->x_y_w_h;
-	$x ||= 0;
-	$y ||= 0;
-	$w ||= $window_rect->w - $x;
-	$h ||= $window_rect->h - $y;
-	# Calculate the viewport from the opposite side of the screen if mirror is in effect
-	if ($x && $mirror_x) { $x= $window_rect->w - $w - $x; }
-	if ($y && $mirror_y) { $y= $window_rect->h - $h - $y; }
-	OpenGL::glViewport($x, $y, $w, $h);
-	
-	$log->debug("setting up projection matrix");
-	my ($fx, $fy, $fw, $fh)= _rect($frustum_rect || $self->frustum_rect || {})->x_y_w_h;
-	# If horizontal dimension is missing...
-	if (!$fw) {
-		# If vertical is also missing, default to 1
-		$fh ||= 1;
-		# Calculate the horizontal using pixel aspect and the viewport width
-		$fw= $pixel_aspect * $fh * ($w / $h);
-	} elsif (!$fh) {
-		$fh= $fw * ($h / $w) / $pixel_aspect;
-	}
-	# If edge missing, use half the size
-	$fx= $fw * -.5 unless defined $fx;
-	$fy= $fh * -.5 unless defined $fy;
-	
-	OpenGL::glMatrixMode(OpenGL::GL_PROJECTION());
-	OpenGL::glLoadIdentity();
-	
-	OpenGL::glFrustum(
-		($mirror_x? ($fx+$fw, $fx) : ($fx, $fx+$fw)),
-		($mirror_y? ($fy+$fh, $fy) : ($fy, $fy+$fh)),
-		1, $self->frustum_depth * 2);
-	OpenGL::glTranslated(0, 0, -$self->frustum_depth);
-	
-	# If mirror is in effect, need to tell OpenGL which way the camera is
-	OpenGL::glFrontFace($mirror_x == $mirror_y? OpenGL::GL_CCW() : OpenGL::GL_CW());
-	OpenGL::glMatrixMode(OpenGL::GL_MODELVIEW());
+	$log->debug("setting up viewport and projection matrix");
+	$self->_project_frustum($viewport_rect, $frustum_rect, 1);
 	return $self;
 }
 
+=head2 frustum_matrix
+
+  my $mat4= $glc->frustum_matrix();
+  # -or-
+  my $mat4= $glc->frustum_matrix( $viewport_rect, $frustum_rect );
+  glUniformMatrix4fv($loc, 1, GL_FALSE, $mat4);
+
+Returns the projection matrix that L</project_frustum> would load, as a packed
+string of 16 native floats in column-major order, for shader pipelines.  This
+doesn't change any GL state, but defaults are still based on the size of the
+current target.  (In a core profile context, C<project_frustum> sets only the
+viewport and front face, since there is no matrix stack.)
+
+=cut
+
+sub frustum_matrix {
+	my ($self, $viewport_rect, $frustum_rect)= @_;
+	return $self->_project_frustum($viewport_rect, $frustum_rect, 0);
+}
+
+sub _project_frustum {
+	my ($self, $viewport_rect, $frustum_rect, $apply)= @_;
+	my $target_rect= $self->_gl_target->get_rect;
+	return $self->_ui_context->project_frustum(
+		$target_rect->w, $target_rect->h,
+		[ _rect($viewport_rect || $self->viewport_rect || {})->x_y_w_h ],
+		[ _rect($frustum_rect || $self->frustum_rect || {})->x_y_w_h ],
+		$self->screen_pixel_aspect_ratio, $self->frustum_depth,
+		$self->mirror_x? 1 : 0, $self->mirror_y? 1 : 0, $apply
+	);
+}
+
 =head2 swap_buffers
 
   $glc->swap_buffers()
@@ -482,18 +832,307 @@ sub swap_buffers {
 
 =head2 show
 
-Convenience method to call C<< $glc->swap_buffers() >>
-and log the results of C<< $glc->gl_get_errors() >> to Log::Any
+  $glc->show() or warn "GL errors this frame";
+
+End the frame: swap buffers, collect any OpenGL errors, and flush the X11
+connection, all in a single call into C.  Errors are logged to Log::Any, and
+the return value is true if there were none.  Any queued X11 errors are
+then passed to L</on_error> (but don't affect the return value).  The timing of each call is
+available from L</present_stats>.
+
+If L</gl_debug> is enabled, errors come from the debug message queue (see
+L</drain_gl_debug>) rather than C<glGetError>.
+
+  my $age= $glc->buffer_age;
+  ... redraw the union of the last $age frames' damage, or all if $age is 0 ...
+  $glc->show(@damaged_rects);
+
+Given L<Rects|X11::MinimalOpenGLContext::Rect> or C<[x,y,w,h]> arrays (in GL
+coordinates, origin at the bottom left), only those parts of the frame are
+presented.  On the C<'glx'> backend this uses C<glXCopySubBufferMESA>, which
+copies from the back buffer without swapping, so the cost scales with the
+damaged area; it is not synchronized to the vertical refresh, so it can tear
+like any other copy.  Without C<GLX_MESA_copy_sub_buffer> the whole frame is
+swapped as usual.  On C<'xshm'> only the damaged parts of the image are sent
+to the X server.  The rectangles must cover everything that changed since
+the last frame, so present the whole frame (no rectangles) after
+L</buffer_age> returned 0, or after the window was exposed or resized.
 
 =cut
 
 sub show {
 	my $self= shift;
-	$self->swap_buffers;
-	my $e= $self->get_gl_errors;
-	$log->error("OpenGL error bits: ", join(', ', values %$e))
-		if $e;
-	return !$e;
+	# Called every frame, so skip the lazy accessor once it has been built
+	my $cx= $self->{_ui_context} || $self->_ui_context;
+	my $damage= @_? pack('i*', map _rect($_)->x_y_w_h, @_) : undef;
+	my $status= $cx->present(!$self->{gl_debug}, 1, $damage) or return 1;
+	_X11_dispatch_errors() if $status & 0x200;
+	my $errors= 0;
+	if (my @names= $cx->present_error_names($status)) {
+		$log->error("OpenGL error bits: ", join(', ', @names));
+		$errors++;
+	}
+	$errors += grep $_->{type} eq 'Error', @{ $self->drain_gl_debug }
+		if $self->{gl_debug};
+	return !$errors;
+}
+
+=head2 buffer_age
+
+  my $age= $glc->buffer_age;
+
+How many frames old the contents of the buffer about to be drawn are: 1 if
+it still holds the last frame shown, 2 if the one before that, and so on.  A
+program that only redraws what changed has to redraw everything that changed
+in the last C<$age> frames (including this one).  0 means the contents are
+unknown and everything has to be drawn.
+
+On the C<'glx'> backend this comes from C<GLX_EXT_buffer_age> (and is 0
+without it), converted to count the partial presents of L</show> as frames
+too.  It is tracked for the last window presented, and is 0 for the first
+frame after switching to another one.  Single-buffered windows, pixmaps and
+the C<'egl'> and C<'osmesa'> backends always have 1.  The C<'xshm'> backend
+alternates between two images, so it is 2 once both have been shown.
+
+=cut
+
+sub buffer_age {
+	shift->_ui_context->buffer_age;
+}
+
+=head2 process_x_errors
+
+  $glc->process_x_errors;
+
+Deliver queued X11 errors to the L</on_error> callbacks now.  L</show> does
+this every frame, but a program that draws only occasionally can call it
+from its event loop.  Returns the number of reports delivered.
+
+=cut
+
+sub process_x_errors {
+	X11::MinimalOpenGLContext::UIContext::x_errors_pending()
+		? _X11_dispatch_errors() : 0;
+}
+
+=head2 drain_gl_debug
+
+  my $messages= $glc->drain_gl_debug;
+
+Remove all queued OpenGL debug messages, log them to Log::Any (C<high>
+severity as errors, C<medium> as warnings, C<low> as info, and notifications
+as debug), and return them as an arrayref of hashrefs with keys C<source>,
+C<type>, C<id>, C<severity>, and C<message>.  If messages arrived faster than
+they were drained, a warning says how many were lost.  L</show> calls this
+for you.
+
+=cut
+
+my %_gl_debug_log_level= ( high => 'error', medium => 'warn', low => 'info', notification => 'debug' );
+
+sub drain_gl_debug {
+	my $self= shift;
+	my @messages;
+	my $dropped= $self->_ui_context->drain_debug_messages(\@messages);
+	for (@messages) {
+		my $level= $_gl_debug_log_level{$_->{severity}} || 'debug';
+		$log->$level("GL $_->{type} ($_->{source} #$_->{id}): $_->{message}");
+	}
+	$log->warn("$dropped GL debug messages were dropped") if $dropped;
+	return \@messages;
+}
+
+=head2 present_stats
+
+Returns a hashref of C<count> (number of frames shown), C<interval> (seconds
+between the last two calls to L</show>), and C<duration> (seconds spent
+inside the last one).  Also C<make_current> and C<make_current_skipped>,
+the number of L</set_gl_target> calls that had to switch context and the
+number that found it already current, and C<partial>, the number of frames
+presented as damaged rectangles only.
+
+=cut
+
+sub present_stats {
+	return { $_[0]->_ui_context->present_stats };
+}
+
+=head2 draw_vertices
+
+  my $buf= pack '(f2 C4)*', map { (cos($_)*.5, sin($_)*.5, 0, 0, 0, 255) } @angles;
+  $glc->draw_vertices('triangle_fan', 'v2f c4ub', $buf);
+
+Draw a whole array of vertices with one call.  C<$buf> is a string of packed
+vertices, a reference to one, or a L<PDL> (anything with C<get_dataref>).  The
+bytes are copied directly from the scalar into a streaming vertex buffer
+object, and drawn with one C<glDrawArrays>.  Returns the number of vertices.
+
+The mode is a C<GL_*> constant or one of C<points>, C<lines>, C<line_loop>,
+C<line_strip>, C<triangles>, C<triangle_strip>, C<triangle_fan>.
+
+The format lists the attributes of each vertex in the order they are packed:
+a letter for what it is (C<v>ertex, C<c>olor, C<t>exture coordinate,
+C<n>ormal), the number of components, and the type (C<f>, C<d>, C<b>, C<ub>,
+C<s>, C<us>, C<i>, C<ui>), like C<"v3f n3f t2f">.  With a compatibility
+profile they feed the fixed-function arrays.  With a core profile they are
+generic attributes 0, 1, 2... in that order, for the shader program you have
+bound.  (Asking for C<gl_version> 3.2 or later without a C<gl_profile>
+usually gets a core profile too.)
+
+The viewport's GL context must be the current one.  Attributes that aren't in
+the format are disabled for the draw.  With a compatibility profile, this
+leaves all of the vertex, color, texture coordinate and normal arrays
+disabled, and no buffer bound to C<GL_ARRAY_BUFFER>, so set up any client
+arrays of your own again after calling this.
+
+=cut
+
+my %_draw_modes= (
+	points => 0, lines => 1, line_loop => 2, line_strip => 3,
+	triangles => 4, triangle_strip => 5, triangle_fan => 6,
+);
+
+sub draw_vertices {
+	my ($self, $mode, $format, $buf)= @_;
+	$mode= $_draw_modes{$mode} // croak "Unknown draw mode '$mode'"
+		unless $mode =~ /^[0-9]+\z/;
+	$buf= $buf->get_dataref if blessed($buf) && $buf->can('get_dataref');
+	# Pass the referenced scalar itself, not a copy of it
+	return $self->_ui_context->draw_vertices($mode, $format, ref $buf eq 'SCALAR'? $$buf : $buf);
+}
+
+=head2 stream_reserve
+
+  my $buf= $glc->stream_reserve($n_vertices * $vertex_size);
+  substr($$buf, $ofs, length $packed, $packed);   # or vec(), etc.
+  $glc->draw_reserved('triangles', 'v2f c4ub');
+
+Returns a reference to a scalar of C<$bytes> bytes that you fill with vertex
+data, and then draw with L</draw_reserved>.  With a persistent mapping (see
+L</stream_persistent>) the scalar's string buffer I<is> the mapped GPU memory,
+so writing into it is the upload.  Write it in place, with 4-argument
+C<substr> or C<vec>; anything that changes its length croaks at
+C<draw_reserved>, and a plain assignment costs an extra copy.  Without a
+persistent mapping it is an ordinary zero-filled scalar that C<draw_reserved>
+uploads.
+
+The scalar becomes undef at the next C<stream_reserve>, C<draw_reserved>, or
+L</show>, so it can't be used to write into memory the GPU may be reading.
+
+=cut
+
+sub stream_reserve {
+	my ($self, $bytes)= @_;
+	return $self->_ui_context->stream_reserve($bytes);
+}
+
+=head2 draw_reserved
+
+  $glc->draw_reserved($mode, $format);
+
+Draw the vertices written into the scalar from L</stream_reserve>.  The mode
+and format are the same as for L</draw_vertices>.  Returns the number of
+vertices.
+
+=cut
+
+sub draw_reserved {
+	my ($self, $mode, $format)= @_;
+	$mode= $_draw_modes{$mode} // croak "Unknown draw mode '$mode'"
+		unless $mode =~ /^[0-9]+\z/;
+	return $self->_ui_context->draw_reserved($mode, $format);
+}
+
+=head2 stream_stats
+
+Returns a hashref of C<draws> and C<bytes> sent through L</draw_vertices>,
+how many times the stream buffer was C<orphans>-ed (or replaced by a larger
+one), and its C<buffer_size>.  With a persistent mapping, C<persistent> is
+true, C<region_size> is the space for each frame in flight, and
+C<fence_waits> counts the times the CPU caught up to the GPU and had to wait
+for a region to be free.
+
+=cut
+
+sub stream_stats {
+	return { $_[0]->_ui_context->stream_stats };
+}
+
+=head2 pixmap_pool_stats
+
+Returns a hashref of C<count> (pixmaps in the pool now), C<limit> (see
+L</pixmap_pool>), C<hits> (create_pixmap calls served from the pool) and
+C<misses> (calls that allocated a new one while the pool was enabled).
+
+=cut
+
+sub pixmap_pool_stats {
+	return { $_[0]->_ui_context->pixmap_pool_stats };
+}
+
+=head2 vk_setup_swapchain
+
+  $glc->vk_setup_swapchain($wnd,
+    present_mode     => 'mailbox', # or 'immediate', 'fifo', 'fifo_relaxed'
+    image_count      => 3,
+    frames_in_flight => 2,
+  );
+
+Present frames to window C<$wnd> through a Vulkan swapchain
+(VK_KHR_xlib_surface) instead of glXSwapBuffers.  libvulkan is loaded at
+runtime, so this dies if it (or the Vulkan headers, at build time) are not
+available.  If the requested present mode is not supported, C<'fifo'> is used.
+C<image_count> is clamped to what the surface allows, and C<frames_in_flight>
+is how many frames may be queued before L</vk_present> blocks.
+
+This is a copy path, not a faster way to present: frames rendered with GL are
+read back into host memory and uploaded again by Vulkan, which costs more than
+glXSwapBuffers.  Use it for control over the present mode and frame pacing, or
+to present frames you render on the CPU.  It works with a software Vulkan
+driver like lavapipe under Xvfb.
+
+=head2 vk_present
+
+  $glc->vk_present();        # read back the current GL target
+  $glc->vk_present($pixels); # width*height*4 bytes of BGRA, top row first
+
+Copy one frame into the next swapchain image and queue it for presentation.
+With no argument, the frame is read from the current GL target (which should
+be the same size as the window) and flipped to top-row-first.  Returns false
+if the frame was dropped because the window changed size; the swapchain is
+rebuilt for the new size, which you can see in L</vk_swapchain_info>.
+
+=head2 vk_swapchain_info
+
+Returns a hashref of C<width>, C<height>, C<image_count>, C<frames_in_flight>,
+and C<present_mode> of the current swapchain.
+
+=head2 vk_teardown
+
+Destroy the swapchain and Vulkan device.  This also happens on L</disconnect>.
+
+=cut
+
+sub vk_setup_swapchain {
+	my ($self, $wnd, %opts)= @_;
+	$self->_ui_context->vk_setup(ref $wnd? $wnd->xid : $wnd,
+		$opts{present_mode} || 'fifo', $opts{image_count} || 0, $opts{frames_in_flight} || 2);
+	return $self;
+}
+
+sub vk_present {
+	my ($self, $pixels)= @_;
+	return $self->_ui_context->vk_present($pixels);
+}
+
+sub vk_swapchain_info {
+	return { $_[0]->_ui_context->vk_info };
+}
+
+sub vk_teardown {
+	my $self= shift;
+	$self->_ui_context->vk_teardown;
+	return $self;
 }
 
 =head2 get_gl_errors
@@ -504,20 +1143,20 @@ hash of the symbolic names of the error constants.
 =cut
 
 my %_gl_err_msg= (
-	OpenGL::GL_INVALID_ENUM()      => "Invalid Enum",
-	OpenGL::GL_INVALID_VALUE()     => "Invalid Value",
-	OpenGL::GL_INVALID_OPERATION() => "Invalid Operation",
-	OpenGL::GL_STACK_OVERFLOW()    => "Stack Overflow",
-	OpenGL::GL_STACK_UNDERFLOW()   => "Stack Underflow",
-	OpenGL::GL_OUT_OF_MEMORY()     => "Out of Memory",
-#	OpenGL::GL_TABLE_TOO_LARGE()   => "Table Too Large",
+	X11::MinimalOpenGLContext::GL::GL_INVALID_ENUM()      => "Invalid Enum",
+	X11::MinimalOpenGLContext::GL::GL_INVALID_VALUE()     => "Invalid Value",
+	X11::MinimalOpenGLContext::GL::GL_INVALID_OPERATION() => "Invalid Operation",
+	X11::MinimalOpenGLContext::GL::GL_STACK_OVERFLOW()    => "Stack Overflow",
+	X11::MinimalOpenGLContext::GL::GL_STACK_UNDERFLOW()   => "Stack Underflow",
+	X11::MinimalOpenGLContext::GL::GL_OUT_OF_MEMORY()     => "Out of Memory",
+	X11::MinimalOpenGLContext::GL::GL_INVALID_FRAMEBUFFER_OPERATION() => "Invalid Framebuffer Operation",
 );
 
 sub get_gl_errors {
 	my $self= shift;
 	my (%errors, $e);
 	$errors{$e}= $_gl_err_msg{$e} || "(unrecognized) ".$e
-		while (($e= OpenGL::glGetError()) != OpenGL::GL_NO_ERROR());
+		while (($e= glGetError()) != GL_NO_ERROR);
 	return (keys %errors)? \%errors : undef;
 }
 
@@ -534,20 +1173,30 @@ sub _X11_error_code_byval {
 	return \%_X11_error_code_byval;
 }
 
+# The XLib error handler only queues errors; this delivers them.
+sub _X11_dispatch_errors {
+	my @errors;
+	my $dropped= X11::MinimalOpenGLContext::UIContext::drain_x_errors(\@errors);
+	$log->warn("X11 error queue overflowed, $dropped errors not reported")
+		if $dropped;
+	my $n= @errors / 2;
+	# (owner, error) pairs, where C already looked up the owner by Display*
+	while (my ($glc, $err)= splice @errors, 0, 2) {
+		_X11_error($err, $glc);
+	}
+	return $n;
+}
+
 # This is called for recoverable errors on the X11 stream
 # most notably when a window has been closed and is no longer valid.
 sub _X11_error {
-	my ($err)= @_;
+	my ($err, $glc)= @_;
 	$err->{error_code_name}= _X11_error_code_byval()->{$err->{error_code}} || '(unknown)';
-
-	# iterate through all connections to see which one the error applies to.
-	for (values %_ConnectedInstances) {
-		if ($_->_has_ui_context && $_->_ui_context->display eq $err->{display}) {
-			$_->on_error->($_, $err, 0)
-				if $_->on_error;
-			last;
-		}
-	}
+	$log->debugf("X11 error %s (request %d.%d from %s) x%d", $err->{error_code_name},
+		$err->{request_code}, $err->{minor_code}, $err->{operation} || 'unknown', $err->{count})
+		if $log->is_debug;
+	$glc->on_error->($glc, $err, 0)
+		if $glc && $glc->on_error;
 }
 
 # This is called when XLib encounters a fatal error (like lost XServer)
@@ -0,0 +1,166 @@
+package X11::MinimalOpenGLContext::GL;
+use strict;
+use warnings;
+use Exporter 'import';
+
+# ABSTRACT - The few OpenGL functions X11::MinimalOpenGLContext needs, without POGL
+
+=head1 SYNOPSIS
+
+  use X11::MinimalOpenGLContext::GL ':all';
+
+  $glc->set_gl_target;
+  glClearColor(0, 0, 0, 1);
+  glClear(GL_COLOR_BUFFER_BIT);
+  my $rgba= glReadPixels(0, 0, $w, $h, GL_RGBA, GL_UNSIGNED_BYTE);
+  $glc->show;
+
+=head1 DESCRIPTION
+
+These are the core GL calls that a basic frame needs (viewport, projection,
+clear, error checks, and readback), implemented directly in this module's XS
+so that simple programs don't need the L<OpenGL> (POGL) module at all.
+
+The function pointers are looked up once when the context is created, through
+the backend's own C<GetProcAddress>, and each call goes through the table of
+the UIContext most recently made current with
+L<X11::MinimalOpenGLContext/set_gl_target>.  This means they also work for the
+C<'osmesa'> and C<'xshm'> backends, where calls through libGL would not reach
+the context.  They die with C<"No current GL context"> before that.
+
+The fixed-function calls (C<glMatrixMode>, C<glLoadIdentity>,
+C<glLoadMatrixd>, C<glFrustum>, C<glTranslated>) die if the GL library
+doesn't export them.  In a core profile they exist but raise
+C<GL_INVALID_OPERATION>, as usual.
+
+Nothing is exported by default.  Tags are C<:functions>, C<:constants>, and
+C<:all>.
+
+=head1 FUNCTIONS
+
+=head2 glGetError
+
+=head2 glGetString
+
+Returns undef if the GL returns NULL.
+
+=head2 glEnable
+
+=head2 glDisable
+
+=head2 glFlush
+
+=head2 glFinish
+
+=head2 glViewport
+
+=head2 glClearColor
+
+=head2 glClear
+
+=head2 glFrontFace
+
+=head2 glPixelStorei
+
+=head2 glReadPixels
+
+  my $pixels= glReadPixels($x, $y, $w, $h, $format, $type);
+
+Returns the pixels as a string of bytes, bottom row first.  Rows are padded
+to the current C<GL_PACK_ALIGNMENT> (4 by default, so RGBA rows are never
+padded).  C<GL_PACK_ROW_LENGTH> and the C<GL_PACK_SKIP_*> settings must be
+left at 0.  Dies for format/type combinations it doesn't know the size of.
+
+=head2 glMatrixMode
+
+=head2 glLoadIdentity
+
+=head2 glLoadMatrixd
+
+  glLoadMatrixd(@m);              # 16 numbers, column-major
+  glLoadMatrixd(pack 'd16', @m);  # or one packed string
+
+=head2 glFrustum
+
+=head2 glTranslated
+
+=cut
+
+our @EXPORT_FUNCTIONS= qw(
+	glGetError glGetString glEnable glDisable glFlush glFinish
+	glViewport glClearColor glClear glFrontFace glPixelStorei glReadPixels
+	glMatrixMode glLoadIdentity glLoadMatrixd glFrustum glTranslated
+);
+
+=head1 CONSTANTS
+
+Only the ones relevant to the functions above are provided, plus the
+primitive types for L<X11::MinimalOpenGLContext/draw_vertices>.
+
+=cut
+
+use constant {
+	GL_POINTS                        => 0,
+	GL_LINES                         => 1,
+	GL_LINE_LOOP                     => 2,
+	GL_LINE_STRIP                    => 3,
+	GL_TRIANGLES                     => 4,
+	GL_TRIANGLE_STRIP                => 5,
+	GL_TRIANGLE_FAN                  => 6,
+	GL_NO_ERROR                      => 0,
+	GL_INVALID_ENUM                  => 0x0500,
+	GL_INVALID_VALUE                 => 0x0501,
+	GL_INVALID_OPERATION             => 0x0502,
+	GL_STACK_OVERFLOW                => 0x0503,
+	GL_STACK_UNDERFLOW               => 0x0504,
+	GL_OUT_OF_MEMORY                 => 0x0505,
+	GL_INVALID_FRAMEBUFFER_OPERATION => 0x0506,
+	GL_DEPTH_BUFFER_BIT              => 0x00000100,
+	GL_STENCIL_BUFFER_BIT            => 0x00000400,
+	GL_COLOR_BUFFER_BIT              => 0x00004000,
+	GL_CW                            => 0x0900,
+	GL_CCW                           => 0x0901,
+	GL_DEPTH_TEST                    => 0x0B71,
+	GL_BLEND                         => 0x0BE2,
+	GL_PACK_ALIGNMENT                => 0x0D05,
+	GL_MODELVIEW                     => 0x1700,
+	GL_PROJECTION                    => 0x1701,
+	GL_VENDOR                        => 0x1F00,
+	GL_RENDERER                      => 0x1F01,
+	GL_VERSION                       => 0x1F02,
+	GL_EXTENSIONS                    => 0x1F03,
+	GL_UNSIGNED_BYTE                 => 0x1401,
+	GL_FLOAT                         => 0x1406,
+	GL_DEPTH_COMPONENT               => 0x1902,
+	GL_RED                           => 0x1903,
+	GL_ALPHA                         => 0x1906,
+	GL_RGB                           => 0x1907,
+	GL_RGBA                          => 0x1908,
+	GL_BGR                           => 0x80E0,
+	GL_BGRA                          => 0x80E1,
+	GL_FRAMEBUFFER_SRGB              => 0x8DB9,
+};
+
+our @EXPORT_CONSTANTS= qw(
+	GL_POINTS GL_LINES GL_LINE_LOOP GL_LINE_STRIP GL_TRIANGLES GL_TRIANGLE_STRIP GL_TRIANGLE_FAN
+	GL_NO_ERROR GL_INVALID_ENUM GL_INVALID_VALUE GL_INVALID_OPERATION
+	GL_STACK_OVERFLOW GL_STACK_UNDERFLOW GL_OUT_OF_MEMORY GL_INVALID_FRAMEBUFFER_OPERATION
+	GL_DEPTH_BUFFER_BIT GL_STENCIL_BUFFER_BIT GL_COLOR_BUFFER_BIT
+	GL_CW GL_CCW GL_DEPTH_TEST GL_BLEND GL_PACK_ALIGNMENT GL_MODELVIEW GL_PROJECTION
+	GL_VENDOR GL_RENDERER GL_VERSION GL_EXTENSIONS
+	GL_UNSIGNED_BYTE GL_FLOAT GL_DEPTH_COMPONENT GL_RED GL_ALPHA GL_RGB GL_RGBA GL_BGR GL_BGRA
+	GL_FRAMEBUFFER_SRGB
+);
+
+our @EXPORT_OK= ( @EXPORT_FUNCTIONS, @EXPORT_CONSTANTS );
+our %EXPORT_TAGS= (
+	functions => \@EXPORT_FUNCTIONS,
+	constants => \@EXPORT_CONSTANTS,
+	all       => \@EXPORT_OK,
+);
+
+# The functions are in the module's XS.  Loaded last, because it imports
+# from this package.
+require X11::MinimalOpenGLContext;
+
+1;
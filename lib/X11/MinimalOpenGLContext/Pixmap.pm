@@ -33,14 +33,18 @@ sub h   { $_[0][3] }
 
 =head2 new
 
-Constructor, takes a reference to the context, ...
+Constructor, takes a reference to the context, the width and height, and
+optionally a file name to memory-map as the pixel storage (only supported
+by the C<'osmesa'> backend).
 
 =cut
 
 sub new {
-	my ($class, $glc, $w, $h)= @_;
+	my ($class, $glc, $w, $h, $mmap_file)= @_;
 	defined $w && defined $h or croak "Width and height are required";
-	my $xid= $glc->_ui_context->create_pixmap($w, $h);
+	my $xid= defined $mmap_file
+		? $glc->_ui_context->create_mapped_pixmap($w, $h, $mmap_file)
+		: $glc->_ui_context->create_pixmap($w, $h);
 	my $self= bless [ $glc, $xid, $w, $h ], $class;
 	Scalar::Util::weaken($self->[0]);
 	return $self;
@@ -48,8 +52,9 @@ sub new {
 
 sub DESTROY {
 	my $self= shift;
-	# If weak reference still exists, then free the window
-	$self->ctx->_ui_context->destroy_pixmap($self->xid)
+	# If weak reference still exists, then free the pixmap, or give it back to
+	# the context's pixmap_pool
+	$self->ctx->_ui_context->release_pixmap($self->xid, $self->w, $self->h)
 		if $self->ctx;
 }
 
@@ -64,4 +69,25 @@ sub get_rect {
 	return X11::MinimalOpenGLContext::Rect->new(0, 0, $self->w, $self->h);
 }
 
+=head2 pixels
+
+  my $rgba_ref= $pixmap->pixels;
+  my ($r, $g, $b, $a)= unpack 'C4', $$rgba_ref;
+
+For the C<'osmesa'> backend, returns a reference to a read-only scalar whose
+string buffer I<is> the pixmap memory: C<w * h * 4> bytes of RGBA, bottom row
+first.  No copy is made (unless you copy C<$$rgba_ref> into another
+variable), so read it after C<show>.  Every call for the same pixmap returns
+the same scalar.  Once the pixmap is destroyed (or given back to the
+L<pixmap_pool|X11::MinimalOpenGLContext/pixmap_pool>), or the context is
+disconnected, the scalar becomes undef rather than pointing at freed memory.
+Dies for other backends.
+
+=cut
+
+sub pixels {
+	my $self= shift;
+	return $self->ctx->_ui_context->pixmap_buffer($self->xid);
+}
+
 1;
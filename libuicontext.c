@@ -0,0 +1,6 @@
+// The whole of uicontext as one translation unit, for building it as a C
+// library without perl (the .xs includes the same three files).  Public
+// declarations are in uicontext.h.
+#include "uicontext.c"
+#include "vkswapchain.c"
+#include "vertexstream.c"
@@ -5,6 +5,7 @@
 
 use Test::More;
 use IO::Handle;
+use File::Temp;
 use Log::Any::Adapter 'TAP';
 sub errmsg(&) {	eval { shift->() };	defined $@? $@ : ''; }
 
@@ -20,6 +21,9 @@ isa_ok( $v->_ui_context, 'X11::MinimalOpenGLContext::UIContext', 'has ui context
 like(errmsg{ $v->_ui_context->screen_metrics }, qr/connect/i, 'screen dims unavailable before connect' );
 $v->_ui_context->connect(undef);
 is( errmsg{my @metrics= $v->_ui_context->screen_metrics }, '', 'got screen dims' );
+my ($some_ext)= split / /, $v->_ui_context->glx_extensions;
+ok( $v->_ui_context->has_glx_extension($some_ext), "has_glx_extension $some_ext" );
+ok( !$v->_ui_context->has_glx_extension('GLX_NO_such_extension'), 'has_glx_extension of unknown name' );
 
 is( errmsg{ $v->_ui_context->setup_glcontext(1, 0) }, '', 'setup_glcontext' );
 
@@ -31,6 +35,61 @@ ok( $rect->[2] > 0, 'can load window dimensions' );
 # Test lack of an exception
 is( errmsg { $v->_ui_context->glXMakeCurrent($wnd_xid) }, '', 'XMakeCurrent' );
 is( errmsg { $v->_ui_context->glXSwapBuffers(); }, '', 'glXSwapBuffers' );
+is( $v->_ui_context->present(1, 1), 0, 'present without GL errors' );
+my %stats= $v->_ui_context->present_stats;
+is( $stats{count}, 1, 'present was counted' );
+
+my %phases= $v->_ui_context->startup_phase_times;
+ok( defined $phases{XOpenDisplay} && $phases{XOpenDisplay} >= 0, 'XOpenDisplay was timed' );
+ok( defined $phases{glXCreateContext}, 'glXCreateContext was timed' );
+is( scalar @{ $v->startup_report->{phases} }, scalar keys %phases, 'startup_report lists each phase' );
+
+# X errors are queued, and repeats are coalesced into one report
+$v->_ui_context->destroy_window(0x3FFFFF) for 1..3;
+$v->_ui_context->window_rect($wnd_xid); # round trip, so the errors arrive
+ok( X11::MinimalOpenGLContext::UIContext::x_errors_pending(), 'X errors pending' );
+my @x_errors;
+is( X11::MinimalOpenGLContext::UIContext::drain_x_errors(\@x_errors), 0, 'no X errors dropped' );
+is( scalar @x_errors, 2, 'repeated X error coalesced' );
+is( $x_errors[0], $v, 'X error routed to owner' );
+is( $x_errors[1]{count}, 3, 'coalesced X error count' );
+is( $x_errors[1]{operation}, 'UIContext_destroy_window', 'X error attributed by serial' );
+ok( $x_errors[1]{serial} > $x_errors[1]{first_serial}, 'first and last serial' );
+ok( !X11::MinimalOpenGLContext::UIContext::x_errors_pending(), 'X error queue drained' );
+
+# The FBConfig cache is written by the first viewport, read by the next, and
+# rewritten (keeping other keys' lines) when its ID goes stale
+my $cache_dir= File::Temp->newdir;
+my $cache= "$cache_dir/fbconfig";
+sub cached_fbconfig_id {
+	my $glc= X11::MinimalOpenGLContext->new(fbconfig_cache => $cache);
+	$glc->connect;
+	$glc->setup_glcontext;
+	my %attrs;
+	my $err= errmsg{ %attrs= $glc->_ui_context->fbconfig_attribs };
+	$glc->disconnect;
+	return $err? undef : $attrs{id};
+}
+sub slurp {
+	open my $fh, '<', $_[0] or die "open($_[0]): $!";
+	local $/;
+	return scalar <$fh>;
+}
+SKIP: {
+	my $id= cached_fbconfig_id();
+	skip 'No FBConfigs before GLX 1.3', 5 unless $id;
+	my $content= slurp($cache);
+	my ($key)= $content =~ /^(.*)\t/;
+	is( $content, sprintf("%s\t%X\n", $key, $id), 'chosen FBConfig written to the cache' );
+	utime 1, 1, $cache;
+	is( cached_fbconfig_id(), $id, 'cached FBConfig used' );
+	is( (stat $cache)[9], 1, 'cache not rewritten when its ID is valid' );
+	open my $fh, '>', $cache or die "open($cache): $!";
+	print $fh "other display\t21\n$key\tFFFFFF\n";
+	close $fh;
+	is( cached_fbconfig_id(), $id, 'stale ID falls back to the full search' );
+	is( slurp($cache), sprintf("other display\t21\n%s\t%X\n", $key, $id), 'stale line replaced, other lines kept' );
+}
 
 is( errmsg{ $v->_ui_context->disconnect() }, '', 'disconnect' );
 done_testing;
@@ -5,11 +5,12 @@
 
 use Test::More;
 use Time::HiRes 'sleep';
-use OpenGL qw(:glfunctions :glconstants);
 use Log::Any::Adapter 'TAP';
 sub errmsg(&) {	eval { shift->() };	defined $@? $@ : ''; }
 
 use_ok('X11::MinimalOpenGLContext') or BAIL_OUT;
+use X11::MinimalOpenGLContext::GL ':all';
+use Math::Trig 'deg2rad';
 
 my $v= new_ok( 'X11::MinimalOpenGLContext', [on_error => sub { use DDP; p $_[1]; }], 'new viewport' );
 
@@ -42,26 +43,114 @@ glClearColor(1, 1, 0, 1);
 glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
 # Circle should touch top and bottom of window
-glBegin(GL_TRIANGLE_FAN);
-use Math::Trig 'deg2rad';
-glColor3f(0, 0, 0);
-glVertex2d(0, 0);
-for (0..360) {
-	glVertex2d(cos(deg2rad($_))*.5, sin(deg2rad($_))*.5);
-}
-glEnd();
+my $circle= pack '(f2 C4)*', 0, 0, 0, 0, 0, 255,
+	map { (cos(deg2rad($_))*.5, sin(deg2rad($_))*.5, 0, 0, 0, 255) } 0..360;
+is( $v->draw_vertices(GL_TRIANGLE_FAN, 'v2f c4ub', $circle), 362, 'draw circle' );
 $v->show;
 sleep 1;
 # Circle should touch top and bottom of window
-glBegin(GL_TRIANGLE_FAN);
-use Math::Trig 'deg2rad';
-glColor3f(0, 0, 0);
-glVertex2d(0, 0);
-for (0..360) {
-	glVertex2d(cos(deg2rad($_))*.5, sin(deg2rad($_))*.5);
-}
-glEnd();
-$v->show;
+is( $v->draw_vertices('triangle_fan', 'v2f c4ub', \$circle), 362, 'draw circle from scalar ref' );
+is( $v->stream_stats->{draws}, 2, 'two draws' );
+ok( $v->show, 'show' );
 sleep 2;
 
+# Redraw and present only two corners.  The rectangles count from the bottom
+# left like GL, while X11 (and window_pixel) count rows from the top.
+sub window_pixel {
+	my ($glc, $x, $y)= @_;
+	sprintf '%06X', $glc->_ui_context->window_pixel($glc->_gl_target->xid, $x, $y) & 0xFFFFFF;
+}
+glClearColor(1, 1, 0, 1);
+glClear(GL_COLOR_BUFFER_BIT);
+ok( $v->show, 'show' );
+is( window_pixel($v, 350, 150), 'FFFF00', 'window shows the full frame' );
+glClearColor(0, 0, 1, 1);
+glClear(GL_COLOR_BUFFER_BIT);
+ok( $v->show([0, 0, 100, 100], [300, 100, 100, 100]), 'show damaged rectangles' );
+is( window_pixel($v, 50, 150), '0000FF', 'first rectangle presented' );
+is( window_pixel($v, 350, 50), '0000FF', 'second rectangle presented' );
+if ($v->present_stats->{partial}) {
+	is( window_pixel($v, 350, 150), 'FFFF00', 'rest of the window unchanged' );
+	is( $v->buffer_age, 1, 'back buffer is kept by a partial present' );
+} else {
+	is( window_pixel($v, 350, 150), '0000FF', 'without GLX_MESA_copy_sub_buffer the whole frame is shown' );
+}
+sleep .5;
+
+# Scale a pixmap up into the window.  The pixmap is single-buffered, so it
+# has to be read from its front buffer, and the window from its back buffer.
+my $wnd= $v->_gl_target;
+my $pxm= $v->create_pixmap(4, 2);
+$v->set_gl_target($pxm);
+glViewport(0, 0, 4, 2);
+glClearColor(0, 1, 0, 1);
+glClear(GL_COLOR_BUFFER_BIT);
+is( join(',', unpack 'C3', glReadPixels(1, 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '0,255,0', 'pixmap rendered' );
+$v->set_gl_target($wnd);
+glClearColor(0, 0, 0, 1);
+glClear(GL_COLOR_BUFFER_BIT);
+is( errmsg{ $v->blit($pxm, $wnd, linear => 0) }, '', 'blit pixmap into window' );
+is( join(',', unpack 'C3', glReadPixels(1, 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '0,255,0',
+	'glReadPixels during the blit reads the pixmap' );
+$v->set_gl_target($wnd);
+is( join(',', unpack 'C3', glReadPixels(200, 100, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '0,255,0', 'window has the scaled pixmap' );
+ok( $v->show, 'show' );
+undef $pxm;
+sleep .5;
+is( errmsg{ $v->disconnect }, '', 'disconnect' );
+
+# Each FBConfig preference is met, and pixmaps get a config with the same depth
+# and stencil sizes that the context can render to
+use constant GLX_PIXMAP_BIT => 0x2;
+for my $prefs ({ depth_bits => 24 }, { depth_bits => 16, stencil_bits => 8 }, { samples => 4 },
+	{ srgb => 1 }, { double_buffer => 0 }
+) {
+	my $desc= join ' ', %$prefs;
+	my $g= X11::MinimalOpenGLContext->new(%$prefs);
+	SKIP: {
+		my $err= errmsg{ $g->setup_glcontext };
+		skip "No FBConfig for $desc: $err", 8 if $err;
+		my %fb= $g->_ui_context->fbconfig_attribs;
+		ok( $fb{depth} >= ($prefs->{depth_bits} || 0), "$desc: depth size $fb{depth}" );
+		ok( $fb{stencil} >= ($prefs->{stencil_bits} || 0), "$desc: stencil size $fb{stencil}" );
+		ok( $fb{samples} >= ($prefs->{samples} || 0), "$desc: $fb{samples} samples" );
+		ok( $fb{srgb} || !$prefs->{srgb}, "$desc: sRGB capable $fb{srgb}" );
+		is( $fb{double_buffer}, (!defined $prefs->{double_buffer} || $prefs->{double_buffer})? 1 : 0, "$desc: double buffer" );
+		my %pfb= $g->_ui_context->fbconfig_attribs(1);
+		ok( $pfb{drawable_type} & GLX_PIXMAP_BIT, "$desc: pixmap config can render to pixmaps" );
+		is( "$pfb{depth} $pfb{stencil}", "$fb{depth} $fb{stencil}", "$desc: pixmap config has the same depth and stencil" );
+		$g->setup_pixmap(4, 4);
+		glClearColor(0, 1, 0, 1);
+		glClear(GL_COLOR_BUFFER_BIT);
+		is( join(',', unpack 'C3', glReadPixels(1, 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '0,255,0', "$desc: render to a pixmap" );
+	}
+	$g->disconnect;
+}
+
+# The XShm backend keeps two images, and presents rectangles with
+# XShmPutImage (or XPutImage)
+SKIP: {
+	my $s= X11::MinimalOpenGLContext->new(backend => 'xshm');
+	my $err= errmsg{ $s->setup_window([100, 100, 400, 200]) };
+	skip "No xshm backend: $err", 11 if $err;
+	glViewport(0, 0, 400, 200);
+	is( $s->buffer_age, 0, 'xshm: new image has no age' );
+	glClearColor(1, 1, 0, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+	ok( $s->show, 'xshm: show' );
+	is( $s->buffer_age, 0, 'xshm: other image not shown yet' );
+	glClear(GL_COLOR_BUFFER_BIT);
+	ok( $s->show, 'xshm: show' );
+	is( $s->buffer_age, 2, 'xshm: images alternate' );
+	is( window_pixel($s, 350, 150), 'FFFF00', 'xshm: window shows the full frame' );
+	glClearColor(0, 0, 1, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+	ok( $s->show([0, 0, 100, 100], [300, 100, 100, 100]), 'xshm: show damaged rectangles' );
+	is( window_pixel($s, 50, 150), '0000FF', 'xshm: first rectangle presented' );
+	is( window_pixel($s, 350, 50), '0000FF', 'xshm: second rectangle presented' );
+	is( window_pixel($s, 350, 150), 'FFFF00', 'xshm: rest of the window unchanged' );
+	is( $s->present_stats->{partial}, 1, 'xshm: partial present counted' );
+	$s->disconnect;
+}
+
 done_testing;
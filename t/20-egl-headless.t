@@ -0,0 +1,191 @@
+# Before `make install' is performed this script should be runnable with
+# `make test'. After `make install' it should work as `perl X11-MinimalOpenGLContext.t'
+
+#########################
+
+use Test::More;
+use Log::Any::Adapter 'TAP';
+sub errmsg(&) {	eval { shift->() };	defined $@? $@ : ''; }
+
+use_ok('X11::MinimalOpenGLContext') or BAIL_OUT;
+use X11::MinimalOpenGLContext::GL ':all';
+
+my $v= new_ok( 'X11::MinimalOpenGLContext', [ backend => 'egl' ], 'new viewport' );
+
+my $err= errmsg{ $v->connect };
+plan skip_all => "No headless EGL available: $err" if $err;
+
+is( $v->_ui_context->backend, 'egl', 'using EGL backend' );
+is( errmsg{ $v->setup_pixmap(64, 32) }, '', 'setup_pixmap' );
+ok( $v->_gl_target->xid, 'pixmap is a framebuffer object' );
+like( errmsg{ $v->create_window }, qr/X11/, 'no windows without X11' );
+is( errmsg{ $v->project_frustum }, '', 'project_frustum' );
+my @mat4= unpack 'f16', $v->frustum_matrix;
+is( scalar @mat4, 16, 'frustum_matrix is packed float[16]' );
+is( $mat4[11], -1, 'perspective divide by -z' );
+is( glGetError(), GL_NO_ERROR, 'no GL errors from projection' );
+glClearColor(1, 1, 0, 1);
+glClear(GL_COLOR_BUFFER_BIT);
+glMatrixMode(GL_PROJECTION);
+glLoadIdentity();
+my $triangle= pack '(f2 C4)*', -1, -1, 0, 0, 0, 255,   1, -1, 0, 0, 0, 255,   -1, 1, 0, 0, 0, 255;
+like( errmsg{ $v->draw_vertices('triangles', '', $triangle) }, qr/no vertex position/, 'empty format on a new stream' );
+is( $v->draw_vertices('triangles', 'v2f c4ub', $triangle), 3, 'draw_vertices' );
+is( join(',', unpack 'C4', glReadPixels(2, 2, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '0,0,0,255', 'triangle drawn' );
+is( join(',', unpack 'C4', glReadPixels(62, 30, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '255,255,0,255', 'only the triangle' );
+like( errmsg{ $v->draw_vertices('triangles', 'v2f', 'abc') }, qr/multiple/, 'partial vertex' );
+like( errmsg{ $v->draw_vertices('triangles', 'x2f', $triangle) }, qr/Unknown attribute/, 'bad format' );
+like( errmsg{ $v->draw_vertices('triangles', '', $triangle) }, qr/no vertex position/, 'empty format after a bad one' );
+glClear(GL_COLOR_BUFFER_BIT);
+my $reserved= $v->stream_reserve(length $triangle);
+substr($$reserved, 0, length $triangle, $triangle);
+is( $v->draw_reserved('triangles', 'v2f c4ub'), 3, 'draw_reserved' );
+ok( !defined $$reserved, 'reserved scalar released' );
+is( join(',', unpack 'C4', glReadPixels(2, 2, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '0,0,0,255', 'reserved triangle drawn' );
+glClearColor(1, 0, 0, 1);
+glClear(GL_COLOR_BUFFER_BIT);
+my $pixels= glReadPixels(0, 0, 64, 32, GL_RGBA, GL_UNSIGNED_BYTE);
+is( length $pixels, 64*32*4, 'glReadPixels size' );
+is( join(',', unpack 'C4', $pixels), '255,0,0,255', 'glReadPixels color' );
+ok( $v->show, 'show' );
+
+is( errmsg{ $v->disconnect }, '', 'disconnect' );
+
+my $d= new_ok( 'X11::MinimalOpenGLContext', [ backend => 'egl', gl_debug => 1 ], 'viewport with gl_debug' );
+is( errmsg{ $d->setup_pixmap(16, 16) }, '', 'setup_pixmap with debug context' );
+glClear(0xFFFFFFFF);
+ok( !$d->show, 'show reports error from debug output' );
+ok( $d->show, 'debug messages were drained' );
+is( errmsg{ $d->disconnect }, '', 'disconnect' );
+my $c= new_ok( 'X11::MinimalOpenGLContext', [ backend => 'egl', gl_version => '3.3', gl_profile => 'core', gl_no_error => 1 ], 'viewport with core profile' );
+is( errmsg{ $c->setup_pixmap(16, 16) }, '', 'setup_pixmap with core no-error context' );
+ok( $c->show, 'show' );
+$c->gl_debug(1);
+like( errmsg{ $c->setup_glcontext }, qr/no-error/, 'no_error conflicts with gl_debug' );
+is( errmsg{ $c->disconnect }, '', 'disconnect' );
+# 3.2 and later default to a core profile when none is named
+my $cv= new_ok( 'X11::MinimalOpenGLContext', [ backend => 'egl', gl_version => '3.3' ], 'viewport with version but no profile' );
+SKIP: {
+	my $err= errmsg{ $cv->setup_pixmap(8, 8) };
+	skip "No GL 3.3 context: $err", 3 if $err;
+	is( $cv->draw_vertices('triangles', 'v2f c4ub', $triangle), 3, 'draw_vertices' );
+	is( $cv->draw_vertices('triangles', 'v2f', pack 'f6', -1, -1, 1, -1, -1, 1), 3, 'draw_vertices with fewer attributes' );
+	is( glGetError(), GL_NO_ERROR, 'vertex stream matches the profile of the context' );
+}
+is( errmsg{ $cv->disconnect }, '', 'disconnect' );
+my $z= new_ok( 'X11::MinimalOpenGLContext', [ backend => 'egl', depth_bits => 16, stencil_bits => 8 ], 'viewport with depth buffer' );
+is( errmsg{ $z->setup_pixmap(16, 16) }, '', 'framebuffer object with depth and stencil' );
+glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+ok( $z->show, 'show' );
+is( errmsg{ $z->disconnect }, '', 'disconnect' );
+
+my $p= new_ok( 'X11::MinimalOpenGLContext', [ backend => 'egl', pixmap_pool => 2 ], 'viewport with pixmap pool' );
+is( errmsg{ $p->setup_pixmap(16, 16) }, '', 'setup_pixmap with pool' );
+my $xid= $p->create_pixmap(32, 32)->xid;
+is( $p->pixmap_pool_stats->{count}, 1, 'released pixmap is pooled' );
+my $pxm= $p->create_pixmap(32, 32);
+is( $pxm->xid, $xid, 'same size gets the pooled one back' );
+isnt( $p->create_pixmap(8, 8)->xid, $xid, 'other size does not' );
+$p->create_pixmap(9, 9) for 1..2;
+is_deeply( $p->pixmap_pool_stats, { count => 2, limit => 2, hits => 2, misses => 4 }, 'pool stats' );
+$p->set_gl_target($pxm);
+glClear(GL_COLOR_BUFFER_BIT);
+is( glGetError(), GL_NO_ERROR, 'render to recycled pixmap' );
+undef $pxm;
+is( errmsg{ $p->disconnect }, '', 'disconnect with pooled pixmaps' );
+
+# Render at a low resolution, then scale it up into another target
+my $b= new_ok( 'X11::MinimalOpenGLContext', [ backend => 'egl' ], 'viewport for blit' );
+is( errmsg{ $b->setup_pixmap(4, 2) }, '', 'setup_pixmap for blit source' );
+my $src= $b->_gl_target;
+glViewport(0, 0, 4, 2);
+glClearColor(0, 1, 0, 1);
+glClear(GL_COLOR_BUFFER_BIT);
+glMatrixMode(GL_PROJECTION);
+glLoadIdentity();
+$b->draw_vertices('triangles', 'v2f c4ub', pack '(f2 C4)*', map +($_->[0], $_->[1], 255, 0, 0, 255),
+	[-1,-1], [0,-1], [0,1], [-1,-1], [0,1], [-1,1]);
+my $dst= $b->create_pixmap(16, 8);
+$b->set_gl_target($dst);
+glClearColor(0, 0, 1, 1);
+glClear(GL_COLOR_BUFFER_BIT);
+is( errmsg{ $b->blit($src, $dst, linear => 0) }, '', 'blit whole target' );
+is( $b->_gl_target, $dst, 'destination is the target' );
+$b->set_gl_target($dst);
+is( join(',', unpack 'C3', glReadPixels(2, 4, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '255,0,0', 'left half scaled' );
+is( join(',', unpack 'C3', glReadPixels(12, 4, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '0,255,0', 'right half scaled' );
+$b->set_gl_target($dst);
+glClear(GL_COLOR_BUFFER_BIT);
+$b->blit($src, [2, 0, 2, 2], $dst, [8, 0, 8, 4]);
+$b->set_gl_target($dst);
+is( join(',', unpack 'C3', glReadPixels(12, 2, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '0,255,0', 'rectangle copied' );
+is( join(',', unpack 'C3', glReadPixels(12, 6, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '0,0,255', 'outside the rectangle unchanged' );
+$b->set_gl_target($dst, $src);
+is( join(',', unpack 'C3', glReadPixels(3, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '0,255,0', 'glReadPixels reads the read target' );
+like( errmsg{ $b->blit($src, [0, 0, 0, 2], $dst) }, qr/positive/, 'empty rectangle' );
+# The fallback for GLs without glBlitFramebuffer
+$b->_ui_context->_set_gl_can_blit(0);
+$b->set_gl_target($dst);
+glClear(GL_COLOR_BUFFER_BIT);
+is( errmsg{ $b->blit($src, $dst, linear => 0) }, '', 'blit with glCopyPixels' );
+$b->set_gl_target($dst);
+is( join(',', unpack 'C3', glReadPixels(2, 4, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '255,0,0', 'left half scaled by glCopyPixels' );
+is( join(',', unpack 'C3', glReadPixels(12, 4, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '0,255,0', 'right half scaled by glCopyPixels' );
+$b->_ui_context->_set_gl_can_blit(-1);
+is( $b->buffer_age, 1, 'offscreen targets keep their contents' );
+ok( $b->show([0, 0, 2, 2]), 'show with damage rectangles' );
+undef $dst;
+undef $src;
+is( errmsg{ $b->disconnect }, '', 'disconnect' );
+
+# Two contexts, rendering to three targets in turn
+my @ctx= map X11::MinimalOpenGLContext->new(backend => 'egl'), 1..2;
+$_->setup_pixmap(4, 4) for @ctx;
+my @targets= ([ $ctx[0], $ctx[0]->create_pixmap(4, 4), [1,0,0] ], [ $ctx[1], $ctx[1]->create_pixmap(4, 4), [0,1,0] ],
+	[ $ctx[0], $ctx[0]->create_pixmap(4, 4), [0,0,1] ]);
+for (1..3) {
+	for (@targets) {
+		$_->[0]->set_gl_target($_->[1]);
+		glClearColor(@{$_->[2]}, 1);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+}
+for (@targets) {
+	$_->[0]->set_gl_target($_->[1]);
+	is( join(',', unpack 'C3', glReadPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), join(',', map $_*255, @{$_->[2]}), 'target kept its color' );
+}
+ok( $ctx[0]->present_stats->{make_current_skipped} >= 3, 'switching targets of the current context skips eglMakeCurrent' );
+@targets= ();
+$ctx[1]->disconnect;
+is( errmsg{ glClear(GL_COLOR_BUFFER_BIT) }, '', 'other context is still current' );
+$ctx[0]->disconnect;
+like( errmsg{ glClear(GL_COLOR_BUFFER_BIT) }, qr/No current GL context/, 'nothing current after its context is destroyed' );
+
+# Changing or tearing down one context's GL state must not touch the current
+# context's vertex stream or debug callback
+my ($ea, $eb)= map X11::MinimalOpenGLContext->new(backend => 'egl', gl_debug => 1), 1..2;
+my $green= pack '(f2 C4)*', map +($_->[0], $_->[1], 0, 255, 0, 255), [-1,-1], [1,-1], [-1,1];
+for ($ea, $eb) {
+	$_->setup_pixmap(8, 8);
+	glViewport(0, 0, 8, 8);
+	is( $_->draw_vertices('triangles', 'v2f c4ub', $green), 3, 'draw_vertices' );
+	ok( $_->show, 'show' );
+}
+like( errmsg{ $ea->draw_vertices('triangles', 'v2f c4ub', $green) }, qr/not current/, 'draw_vertices needs its context current' );
+like( errmsg{ $ea->stream_reserve(length $green) }, qr/not current/, 'stream_reserve needs its context current' );
+$ea->set_gl_target($ea->_gl_target);
+$eb->gl_debug(0);
+glClear(0xFFFFFFFF);
+ok( !$ea->show, 'disabling debug output of another context keeps this one\'s' );
+is( errmsg{ $eb->setup_glcontext }, '', 'replace the GL context of the other viewport' );
+$ea->set_gl_target($ea->_gl_target);
+glClearColor(0, 0, 0, 1);
+glClear(GL_COLOR_BUFFER_BIT);
+is( $ea->draw_vertices('triangles', 'v2f c4ub', $green), 3, 'current context can still draw_vertices' );
+is( join(',', unpack 'C4', glReadPixels(1, 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '0,255,0,255', 'vertices drawn' );
+ok( $ea->show, 'show' );
+is( errmsg{ $eb->disconnect }, '', 'disconnect the context that is not current' );
+glClear(0xFFFFFFFF);
+ok( !$ea->show, 'debug callback of the current context still installed' );
+is( errmsg{ $ea->disconnect }, '', 'disconnect' );
+done_testing;
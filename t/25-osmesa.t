@@ -0,0 +1,87 @@
+# Before `make install' is performed this script should be runnable with
+# `make test'. After `make install' it should work as `perl X11-MinimalOpenGLContext.t'
+
+#########################
+
+use Test::More;
+use File::Temp;
+use Log::Any::Adapter 'TAP';
+sub errmsg(&) {	eval { shift->() };	defined $@? $@ : ''; }
+
+use_ok('X11::MinimalOpenGLContext') or BAIL_OUT;
+use X11::MinimalOpenGLContext::GL ':all';
+
+my $v= new_ok( 'X11::MinimalOpenGLContext', [ backend => 'osmesa' ], 'new viewport' );
+
+my $err= errmsg{ $v->connect };
+plan skip_all => "No OSMesa available: $err" if $err;
+
+is( $v->_ui_context->backend, 'osmesa', 'using OSMesa backend' );
+is( errmsg{ $v->setup_pixmap(8, 4) }, '', 'setup_pixmap' );
+my $pxm= $v->_gl_target;
+glViewport(0, 0, 8, 4);
+glClearColor(1, 1, 0, 1);
+glClear(GL_COLOR_BUFFER_BIT);
+glMatrixMode(GL_PROJECTION);
+glLoadIdentity();
+# Left half blue
+is( $v->draw_vertices('triangles', 'v2f c4ub', pack '(f2 C4)*', map +(@$_, 0, 0, 255, 255),
+	[-1,-1], [0,-1], [0,1], [-1,-1], [0,1], [-1,1]), 6, 'draw_vertices' );
+ok( $v->show, 'show' );
+is( join(',', unpack 'C4', glReadPixels(1, 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE)), '0,0,255,255', 'glReadPixels' );
+
+my $pixels= $pxm->pixels;
+is( length $$pixels, 8*4*4, 'pixels covers the whole pixmap' );
+is( $pxm->pixels, $pixels, 'same scalar every time' );
+is( join(',', unpack 'C4', substr($$pixels, (1*8+1)*4, 4)), '0,0,255,255', 'pixels in the left half' );
+is( join(',', unpack 'C4', substr($$pixels, (2*8+6)*4, 4)), '255,255,0,255', 'pixels in the right half' );
+ok( !eval { $$pixels= 'x'; 1 }, 'pixels scalar is read-only' );
+
+# The alias must not outlive the memory it points to
+my $other= $v->create_pixmap(4, 4);
+my $other_pixels= $other->pixels;
+is( length $$other_pixels, 4*4*4, 'pixels of another pixmap' );
+undef $other;
+ok( !defined $$other_pixels, 'pixels become undef when the pixmap is destroyed' );
+$v->set_gl_target($v->create_pixmap(4, 4));
+undef $pxm;
+ok( !defined $$pixels, 'pixels of the old target become undef when it is destroyed' );
+glClear(GL_COLOR_BUFFER_BIT);
+is( glGetError(), GL_NO_ERROR, 'render to the new target' );
+
+# Pixmaps given back to the pool are cut off too, before anything else can
+# get them and draw into them
+my $p= new_ok( 'X11::MinimalOpenGLContext', [ backend => 'osmesa', pixmap_pool => 2 ], 'viewport with pixmap pool' );
+is( errmsg{ $p->setup_pixmap(4, 4) }, '', 'setup_pixmap with pool' );
+my $pooled= $p->create_pixmap(4, 4);
+my $xid= $pooled->xid;
+my $pooled_pixels= $pooled->pixels;
+undef $pooled;
+is( $p->pixmap_pool_stats->{count}, 1, 'released pixmap is pooled' );
+ok( !defined $$pooled_pixels, 'pixels become undef when the pixmap goes back to the pool' );
+$pooled= $p->create_pixmap(4, 4);
+is( $pooled->xid, $xid, 'pooled pixmap is handed out again' );
+is( length ${ $pooled->pixels }, 4*4*4, 'and has pixels of its own again' );
+$pooled_pixels= $pooled->pixels;
+is( errmsg{ $p->disconnect }, '', 'disconnect' );
+ok( !defined $$pooled_pixels, 'pixels become undef on disconnect' );
+
+# Pixels stored in a file, for other processes to read
+my $dir= File::Temp->newdir;
+my $path= "$dir/pixels";
+my $m= new_ok( 'X11::MinimalOpenGLContext', [ backend => 'osmesa' ], 'viewport for mmap file' );
+is( errmsg{ $m->setup_pixmap(4, 2, $path) }, '', 'setup_pixmap with mmap file' );
+is( -s $path, 4*2*4, 'file sized to the pixmap' );
+glClearColor(0, 1, 0, 1);
+glClear(GL_COLOR_BUFFER_BIT);
+ok( $m->show, 'show' );
+open my $fh, '<:raw', $path or die "open($path): $!";
+my $data= do { local $/; <$fh> };
+close $fh;
+is( $data, pack('C4', 0, 255, 0, 255) x 8, 'file holds the rendered pixels' );
+is( $data, ${ $m->_gl_target->pixels }, 'and so does the pixels alias' );
+is( errmsg{ $m->disconnect }, '', 'disconnect' );
+is( -s $path, 4*2*4, 'file stays after disconnect' );
+
+is( errmsg{ $v->disconnect }, '', 'disconnect' );
+done_testing;
@@ -0,0 +1,43 @@
+# Before `make install' is performed this script should be runnable with
+# `make test'. After `make install' it should work as `perl X11-MinimalOpenGLContext.t'
+
+#########################
+
+use Test::More;
+use Log::Any::Adapter 'TAP';
+sub errmsg(&) {	eval { shift->() };	defined $@? $@ : ''; }
+
+use_ok('X11::MinimalOpenGLContext') or BAIL_OUT;
+use X11::MinimalOpenGLContext::GL ':all';
+
+my $v= new_ok( 'X11::MinimalOpenGLContext', [], 'new viewport' );
+
+my $err= errmsg{ $v->setup_window([0, 0, 64, 32]) };
+plan skip_all => "No X11 display: $err" if $err;
+my $wnd= $v->_gl_target;
+
+# Needs libvulkan and a driver that can present to Xlib windows (e.g. lavapipe)
+$err= errmsg{ $v->vk_setup_swapchain($wnd, present_mode => 'fifo', image_count => 2, frames_in_flight => 1) };
+plan skip_all => "No usable Vulkan: $err" if $err;
+
+my $info= $v->vk_swapchain_info;
+is( $info->{width},  64, 'swapchain width' );
+is( $info->{height}, 32, 'swapchain height' );
+is( $info->{present_mode}, 'fifo', 'present mode' );
+ok( $info->{image_count} >= 2, 'image_count' );
+is( $info->{frames_in_flight}, 1, 'frames_in_flight' );
+
+ok( $v->vk_present("\0\0\xFF\xFF" x (64*32)), 'present caller pixels' );
+like( errmsg{ $v->vk_present("\0" x 16) }, qr/Expected 8192 bytes/, 'short pixel buffer dies' );
+
+glViewport(0, 0, 64, 32);
+glClearColor(0, 1, 0, 1);
+glClear(GL_COLOR_BUFFER_BIT);
+ok( $v->vk_present, 'present GL target' ) for 1..3;
+
+is( errmsg{ $v->vk_teardown }, '', 'vk_teardown' );
+like( errmsg{ $v->vk_swapchain_info }, qr/vk_setup/, 'no swapchain after teardown' );
+is( errmsg{ $v->vk_setup_swapchain($wnd) }, '', 'set up again with defaults' );
+is( errmsg{ $v->disconnect }, '', 'disconnect tears it down' );
+
+done_testing;
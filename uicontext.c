@@ -1,69 +1,601 @@
-#include <GL/gl.h>
-#include <GL/glx.h>
-#include <X11/Xlib.h>
+#include "uicontext.h"
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+
+// EGL is only used for the headless backend, and libEGL is loaded at runtime
+// so that it is not a dependency of the module.  Only the headers are needed.
+#if defined(__has_include)
+ #if __has_include(<EGL/egl.h>) && __has_include(<EGL/eglext.h>)
+  #include <EGL/egl.h>
+  #include <EGL/eglext.h>
+  #define UICONTEXT_HAVE_EGL 1
+ #endif
+#endif
 
 // The .xs includes this file, and provides definitions for the
 //  logging functions, and also perl's "croak".
 // This file can be compiled on its own, separate from the .xs
-//  with these alternate versions of the macros.
+//  with these alternate versions of the macros.  Nothing else in it
+//  depends on perl.
 #ifndef log_error
  #include <stdio.h>
  #define log_info_enabled()  log_enabled("is_info")
  #define log_debug_enabled() log_enabled("is_debug")
  #define log_trace_enabled() log_enabled("is_trace")
- static int log_enabled(const char *method) { return 1; }
- #define log_error(x...) fprintf(stderr, "\nerror: " x)
- #define log_info(x...) fprintf(stderr, "\n" x)
- #define log_debug(x...) fprintf(stderr, "\ndebug: " x)
- #define log_trace(x...) fprintf(stderr, "\ntrace: " x)
- #define croak(x...) do { fprintf(stderr, "\nfatal: " x); exit(2); } while (0)
+ static int log_enabled(const char *method) { return getenv("UICONTEXT_DEBUG") != NULL; }
+ #define log_error(x...) fprintf(stderr, "error: " x), fputc('\n', stderr)
+ #define log_info(x...) do { if (log_enabled("is_info")) fprintf(stderr, x), fputc('\n', stderr); } while (0)
+ #define log_debug(x...) do { if (log_enabled("is_debug")) fprintf(stderr, "debug: " x), fputc('\n', stderr); } while (0)
+ #define log_trace(x...) do { if (log_enabled("is_trace")) fprintf(stderr, "trace: " x), fputc('\n', stderr); } while (0)
+ #define croak(x...) do { fprintf(stderr, "fatal: " x); fputc('\n', stderr); exit(2); } while (0)
+ #define UICONTEXT_STANDALONE
 #endif
 
 #if None != 0
  #error Code makes invalid assumtion about XID "None"!
 #endif
 
-typedef struct UIContext {
+// Each step of startup is timed, so that slow connections or slow drivers
+// can be diagnosed.  The names are what get reported to perl.  Requests that
+// Xlib only buffers (XCreateColormap, XCreateWindow) are timed without a
+// round trip, so they measure the client side only.
+enum UIContext_phase {
+	UICONTEXT_PHASE_XOPENDISPLAY,
+	UICONTEXT_PHASE_GLXQUERYVERSION,
+	UICONTEXT_PHASE_GLXQUERYEXTENSIONSSTRING,
+	UICONTEXT_PHASE_GLXCHOOSEVISUAL,
+	UICONTEXT_PHASE_GLXCREATECONTEXT,
+	UICONTEXT_PHASE_XCREATECOLORMAP,
+	UICONTEXT_PHASE_XCREATEWINDOW,
+	UICONTEXT_PHASE_XMAPWINDOW,
+	UICONTEXT_PHASE_COUNT
+};
+#ifndef UICONTEXT_STANDALONE
+static const char *UIContext_phase_names[UICONTEXT_PHASE_COUNT]= {
+	"XOpenDisplay",
+	"glXQueryVersion",
+	"glXQueryExtensionsString",
+	"glXChooseVisual",
+	"glXCreateContext",
+	"XCreateColormap",
+	"XCreateWindow",
+	"XMapWindow",
+};
+#endif
+
+// GLX extensions this module knows about.  glXQueryExtensionsString is parsed
+// into a bitset of these at connect, so checking one is a single bit test.
+enum UIContext_glx_ext {
+	UICONTEXT_GLX_ARB_create_context= 0,
+	UICONTEXT_GLX_ARB_create_context_no_error,
+	UICONTEXT_GLX_ARB_create_context_profile,
+	UICONTEXT_GLX_ARB_create_context_robustness,
+	UICONTEXT_GLX_ARB_fbconfig_float,
+	UICONTEXT_GLX_ARB_framebuffer_sRGB,
+	UICONTEXT_GLX_ARB_get_proc_address,
+	UICONTEXT_GLX_ARB_multisample,
+	UICONTEXT_GLX_EXT_buffer_age,
+	UICONTEXT_GLX_EXT_create_context_es2_profile,
+	UICONTEXT_GLX_EXT_framebuffer_sRGB,
+	UICONTEXT_GLX_EXT_import_context,
+	UICONTEXT_GLX_EXT_no_config_context,
+	UICONTEXT_GLX_EXT_swap_control,
+	UICONTEXT_GLX_EXT_swap_control_tear,
+	UICONTEXT_GLX_EXT_texture_from_pixmap,
+	UICONTEXT_GLX_EXT_visual_info,
+	UICONTEXT_GLX_EXT_visual_rating,
+	UICONTEXT_GLX_INTEL_swap_event,
+	UICONTEXT_GLX_MESA_copy_sub_buffer,
+	UICONTEXT_GLX_MESA_query_renderer,
+	UICONTEXT_GLX_MESA_swap_control,
+	UICONTEXT_GLX_OML_swap_method,
+	UICONTEXT_GLX_OML_sync_control,
+	UICONTEXT_GLX_SGIS_multisample,
+	UICONTEXT_GLX_SGIX_fbconfig,
+	UICONTEXT_GLX_SGIX_pbuffer,
+	UICONTEXT_GLX_SGIX_visual_select_group,
+	UICONTEXT_GLX_SGI_make_current_read,
+	UICONTEXT_GLX_SGI_swap_control,
+	UICONTEXT_GLX_SGI_video_sync,
+	UICONTEXT_GLX_EXT_COUNT
+};
+// Sorted in strcmp order, for bsearch
+static const char *UIContext_glx_ext_names[UICONTEXT_GLX_EXT_COUNT]= {
+	"GLX_ARB_create_context",
+	"GLX_ARB_create_context_no_error",
+	"GLX_ARB_create_context_profile",
+	"GLX_ARB_create_context_robustness",
+	"GLX_ARB_fbconfig_float",
+	"GLX_ARB_framebuffer_sRGB",
+	"GLX_ARB_get_proc_address",
+	"GLX_ARB_multisample",
+	"GLX_EXT_buffer_age",
+	"GLX_EXT_create_context_es2_profile",
+	"GLX_EXT_framebuffer_sRGB",
+	"GLX_EXT_import_context",
+	"GLX_EXT_no_config_context",
+	"GLX_EXT_swap_control",
+	"GLX_EXT_swap_control_tear",
+	"GLX_EXT_texture_from_pixmap",
+	"GLX_EXT_visual_info",
+	"GLX_EXT_visual_rating",
+	"GLX_INTEL_swap_event",
+	"GLX_MESA_copy_sub_buffer",
+	"GLX_MESA_query_renderer",
+	"GLX_MESA_swap_control",
+	"GLX_OML_swap_method",
+	"GLX_OML_sync_control",
+	"GLX_SGIS_multisample",
+	"GLX_SGIX_fbconfig",
+	"GLX_SGIX_pbuffer",
+	"GLX_SGIX_visual_select_group",
+	"GLX_SGI_make_current_read",
+	"GLX_SGI_swap_control",
+	"GLX_SGI_video_sync",
+};
+#define UICONTEXT_GLX_EXT_WORDS ((UICONTEXT_GLX_EXT_COUNT+31)/32)
+#define UIContext_has_glx_ext(cx, ext) (((cx)->glx_ext_bits[(ext)>>5] >> ((ext)&31)) & 1)
+
+// GLX extension functions, looked up once at connect.  NULL if the extension
+// is not supported.
+typedef struct UIContext_glx_fn {
+	PFNGLXCREATECONTEXTATTRIBSARBPROC CreateContextAttribsARB;
+	PFNGLXIMPORTCONTEXTEXTPROC        ImportContextEXT;
+	PFNGLXFREECONTEXTEXTPROC          FreeContextEXT;
+	PFNGLXGETCONTEXTIDEXTPROC         GetContextIDEXT;
+	PFNGLXQUERYCONTEXTINFOEXTPROC     QueryContextInfoEXT;
+	PFNGLXCOPYSUBBUFFERMESAPROC       CopySubBufferMESA;
+} UIContext_glx_fn;
+
+static const char *UIContext_backend_names[UICONTEXT_BACKEND_COUNT]= {
+	"glx",
+	"egl",
+	"osmesa",
+	"xshm",
+};
+
+static const char *UIContext_profile_names[UICONTEXT_PROFILE_COUNT]= {
+	"",
+	"core",
+	"compat",
+};
+
+// Attributes for creating the GL context, beyond what glXCreateContext offers
+typedef struct UIContext_ctx_attrs {
+	int          major, minor; // GL version, or 0 for whatever the driver picks
+	int          profile;      // UICONTEXT_PROFILE_*
+	int          no_error;     // GL_KHR_no_error: skip validation, errors are undefined behavior
+	int          robust;       // robust buffer access, lose context on GPU reset
+} UIContext_ctx_attrs;
+
+// Framebuffer preferences for setup_glcontext.  Zero for everything gives the
+// original default: RGBA8, double buffered, no depth or stencil buffer.
+typedef struct UIContext_fb_prefs {
+	int          depth;         // minimum depth buffer bits
+	int          stencil;       // minimum stencil buffer bits
+	int          samples;       // MSAA samples; the closest available is used
+	int          srgb;          // require an sRGB-capable framebuffer
+	int          single_buffer;
+} UIContext_fb_prefs;
+
+// Names of the UICONTEXT_PRESENT_ERR_* bits, in order
+#ifndef UICONTEXT_STANDALONE
+static const char *UIContext_present_err_names[8]= {
+	"Invalid Enum",
+	"Invalid Value",
+	"Invalid Operation",
+	"Stack Overflow",
+	"Stack Underflow",
+	"Out of Memory",
+	"Invalid Framebuffer Operation",
+	"(unrecognized)",
+};
+#endif
+
+// The OSMesa backend renders into plain memory buffers, which stand in for
+// pixmaps.  These are either malloc'd, or mmap'd from a file.
+typedef struct UIContext_membuf {
+	void        *pixels;   // RGBA, 4 bytes per pixel, bottom row first
+	size_t       size;
+	int          w, h;
+	int          is_mmap;
+	// Called when the pixmap using this memory goes away, so that anything
+	// aliasing 'pixels' can be cut off before the memory is freed or reused
+	void       (*on_release)(void *arg);
+	void        *on_release_arg;
+} UIContext_membuf;
+
+// GL entry points for framebuffer objects, loaded when the context is created.
+typedef struct UIContext_fbo_fn {
+	PFNGLGENFRAMEBUFFERSPROC                     GenFramebuffers;
+	PFNGLDELETEFRAMEBUFFERSPROC                  DeleteFramebuffers;
+	PFNGLBINDFRAMEBUFFERPROC                     BindFramebuffer;
+	PFNGLCHECKFRAMEBUFFERSTATUSPROC              CheckFramebufferStatus;
+	PFNGLFRAMEBUFFERRENDERBUFFERPROC             FramebufferRenderbuffer;
+	PFNGLGETFRAMEBUFFERATTACHMENTPARAMETERIVPROC GetFramebufferAttachmentParameteriv;
+	PFNGLGENRENDERBUFFERSPROC                    GenRenderbuffers;
+	PFNGLDELETERENDERBUFFERSPROC                 DeleteRenderbuffers;
+	PFNGLBINDRENDERBUFFERPROC                    BindRenderbuffer;
+	PFNGLRENDERBUFFERSTORAGEPROC                 RenderbufferStorage;
+} UIContext_fbo_fn;
+
+// Core GL entry points used every frame, by this module and by the perl
+// functions in X11::MinimalOpenGLContext::GL.  They are looked up through the
+// backend's GetProcAddress when the context is created, so that calls reach
+// the library that owns the context (OSMesa can't be reached through libGL).
+// The fixed-function ones are NULL if the library doesn't provide them.
+typedef struct UIContext_gl_fn {
+	GLenum         (APIENTRY *GetError)(void);
+	const GLubyte* (APIENTRY *GetString)(GLenum name);
+	void (APIENTRY *GetIntegerv)(GLenum pname, GLint *params);
+	void (APIENTRY *Enable)(GLenum cap);
+	void (APIENTRY *Disable)(GLenum cap);
+	void (APIENTRY *Flush)(void);
+	void (APIENTRY *Finish)(void);
+	void (APIENTRY *Viewport)(GLint x, GLint y, GLsizei w, GLsizei h);
+	void (APIENTRY *ClearColor)(GLclampf r, GLclampf g, GLclampf b, GLclampf a);
+	void (APIENTRY *Clear)(GLbitfield mask);
+	void (APIENTRY *FrontFace)(GLenum mode);
+	void (APIENTRY *PixelStorei)(GLenum pname, GLint param);
+	void (APIENTRY *ReadPixels)(GLint x, GLint y, GLsizei w, GLsizei h, GLenum format, GLenum type, GLvoid *pixels);
+	void (APIENTRY *ReadBuffer)(GLenum mode);
+	// GL 3.0 or ARB_framebuffer_object, NULL if missing
+	void (APIENTRY *BlitFramebuffer)(GLint sx0, GLint sy0, GLint sx1, GLint sy1,
+		GLint dx0, GLint dy0, GLint dx1, GLint dy1, GLbitfield mask, GLenum filter);
+	// fixed-function
+	void (APIENTRY *MatrixMode)(GLenum mode);
+	void (APIENTRY *LoadIdentity)(void);
+	void (APIENTRY *LoadMatrixd)(const GLdouble *m);
+	void (APIENTRY *Frustum)(GLdouble l, GLdouble r, GLdouble b, GLdouble t, GLdouble n, GLdouble f);
+	void (APIENTRY *Translated)(GLdouble x, GLdouble y, GLdouble z);
+	void (APIENTRY *PixelZoom)(GLfloat x, GLfloat y);
+	void (APIENTRY *WindowPos2i)(GLint x, GLint y);
+	void (APIENTRY *CopyPixels)(GLint x, GLint y, GLsizei w, GLsizei h, GLenum type);
+} UIContext_gl_fn;
+
+// The XShm backend renders into one of two shared memory XImages while the
+// X server copies the other one to the window.
+typedef struct UIContext_shm_target {
+	Window          wnd;
+	int             w, h;
+	GC              gc;
+	XImage         *img[2];
+	XShmSegmentInfo seg[2];
+	int             pending[2]; // XShmPutImage issued, completion not received
+	int             back;       // index of the image being rendered
+	int             put_image;  // images are in client memory, sent with XPutImage
+	unsigned long   frames;     // presents since the images were created
+	unsigned long   presented[2]; // value of 'frames' when each image was last shown, or 0
+} UIContext_shm_target;
+
+// Messages from glDebugMessageCallback are queued in this ring.  The GL may
+// call back from its own threads, so slots are claimed with atomics (a
+// bounded multi-producer queue where each slot's 'seq' says whose turn it
+// is) and only the thread draining it into Log::Any ever reads it.
+#define UICONTEXT_DEBUG_RING_SIZE 256 // must be a power of 2
+typedef struct UIContext_debug_ring {
+	unsigned     head;    // next slot to claim (producers)
+	unsigned     tail;    // next slot to read (consumer)
+	unsigned     dropped; // messages lost because the ring was full
+	UIContext_debug_msg msg[UICONTEXT_DEBUG_RING_SIZE];
+} UIContext_debug_ring;
+
+// Offscreen targets given back with UIContext_release_pixmap, waiting to be
+// handed out again by a create_pixmap of the same size.  Oldest first.
+#define UICONTEXT_PIXMAP_POOL_MAX 64
+typedef struct UIContext_pixmap_pool {
+	int          limit;  // entries to keep; 0 disables the pool
+	int          count;
+	unsigned long hits, misses;
+	struct { int xid, w, h; } ent[UICONTEXT_PIXMAP_POOL_MAX];
+} UIContext_pixmap_pool;
+
+// Presents of one GLX window, to turn the GLX_EXT_buffer_age of its back
+// buffer (counted in full swaps) into the number of presents, partial ones
+// included, that the application has to repair.
+#define UICONTEXT_SWAP_HISTORY 8
+typedef struct UIContext_damage_state {
+	Window       wnd;        // the history is for this window
+	unsigned long frames;    // presents, full or partial
+	unsigned long swaps;     // full swaps
+	unsigned long swap_frame[UICONTEXT_SWAP_HISTORY]; // 'frames' at each recent swap
+	int          partial;    // the last present copied from the back buffer, which is still current
+} UIContext_damage_state;
+
+// Optional Vulkan swapchain for a window, defined in vkswapchain.c
+typedef struct UIContext_vk UIContext_vk;
+
+// Buffer for draw_vertices, defined in vertexstream.c
+typedef struct UIContext_stream UIContext_stream;
+
+struct UIContext {
+	int          backend;
 	Display     *dpy;
 	
 	// Information about the GLX subsystem, initialized during connect
 	int          glx_version_major;
 	int          glx_version_minor;
 	const char  *glx_extensions;
+	uint32_t     glx_ext_bits[UICONTEXT_GLX_EXT_WORDS];
+	UIContext_glx_fn glx;
 	
 	// GL context, initialized by setup_glcontext
+	UIContext_fb_prefs fb_prefs;
+	char        *fbconfig_cache; // file to remember the FBConfig in, or NULL
+	GLXFBConfig  fbconfig; // Chosen FBConfig, or NULL on GLX < 1.3
 	XVisualInfo *xvisi;    // Pointer to chosen X visual
+	GLXFBConfig  pixmap_fbconfig; // Single-buffered config for pixmaps, chosen on first use
+	int          pixmap_fbconfig_id; // its GLX_FBCONFIG_ID, or 0 if it is the context's config
+	int          pixmap_depth;    // X depth of pixmaps for pixmap_fbconfig
+	int          glctx_srgb; // enable GL_FRAMEBUFFER_SRGB at first make-current
 	GLXContext   glctx;    // Pointer to GL context struct
 	GLXContextID glctx_id; // The X11 ID of the GL context, sharable between processes
 	int          glctx_is_imported;
+	UIContext_ctx_attrs ctx_attrs;
+	
+	// GL debug output, enabled by set_gl_debug.  The callback is installed
+	// the first time the context is made current.
+	int          gl_debug;
+	int          gl_debug_installed;
+	UIContext_debug_ring *debug_ring;
+	
+	// EGL display and context, used instead of the above for the EGL backend.
+	// (declared as void* so this struct doesn't depend on the EGL headers)
+	void        *egl_dpy;
+	void        *egl_ctx;
+	UIContext_fbo_fn fbo;
+	
+	// Core GL functions for whichever backend owns the context
+	UIContext_gl_fn gl;
+	int          gl_can_blit; // glBlitFramebuffer is supported; -1 until the first blit
+	GLenum       gl_read_buffer; // GLX: last glReadBuffer, or the context's default
+	Window       read_buffer_xid; // GLX: drawable whose read buffer was last looked up
+	GLenum       read_buffer_mode; // ...and the result
+	
+	// Streaming vertex buffer, created by the first draw_vertices
+	UIContext_stream *stream;
+	int          stream_orphan; // don't use a persistent mapping, even if supported
+	
+	// OSMesa context and its memory buffers, for the OSMesa backend.
+	// Buffer N is referred to by the ID N+1, in place of an X11 pixmap ID.
+	void        *osmesa_ctx;
+	UIContext_membuf *membufs;
+	int          membuf_count;
+	
+	// Released pixmaps (or FBOs, or membufs) of any backend, for reuse
+	UIContext_pixmap_pool pixmap_pool;
+	
+	// Presentation state for the XShm backend (which also uses osmesa_ctx)
+	int          shm_event_base;
+	int          shm_opcode;    // major opcode of MIT-SHM, for its errors
+	int          shm_put_image; // the server can't attach our shared memory
+	UIContext_shm_target shm;
+	
+	// Vulkan presentation to one window, created by vk_setup
+	UIContext_vk *vk;
 	
 	// X Window or X Pixmap rendering target, initialized by set_gl_target
+	// (or the framebuffer object name, for the EGL backend)
 	Window       target;
-} UIContext;
+	
+	// Seconds (monotonic) spent in each startup phase, or -1 if not run yet
+	double       phase_time[UICONTEXT_PHASE_COUNT];
+	
+	// Calls to UIContext_glXMakeCurrent that switched context or target, and
+	// ones that found it already current
+	unsigned long make_current_count, make_current_skipped;
+	
+	// Buffer age bookkeeping for UIContext_swap_buffers_damage
+	UIContext_damage_state damage;
+	unsigned long present_partial_count;
+	
+	// Timing of UIContext_present
+	unsigned long present_count;
+	double       present_start;    // monotonic time when the last present began
+	double       present_interval; // seconds between the last two presents
+	double       present_duration; // seconds spent inside the last present
+	
+	// Owner of the UIContext, for routing X errors to (the perl object)
+	void        *user_data;
+};
+
+#ifdef UICONTEXT_HAVE_EGL
+// libEGL is opened on first use of the EGL backend, and shared by all UIContexts
+static struct UIContext_egl_fn {
+	void *lib;
+	PFNEGLGETPROCADDRESSPROC        GetProcAddress;
+	PFNEGLGETERRORPROC              GetError;
+	PFNEGLQUERYSTRINGPROC           QueryString;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC GetPlatformDisplayEXT;
+	PFNEGLQUERYDEVICESEXTPROC       QueryDevicesEXT;
+	PFNEGLINITIALIZEPROC            Initialize;
+	PFNEGLTERMINATEPROC             Terminate;
+	PFNEGLBINDAPIPROC               BindAPI;
+	PFNEGLCHOOSECONFIGPROC          ChooseConfig;
+	PFNEGLCREATECONTEXTPROC         CreateContext;
+	PFNEGLDESTROYCONTEXTPROC        DestroyContext;
+	PFNEGLMAKECURRENTPROC           MakeCurrent;
+	// eglGetPlatformDisplayEXT returns the same handle every time, so it can
+	// only be terminated once the last UIContext is done with it.
+	int          display_refs;
+} UIContext_egl;
+#endif
+
+// libOSMesa is also opened on first use.  The API is small enough to declare
+// here rather than depend on GL/osmesa.h
+#define UICONTEXT_OSMESA_RGBA GL_RGBA
+#define UICONTEXT_OSMESA_BGRA 0x1
+#define UICONTEXT_OSMESA_Y_UP 0x11
+typedef void* ( * PFNOSMESACREATECONTEXTEXTPROC) (GLenum format, GLint depthBits, GLint stencilBits, GLint accumBits, void *sharelist);
+typedef void  ( * PFNOSMESADESTROYCONTEXTPROC) (void *ctx);
+typedef GLboolean ( * PFNOSMESAMAKECURRENTPROC) (void *ctx, void *buffer, GLenum type, GLsizei width, GLsizei height);
+typedef void* ( * PFNOSMESAGETPROCADDRESSPROC) (const char *funcName);
+typedef void  ( * PFNOSMESAPIXELSTOREPROC) (GLint pname, GLint value);
+static struct UIContext_osmesa_fn {
+	void *lib;
+	PFNOSMESACREATECONTEXTEXTPROC CreateContextExt;
+	PFNOSMESADESTROYCONTEXTPROC   DestroyContext;
+	PFNOSMESAMAKECURRENTPROC      MakeCurrent;
+	PFNOSMESAGETPROCADDRESSPROC   GetProcAddress;
+	PFNOSMESAPIXELSTOREPROC       PixelStore;
+} UIContext_osmesa;
+
+// libXRes is opened on first use of UIContext_client_resources, and declared
+// here for the same reason.
+typedef struct { Atom resource_type; unsigned int count; } UIContext_XResType;
+typedef Bool   ( * PFNXRESQUERYEXTENSIONPROC) (Display *dpy, int *event_base, int *error_base);
+typedef Status ( * PFNXRESQUERYCLIENTRESOURCESPROC) (Display *dpy, XID xid, int *num_types, UIContext_XResType **types);
+static struct UIContext_xres_fn {
+	void *lib;
+	PFNXRESQUERYEXTENSIONPROC       QueryExtension;
+	PFNXRESQUERYCLIENTRESOURCESPROC QueryClientResources;
+} UIContext_xres;
+
+// What this thread last made current through a UIContext.  GL contexts are
+// current per thread, so this is too.  It lets UIContext_glXMakeCurrent skip
+// the call when that context and target are already current, and gives the
+// functions in X11::MinimalOpenGLContext::GL (which take no context
+// argument) the function table of the current UIContext.  Every
+// make-current in this file updates it, and every release clears it.
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+ #define UICONTEXT_THREAD_LOCAL _Thread_local
+#else
+ #define UICONTEXT_THREAD_LOCAL __thread
+#endif
+static UICONTEXT_THREAD_LOCAL struct UIContext_current_state {
+	UIContext   *cx;
+	void        *glctx;   // GLXContext, EGLContext, or OSMesa context
+	Window       target;  // drawable, FBO, or membuf ID
+	Window       read;    // drawable or FBO that is read from, usually 'target'
+	void        *buffer;  // OSMesa: the memory of the target
+	int          w, h;
+} UIContext_current;
+
+static void UIContext_set_current(UIContext *cx, void *glctx, Window target, void *buffer, int w, int h) {
+	UIContext_current.cx= cx;
+	UIContext_current.glctx= glctx;
+	UIContext_current.target= target;
+	UIContext_current.read= target;
+	UIContext_current.buffer= buffer;
+	UIContext_current.w= w;
+	UIContext_current.h= h;
+}
+
+static void UIContext_forget_current() {
+	memset(&UIContext_current, 0, sizeof(UIContext_current));
+}
+
+// Non-fatal X errors are queued here by the Xlib error handler, and delivered
+// to perl later (by show, or process_x_errors) instead of calling into perl
+// from inside Xlib.  Repeats of an error that is already queued are counted
+// rather than queued again, so an error storm from a closed window takes one
+// slot.  The handler runs in whatever thread made the Xlib call, and this
+// module only uses Xlib from one thread, so no locking.
+static struct UIContext_x_error_queue {
+	int            count;
+	unsigned       dropped;
+	UIContext_x_error err[UICONTEXT_X_ERROR_QUEUE_SIZE];
+} UIContext_x_errors;
+
+// Each UIContext function that sends X requests notes the serial number of
+// its first request here, so the error handler can name the function that
+// caused an error by serial number, without an XSync after every call.
+// A function that turned out to send nothing gets its entry reused.
+#define UICONTEXT_REQUEST_LOG_SIZE 256
+typedef struct UIContext_request_ent {
+	Display       *dpy;
+	unsigned long  serial;
+	const char    *op;
+} UIContext_request_ent;
+static struct UIContext_request_log {
+	unsigned       next;
+	UIContext_request_ent ent[UICONTEXT_REQUEST_LOG_SIZE];
+} UIContext_requests;
+#define UICONTEXT_LOG_REQUEST(cx) do { if ((cx)->dpy) UIContext_log_request((cx)->dpy, __func__); } while (0)
+
+// Map of open Display* to the UIContext that opened it, so queued errors can
+// be routed to their owner with one hash lookup however many connections
+// there are.  Open addressing with linear probing, grown at 1/2 full.
+typedef struct UIContext_dpy_map_ent {
+	Display   *dpy;
+	UIContext *cx;
+} UIContext_dpy_map_ent;
+static struct UIContext_dpy_map {
+	size_t     mask, count;
+	UIContext_dpy_map_ent *ent;
+} UIContext_dpy_map;
 
 static int UIContext_X_handler_installed= 0;
 static int UIContext_X_Fatal= 0; // global flag to prevent running more X calls during error handler
+static void (*UIContext_X_fatal_handler)(void)= NULL;
 #define CROAK_IF_XLIB_FATAL()     do { if (UIContext_X_Fatal) croak("Cannot call XLib functions after a fatal error"); } while(0)
-#define CROAK_IF_NO_DISPLAY(cx)   do { if (!cx->dpy) croak("Not connected to a display"); } while (0)
-#define CROAK_IF_NO_GLCONTEXT(cx) do { if (!cx->glctx) croak("No GL Context"); } while (0)
+#define CROAK_IF_NO_DISPLAY(cx)   do { if (cx->backend == UICONTEXT_BACKEND_GLX && !cx->dpy) croak("Not connected to a display"); } while (0)
+#define CROAK_IF_NO_X11(cx)       do { if (!cx->dpy) croak("Not supported without an X11 display"); } while (0)
+#define CROAK_IF_NO_GLCONTEXT(cx) do { if (!UIContext_has_glcontext(cx)) croak("No GL Context"); } while (0)
 #define CROAK_IF_NO_TARGET(cx)    do { if (!cx->target) croak("OpenGL context has no target"); } while (0)
 
+// Functions internal to the module; the public ones are in uicontext.h
 int UIContext_X_IO_error_handler(Display *d);
 int UIContext_X_error_handler(Display *d, XErrorEvent *e);
-
-UIContext *UIContext_new();
-void UIContext_free(UIContext *cx);
-void UIContext_connect(UIContext *cx, const char* dispName);
-void UIContext_disconnect(UIContext *cx);
-void UIContext_get_screen_metrics(UIContext *cx, int *w, int *h, int *w_mm, int *h_mm);
-
-void UIContext_setup_glcontext(UIContext *cx, int direct, GLXContextID link_to);
-void UIContext_teardown_glcontext(UIContext *cx);
-
-void UIContext_get_window_rect(UIContext *cx, Window wnd, int *x, int *y, unsigned int *width, unsigned int *height);
-void UIContext_glXSwapBuffers(UIContext *cx);
+void UIContext_log_request(Display *dpy, const char *op);
+const char *UIContext_request_op(Display *dpy, unsigned long serial);
+void UIContext_discard_x_errors(Display *dpy);
+int UIContext_take_request_errors(Display *dpy, unsigned long serial, int major);
+void UIContext_dpy_map_put(Display *dpy, UIContext *cx);
+void UIContext_dpy_map_del(Display *dpy);
+
+void UIContext_parse_glx_extensions(UIContext *cx);
+int UIContext_glx_ext_by_name(const char *name, size_t len);
+void UIContext_disconnect_egl(UIContext *cx);
+void UIContext_free_membufs(UIContext *cx);
+void UIContext_vk_teardown(UIContext *cx);
+void UIContext_stream_free(UIContext *cx);
+void UIContext_stream_frame_end(UIContext *cx);
+
+void UIContext_setup_egl_glcontext(UIContext *cx);
+void UIContext_teardown_egl_glcontext(UIContext *cx);
+void UIContext_egl_make_current(UIContext *cx);
+void UIContext_setup_osmesa_glcontext(UIContext *cx);
+void UIContext_teardown_osmesa_glcontext(UIContext *cx);
+void UIContext_init_xshm(UIContext *cx);
+void UIContext_setup_xshm_glcontext(UIContext *cx);
+void UIContext_teardown_xshm_glcontext(UIContext *cx);
+void UIContext_xshm_set_target(UIContext *cx, Window wnd);
+void UIContext_xshm_present(UIContext *cx, const int *rects, int n);
+static int UIContext_clip_rect(const int *rect, int max_w, int max_h, int *x, int *y, int *w, int *h);
+static void UIContext_damage_note_present(UIContext *cx, int full);
+Bool UIContext_wait_event(UIContext *cx, XEvent *event, Bool (*callback)(Display*, XEvent*, XPointer), XPointer callback_arg, int max_wait_msec);
+static int UIContext_has_glcontext(UIContext *cx);
+void UIContext_load_fbo_fn(UIContext *cx);
+void UIContext_load_gl_fn(UIContext *cx);
+UIContext_gl_fn *UIContext_get_current_gl();
+size_t UIContext_gl_pixel_size(GLenum format, GLenum type);
+
+static int UIContext_wants_context_attribs(UIContext *cx);
+void UIContext_install_debug_callback(UIContext *cx);
+void UIContext_remove_debug_callback(UIContext *cx);
+int UIContext_create_fbo(UIContext *cx, int w, int h);
+void UIContext_destroy_fbo(UIContext *cx, GLuint fbo);
+void UIContext_flush_pixmap_pool(UIContext *cx, int keep);
+int UIContext_create_membuf(UIContext *cx, int w, int h, const char *mmap_path);
+void UIContext_destroy_membuf(UIContext *cx, int id);
+UIContext_membuf *UIContext_get_membuf(UIContext *cx, int id);
+void UIContext_membuf_released(UIContext_membuf *mb);
+
+double UIContext_phase_done(UIContext *cx, int phase, double start);
+void UIContext_reset_phase_times(UIContext *cx, int first, int last);
 
 typedef GLXContext ( * PFNGLXIMPORTCONTEXTEXTPROC) (Display* dpy, GLXContextID contextID);
 typedef GLXContextID ( * PFNGLXGETCONTEXTIDEXTPROC) (const GLXContext context);
@@ -71,24 +603,63 @@ typedef void ( * PFNGLXFREECONTEXTEXTPROC) (Display* dpy, GLXContext context);
 
 UIContext *UIContext_new() {
 	UIContext *cx= (UIContext*) calloc(1, sizeof(UIContext));
+	UIContext_reset_phase_times(cx, 0, UICONTEXT_PHASE_COUNT-1);
 	log_trace("XS UIContext allocated");
 	return cx;
 }
 
 void UIContext_free(UIContext *cx) {
 	UIContext_disconnect(cx);
+	if (UIContext_current.cx == cx)
+		UIContext_forget_current();
+	free(cx->debug_ring);
+	free(cx->fbconfig_cache);
 	free(cx);
 	log_trace("XS UIContext freed");
 }
 
+void UIContext_set_user_data(UIContext *cx, void *data) {
+	cx->user_data= data;
+}
+
+void *UIContext_get_user_data(UIContext *cx) {
+	return cx->user_data;
+}
+
+int UIContext_get_backend(UIContext *cx) {
+	return cx->backend;
+}
+
+double UIContext_monotonic_now() {
+	struct timespec now;
+	if (0 != clock_gettime(CLOCK_MONOTONIC, &now))
+		croak("clock_gettime(CLOCK_MONOTONIC) failed");
+	return (double) now.tv_sec + now.tv_nsec * 0.000000001;
+}
+
+// Record the time elapsed since 'start' as the duration of 'phase', and
+// return the current time so that it can be the start of the next phase.
+double UIContext_phase_done(UIContext *cx, int phase, double start) {
+	double now= UIContext_monotonic_now();
+	cx->phase_time[phase]= now - start;
+	return now;
+}
+
+void UIContext_reset_phase_times(UIContext *cx, int first, int last) {
+	int i;
+	for (i= first; i <= last; i++)
+		cx->phase_time[i]= -1;
+}
+
 // Written according to http://www.mesa3d.org/MiniGLX.html
 // Also, see http://tronche.com/gui/x/xlib/
 
-void UIContext_connect(UIContext *cx, const char* dispName) {
+void UIContext_connect(UIContext *cx, const char* dispName, int software) {
 	CROAK_IF_XLIB_FATAL();
 
 	int en_debug= log_debug_enabled();
 	int en_trace= log_trace_enabled();
+	double t;
 
 	// Ensure XLib error handlers have been installed.
 	// This happens globally, but lazy-initialize in the spirit of fast startups.
@@ -100,19 +671,34 @@ void UIContext_connect(UIContext *cx, const char* dispName) {
 
 	// teardown any previous connection
 	UIContext_disconnect(cx);
+	UIContext_reset_phase_times(cx, 0, UICONTEXT_PHASE_COUNT-1);
 
 	if (en_debug)
 		log_debug("connecting to %s", dispName);
 
+	t= UIContext_monotonic_now();
 	cx->dpy= XOpenDisplay(dispName);
 	if (!cx->dpy)
 		croak("XOpenDisplay failed");
+	UIContext_dpy_map_put(cx->dpy, cx);
+	UICONTEXT_LOG_REQUEST(cx);
+	t= UIContext_phase_done(cx, UICONTEXT_PHASE_XOPENDISPLAY, t);
+
+	if (software) {
+		UIContext_init_xshm(cx);
+		return;
+	}
 
 	if (en_trace)
 		log_trace("Getting GLX version");
 
-	if (!glXQueryVersion(cx->dpy, &cx->glx_version_major, &cx->glx_version_minor))
-		croak("Display does not support GLX");
+	if (!glXQueryVersion(cx->dpy, &cx->glx_version_major, &cx->glx_version_minor)) {
+		// Rather than dying, render in software and copy the frames to the window
+		log_info("Display does not support GLX; falling back to software rendering with MIT-SHM");
+		UIContext_init_xshm(cx);
+		return;
+	}
+	t= UIContext_phase_done(cx, UICONTEXT_PHASE_GLXQUERYVERSION, t);
 	if (en_debug)
 		log_debug("GLX Version %d.%d", cx->glx_version_major, cx->glx_version_minor);
 
@@ -123,18 +709,82 @@ void UIContext_connect(UIContext *cx, const char* dispName) {
 		// TODO: find out if this needs freed.  Docs don't say, and all examples I can find
 		// hold onto the pointer for the life of the program.
 		cx->glx_extensions= glXQueryExtensionsString(cx->dpy, DefaultScreen(cx->dpy));
+		UIContext_parse_glx_extensions(cx);
+		UIContext_phase_done(cx, UICONTEXT_PHASE_GLXQUERYEXTENSIONSSTRING, t);
 		if (en_trace)
 			log_trace("GLX Extensions supported: %s", cx->glx_extensions);
 	}
 }
 
+static int UIContext_glx_ext_cmp(const void *key, const void *elem) {
+	const char *name= *(const char**) elem;
+	size_t len= strlen(name), keylen= ((const size_t*) key)[1];
+	int c= strncmp(((const char**) key)[0], name, keylen < len? keylen : len);
+	return c? c : keylen < len? -1 : keylen > len? 1 : 0;
+}
+
+// Index into UIContext_glx_ext_names of the first 'len' chars of 'name', or -1
+int UIContext_glx_ext_by_name(const char *name, size_t len) {
+	const char **found;
+	const void *key[2]= { name, (void*) len };
+	found= (const char**) bsearch(key, UIContext_glx_ext_names, UICONTEXT_GLX_EXT_COUNT,
+		sizeof(const char*), UIContext_glx_ext_cmp);
+	return found? found - UIContext_glx_ext_names : -1;
+}
+
+// Set the bit of each known extension, and look up the functions we use
+void UIContext_parse_glx_extensions(UIContext *cx) {
+	const char *p= cx->glx_extensions, *end;
+	int ext;
+	
+	memset(cx->glx_ext_bits, 0, sizeof(cx->glx_ext_bits));
+	memset(&cx->glx, 0, sizeof(cx->glx));
+	while (p && *p) {
+		while (*p == ' ') p++;
+		for (end= p; *end && *end != ' '; end++);
+		if (end > p && (ext= UIContext_glx_ext_by_name(p, end-p)) >= 0)
+			cx->glx_ext_bits[ext>>5] |= 1U << (ext&31);
+		p= end;
+	}
+	#define LOADFN(ext, name) if (UIContext_has_glx_ext(cx, UICONTEXT_##ext)) \
+		cx->glx.name= (void*) glXGetProcAddress((const GLubyte*) "glX" #name);
+	LOADFN(GLX_ARB_create_context, CreateContextAttribsARB)
+	LOADFN(GLX_EXT_import_context, ImportContextEXT)
+	LOADFN(GLX_EXT_import_context, FreeContextEXT)
+	LOADFN(GLX_EXT_import_context, GetContextIDEXT)
+	LOADFN(GLX_EXT_import_context, QueryContextInfoEXT)
+	LOADFN(GLX_MESA_copy_sub_buffer, CopySubBufferMESA)
+	#undef LOADFN
+}
+
+// Extensions in the table are a bit test; any others are looked up in the string
+int UIContext_has_glx_extension(UIContext *cx, const char *name) {
+	const char *p;
+	size_t len= strlen(name);
+	int ext= UIContext_glx_ext_by_name(name, len);
+	if (ext >= 0)
+		return UIContext_has_glx_ext(cx, ext);
+	for (p= cx->glx_extensions; p && (p= strstr(p, name)); p += len)
+		if ((p == cx->glx_extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+			return 1;
+	return 0;
+}
+
 void UIContext_disconnect(UIContext *cx) {
 	// delete all Xlib objects
 	log_trace("Freeing any graphic objects");
+	if (!UIContext_X_Fatal)
+		UIContext_vk_teardown(cx);
 	UIContext_teardown_glcontext(cx);
 	
 	cx->glx_version_major= 0;
 	cx->glx_version_minor= 0;
+	cx->glx_extensions= NULL;
+	memset(cx->glx_ext_bits, 0, sizeof(cx->glx_ext_bits));
+	memset(&cx->glx, 0, sizeof(cx->glx));
+	UIContext_disconnect_egl(cx);
+	UIContext_free_membufs(cx);
+	cx->backend= UICONTEXT_BACKEND_GLX;
 	if (cx->dpy) {
 		if (UIContext_X_Fatal) {
 			log_trace("Would free objects, but XLib is broken and we can't, so leak them");
@@ -142,6 +792,8 @@ void UIContext_disconnect(UIContext *cx) {
 			log_debug("Disconnecting from display");
 			XCloseDisplay(cx->dpy);
 		}
+		UIContext_discard_x_errors(cx->dpy);
+		UIContext_dpy_map_del(cx->dpy);
 		cx->dpy= NULL;
 	}
 }
@@ -149,6 +801,7 @@ void UIContext_disconnect(UIContext *cx) {
 int UIContext_get_xlib_socket(UIContext *cx) {
 	CROAK_IF_XLIB_FATAL();
 	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_X11(cx);
 	
 	return ConnectionNumber(cx->dpy);
 }
@@ -159,6 +812,7 @@ int UIContext_wait_xlib_socket(UIContext *cx, struct timeval tv) {
 
 	CROAK_IF_XLIB_FATAL();
 	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_X11(cx);
 
 	x11_fd= ConnectionNumber(cx->dpy);
 	FD_ZERO(&fds);
@@ -172,6 +826,15 @@ void UIContext_get_screen_metrics(UIContext *cx, int *w, int *h, int *w_mm, int
 	CROAK_IF_XLIB_FATAL();
 	CROAK_IF_NO_DISPLAY(cx);
 
+	// A headless display has no screen; report zeros, meaning "unknown"
+	if (!cx->dpy) {
+		if (w) *w= 0;
+		if (h) *h= 0;
+		if (w_mm) *w_mm= 0;
+		if (h_mm) *h_mm= 0;
+		return;
+	}
+
 	if (!(s= DefaultScreenOfDisplay(cx->dpy)))
 		croak("DefaultScreenOfDisplay failed");
 
@@ -181,207 +844,1909 @@ void UIContext_get_screen_metrics(UIContext *cx, int *w, int *h, int *w_mm, int
 	if (h_mm) *h_mm= HeightMMOfScreen(s);
 }
 
+// Ask the X server (with the X-Resource extension) how many of each type of
+// resource this connection owns, for finding leaks of server-side objects.
+// Fills up to 'max' entries and returns how many there were in total, or -1
+// if libXRes or the server extension isn't available.  This is one round
+// trip for the counts and one for the type names.
+int UIContext_client_resources(UIContext *cx, UIContext_resource_count *dest, int max) {
+	UIContext_XResType *types= NULL;
+	Atom atoms[UICONTEXT_RESOURCE_TYPES_MAX];
+	char *names[UICONTEXT_RESOURCE_TYPES_MAX];
+	int event_base, error_base, num_types= 0, i, n;
+
+	CROAK_IF_XLIB_FATAL();
+	CROAK_IF_NO_X11(cx);
+
+	if (!UIContext_xres.lib) {
+		void *lib= dlopen("libXRes.so.1", RTLD_NOW|RTLD_GLOBAL);
+		if (!lib) return -1;
+		UIContext_xres.QueryExtension= (PFNXRESQUERYEXTENSIONPROC) dlsym(lib, "XResQueryExtension");
+		UIContext_xres.QueryClientResources= (PFNXRESQUERYCLIENTRESOURCESPROC) dlsym(lib, "XResQueryClientResources");
+		if (!UIContext_xres.QueryExtension || !UIContext_xres.QueryClientResources) {
+			dlclose(lib);
+			return -1;
+		}
+		UIContext_xres.lib= lib;
+	}
+	if (!UIContext_xres.QueryExtension(cx->dpy, &event_base, &error_base))
+		return -1;
+	// The server finds the client from the high bits of the XID.  Xlib
+	// creates the default GC at connect, so its ID always belongs to us, and
+	// no XID has to be allocated just for this query.
+	UICONTEXT_LOG_REQUEST(cx);
+	if (!UIContext_xres.QueryClientResources(cx->dpy,
+		XGContextFromGC(DefaultGC(cx->dpy, DefaultScreen(cx->dpy))), &num_types, &types))
+		croak("XResQueryClientResources failed");
+	n= num_types < max? num_types : max;
+	if (n > UICONTEXT_RESOURCE_TYPES_MAX) n= UICONTEXT_RESOURCE_TYPES_MAX;
+	for (i= 0; i < n; i++)
+		atoms[i]= types[i].resource_type;
+	if (n && !XGetAtomNames(cx->dpy, atoms, n, names)) {
+		XFree(types);
+		croak("XGetAtomNames failed");
+	}
+	for (i= 0; i < n; i++) {
+		snprintf(dest[i].name, sizeof(dest[i].name), "%s", names[i]);
+		dest[i].count= types[i].count;
+		XFree(names[i]);
+	}
+	XFree(types);
+	return num_types;
+}
+
+// True if any context attribute is set which glXCreateContext can't provide
+static int UIContext_wants_context_attribs(UIContext *cx) {
+	return cx->gl_debug || cx->ctx_attrs.major || cx->ctx_attrs.profile
+		|| cx->ctx_attrs.no_error || cx->ctx_attrs.robust;
+}
+
+// Create the GLX context.  If any of cx->ctx_attrs (or gl_debug) are set this
+// uses glXCreateContextAttribsARB with the chosen FBConfig, else
+// glXCreateNewContext (or glXCreateContext before GLX 1.3).  A requested version,
+// profile, or robustness is required, but the debug flag and no-error mode
+// are only optimizations and are skipped if the server can't provide them.
+static GLXContext UIContext_glx_create_context(UIContext *cx, GLXContext share, int direct) {
+	int n= 0, flags= 0;
+	int ctx_attrs[16];
+	
+	if (!UIContext_wants_context_attribs(cx)) {
+		if (cx->fbconfig) {
+			log_trace("calling glXCreateNewContext");
+			return glXCreateNewContext(cx->dpy, cx->fbconfig, GLX_RGBA_TYPE, share, direct);
+		}
+		log_trace("calling glXCreateContext");
+		return glXCreateContext(cx->dpy, cx->xvisi, share, direct);
+	}
+	if (!cx->fbconfig || !cx->glx.CreateContextAttribsARB) {
+		if (cx->ctx_attrs.major || cx->ctx_attrs.profile || cx->ctx_attrs.robust)
+			croak("GLX_ARB_create_context is required for a specific GL version, profile, or robustness");
+		log_info("GLX_ARB_create_context not supported; creating a normal context");
+		return glXCreateContext(cx->dpy, cx->xvisi, share, direct);
+	}
+	
+	n= 0;
+	if (cx->ctx_attrs.major) {
+		ctx_attrs[n++]= GLX_CONTEXT_MAJOR_VERSION_ARB; ctx_attrs[n++]= cx->ctx_attrs.major;
+		ctx_attrs[n++]= GLX_CONTEXT_MINOR_VERSION_ARB; ctx_attrs[n++]= cx->ctx_attrs.minor;
+	}
+	if (cx->ctx_attrs.profile) {
+		if (!UIContext_has_glx_ext(cx, UICONTEXT_GLX_ARB_create_context_profile))
+			croak("GLX_ARB_create_context_profile is not supported");
+		ctx_attrs[n++]= GLX_CONTEXT_PROFILE_MASK_ARB;
+		ctx_attrs[n++]= cx->ctx_attrs.profile == UICONTEXT_PROFILE_CORE
+			? GLX_CONTEXT_CORE_PROFILE_BIT_ARB : GLX_CONTEXT_COMPATIBILITY_PROFILE_BIT_ARB;
+	}
+	if (cx->ctx_attrs.robust) {
+		if (!UIContext_has_glx_ext(cx, UICONTEXT_GLX_ARB_create_context_robustness))
+			croak("GLX_ARB_create_context_robustness is not supported");
+		flags |= GLX_CONTEXT_ROBUST_ACCESS_BIT_ARB;
+		ctx_attrs[n++]= GLX_CONTEXT_RESET_NOTIFICATION_STRATEGY_ARB;
+		ctx_attrs[n++]= GLX_LOSE_CONTEXT_ON_RESET_ARB;
+	}
+	if (cx->gl_debug)
+		flags |= GLX_CONTEXT_DEBUG_BIT_ARB;
+	if (flags) {
+		ctx_attrs[n++]= GLX_CONTEXT_FLAGS_ARB; ctx_attrs[n++]= flags;
+	}
+	if (cx->ctx_attrs.no_error) {
+		if (UIContext_has_glx_ext(cx, UICONTEXT_GLX_ARB_create_context_no_error)) {
+			ctx_attrs[n++]= GLX_CONTEXT_OPENGL_NO_ERROR_ARB; ctx_attrs[n++]= True;
+		}
+		else
+			log_info("GLX_ARB_create_context_no_error not supported; GL errors will still be checked");
+	}
+	ctx_attrs[n]= None;
+	log_trace("calling glXCreateContextAttribsARB");
+	return cx->glx.CreateContextAttribsARB(cx->dpy, cx->fbconfig, share, direct, ctx_attrs);
+}
+
+// Store the attributes for the next context created by setup_glcontext
+void UIContext_set_context_attribs(UIContext *cx, int major, int minor, int profile, int no_error, int robust) {
+	if (no_error && (robust || cx->gl_debug))
+		croak("A no-error context can't also have debug output or robustness");
+	cx->ctx_attrs.major= major;
+	cx->ctx_attrs.minor= minor;
+	cx->ctx_attrs.profile= profile;
+	cx->ctx_attrs.no_error= no_error;
+	cx->ctx_attrs.robust= robust;
+}
+
+int UIContext_profile_by_name(const char *name) {
+	int i;
+	if (!name || !*name) return UICONTEXT_PROFILE_DEFAULT;
+	for (i= 1; i < UICONTEXT_PROFILE_COUNT; i++)
+		if (strcmp(name, UIContext_profile_names[i]) == 0)
+			return i;
+	croak("Unknown GL profile '%s'", name);
+	return -1;
+}
+
+void UIContext_set_fb_prefs(UIContext *cx, int depth, int stencil, int samples, int srgb, int single_buffer) {
+	cx->fb_prefs.depth= depth;
+	cx->fb_prefs.stencil= stencil;
+	cx->fb_prefs.samples= samples;
+	cx->fb_prefs.srgb= srgb;
+	cx->fb_prefs.single_buffer= single_buffer;
+}
+
+// Lower is better.  glXChooseFBConfig already enforced the minimums, so this
+// is about not wasting memory bandwidth on bits nobody asked for, and getting
+// the nearest sample count (more is better than fewer).
+static int UIContext_score_fbconfig(UIContext *cx, GLXFBConfig config, int have_srgb_ext) {
+	UIContext_fb_prefs *want= &cx->fb_prefs;
+	int depth= 0, stencil= 0, samples= 0, srgb= 0, caveat= GLX_NONE, score= 0;
+	
+	glXGetFBConfigAttrib(cx->dpy, config, GLX_DEPTH_SIZE, &depth);
+	glXGetFBConfigAttrib(cx->dpy, config, GLX_STENCIL_SIZE, &stencil);
+	glXGetFBConfigAttrib(cx->dpy, config, GLX_SAMPLES, &samples);
+	glXGetFBConfigAttrib(cx->dpy, config, GLX_CONFIG_CAVEAT, &caveat);
+	if (have_srgb_ext)
+		glXGetFBConfigAttrib(cx->dpy, config, GLX_FRAMEBUFFER_SRGB_CAPABLE_ARB, &srgb);
+	
+	if (caveat == GLX_SLOW_CONFIG) score += 100000;
+	if (samples < want->samples) score += 1000 * (want->samples - samples);
+	else                         score += 10 * (samples - want->samples);
+	score += (depth - want->depth) + 2 * (stencil - want->stencil);
+	if (srgb && !want->srgb) score += 1;
+	return score;
+}
+
+// Enumerate the FBConfigs that meet cx->fb_prefs and return the best one
+static GLXFBConfig UIContext_glx_enumerate_fbconfig(UIContext *cx) {
+	GLXFBConfig *configs, config;
+	int have_srgb_ext= UIContext_has_glx_ext(cx, UICONTEXT_GLX_ARB_framebuffer_sRGB)
+		|| UIContext_has_glx_ext(cx, UICONTEXT_GLX_EXT_framebuffer_sRGB);
+	int i, n= 0, score, best= -1, best_score= 0;
+	int attrs[32], a= 0;
+	
+	attrs[a++]= GLX_X_RENDERABLE;  attrs[a++]= True;
+	// Double-buffered configs often can't render to pixmaps (NVIDIA has none
+	// that do), so pixmaps get their own config; see UIContext_glx_pixmap_fbconfig
+	attrs[a++]= GLX_DRAWABLE_TYPE; attrs[a++]= GLX_WINDOW_BIT;
+	attrs[a++]= GLX_RENDER_TYPE;   attrs[a++]= GLX_RGBA_BIT;
+	attrs[a++]= GLX_RED_SIZE;      attrs[a++]= 8;
+	attrs[a++]= GLX_GREEN_SIZE;    attrs[a++]= 8;
+	attrs[a++]= GLX_BLUE_SIZE;     attrs[a++]= 8;
+	attrs[a++]= GLX_ALPHA_SIZE;    attrs[a++]= 8;
+	attrs[a++]= GLX_DOUBLEBUFFER;  attrs[a++]= cx->fb_prefs.single_buffer? False : True;
+	attrs[a++]= GLX_DEPTH_SIZE;    attrs[a++]= cx->fb_prefs.depth;
+	attrs[a++]= GLX_STENCIL_SIZE;  attrs[a++]= cx->fb_prefs.stencil;
+	if (cx->fb_prefs.srgb) {
+		if (!have_srgb_ext)
+			croak("sRGB framebuffer requested, but GLX_ARB_framebuffer_sRGB is not supported");
+		attrs[a++]= GLX_FRAMEBUFFER_SRGB_CAPABLE_ARB; attrs[a++]= True;
+	}
+	attrs[a]= None;
+	
+	configs= glXChooseFBConfig(cx->dpy, DefaultScreen(cx->dpy), attrs, &n);
+	if (!configs || !n)
+		croak("No FBConfig matches the requested depth/stencil/sRGB/double-buffer settings");
+	for (i= 0; i < n; i++) {
+		score= UIContext_score_fbconfig(cx, configs[i], have_srgb_ext);
+		if (best < 0 || score < best_score) {
+			best= i;
+			best_score= score;
+		}
+	}
+	config= configs[best];
+	XFree(configs);
+	return config;
+}
+
+/*
+
+FBConfig cache.  Enumerating and scoring FBConfigs can take tens of
+milliseconds on some servers, so the chosen GLX_FBCONFIG_ID can be saved in
+a file, one line per display and set of preferences:
+
+  <key> TAB <fbconfig id in hex> NEWLINE
+
+On the next run, glXChooseFBConfig with only GLX_FBCONFIG_ID returns that
+one config directly if it still exists.  The key starts with the host name
+and the client GLX library, since a home directory shared over NFS sees the
+same ":0" on every machine.
+
+*/
+
+#define UICONTEXT_FBCONFIG_CACHE_CHUNK 4096
+
+static void UIContext_fbconfig_cache_key(UIContext *cx, char *buf, size_t len) {
+	const char *glx_vendor= glXQueryServerString(cx->dpy, DefaultScreen(cx->dpy), GLX_VENDOR);
+	const char *client_vendor= glXGetClientString(cx->dpy, GLX_VENDOR);
+	const char *client_version= glXGetClientString(cx->dpy, GLX_VERSION);
+	char host[256], *p;
+	if (gethostname(host, sizeof(host)) != 0)
+		host[0]= '\0';
+	host[sizeof(host)-1]= '\0';
+	snprintf(buf, len, "%s|%s %s|%s|%s %d|%s|GLX %d.%d|depth %d stencil %d samples %d srgb %d single %d",
+		host, client_vendor? client_vendor : "", client_version? client_version : "",
+		DisplayString(cx->dpy), ServerVendor(cx->dpy), VendorRelease(cx->dpy),
+		glx_vendor? glx_vendor : "",
+		cx->glx_version_major, cx->glx_version_minor,
+		cx->fb_prefs.depth, cx->fb_prefs.stencil, cx->fb_prefs.samples,
+		cx->fb_prefs.srgb, cx->fb_prefs.single_buffer);
+	for (p= buf; *p; p++)
+		if (*p == '\t' || *p == '\n') *p= ' ';
+}
+
+// Returns the whole file as a NUL-terminated malloc'd string, or NULL
+static char * UIContext_fbconfig_cache_read(const char *path) {
+	char *buf= NULL, *bigger;
+	size_t len= 0, size= UICONTEXT_FBCONFIG_CACHE_CHUNK;
+	ssize_t got= 0;
+	int fd= open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	// Grow until EOF, so that no other entries get lost when the file is rewritten
+	while ((bigger= (char*) realloc(buf, size+1))) {
+		buf= bigger;
+		while (len < size && (got= read(fd, buf+len, size-len)) > 0)
+			len += (size_t) got;
+		if (len < size) break;
+		size *= 2;
+	}
+	close(fd);
+	if (!bigger || got < 0) {
+		log_debug("Can't read FBConfig cache %s: %s", path, bigger? strerror(errno) : "out of memory");
+		free(buf);
+		return NULL;
+	}
+	buf[len]= '\0';
+	return buf;
+}
+
+static int UIContext_fbconfig_cache_lookup(UIContext *cx, const char *key) {
+	char *content, *line;
+	size_t keylen= strlen(key);
+	int id= 0;
+	if (!(content= UIContext_fbconfig_cache_read(cx->fbconfig_cache)))
+		return 0;
+	for (line= content; line && *line; line= strchr(line, '\n'), line= line? line+1 : NULL) {
+		if (strncmp(line, key, keylen) == 0 && line[keylen] == '\t') {
+			id= (int) strtol(line+keylen+1, NULL, 16);
+			break;
+		}
+	}
+	free(content);
+	return id;
+}
+
+// Replace the line for 'key', keeping the others.  Written to a temp file and
+// renamed so that viewers starting at the same time never see a partial file.
+static void UIContext_fbconfig_cache_store(UIContext *cx, const char *key, int id) {
+	char *content, *line, *eol, *tmp_path, entry[64];
+	size_t keylen= strlen(key);
+	int fd, ok= 1;
+	
+	if (!(tmp_path= (char*) malloc(strlen(cx->fbconfig_cache) + 32))) {
+		log_info("Can't write FBConfig cache %s: out of memory", cx->fbconfig_cache);
+		return;
+	}
+	sprintf(tmp_path, "%s.%ld.tmp", cx->fbconfig_cache, (long) getpid());
+	if ((fd= open(tmp_path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+		log_debug("Can't write FBConfig cache %s: %s", tmp_path, strerror(errno));
+		free(tmp_path);
+		return;
+	}
+	if ((content= UIContext_fbconfig_cache_read(cx->fbconfig_cache))) {
+		for (line= content; ok && *line; line= eol) {
+			eol= strchr(line, '\n');
+			eol= eol? eol+1 : line + strlen(line);
+			if (!(strncmp(line, key, keylen) == 0 && line[keylen] == '\t'))
+				ok= write(fd, line, eol-line) == (ssize_t)(eol-line);
+		}
+		free(content);
+	}
+	snprintf(entry, sizeof(entry), "\t%X\n", id);
+	ok= ok && write(fd, key, keylen) == (ssize_t) keylen
+		&& write(fd, entry, strlen(entry)) == (ssize_t) strlen(entry);
+	if (close(fd) != 0) ok= 0;
+	if (!ok || rename(tmp_path, cx->fbconfig_cache) != 0) {
+		log_debug("Can't write FBConfig cache %s: %s", cx->fbconfig_cache, strerror(errno));
+		unlink(tmp_path);
+	}
+	free(tmp_path);
+}
+
+void UIContext_set_fbconfig_cache(UIContext *cx, const char *path) {
+	free(cx->fbconfig_cache);
+	cx->fbconfig_cache= path && *path? strdup(path) : NULL;
+}
+
+static GLXFBConfig UIContext_glx_pixmap_fbconfig(UIContext *cx);
+
+// An attribute of the FBConfig chosen for windows (or for pixmaps), to check
+// what the preferences got
+int UIContext_get_fbconfig_attrib(UIContext *cx, int for_pixmaps, int attr) {
+	int value= 0;
+	if (!cx->fbconfig)
+		croak("No FBConfig chosen");
+	glXGetFBConfigAttrib(cx->dpy, for_pixmaps? UIContext_glx_pixmap_fbconfig(cx) : cx->fbconfig, attr, &value);
+	return value;
+}
+
+// Pick the FBConfig that best matches cx->fb_prefs, and its visual
+static void UIContext_glx_choose_fbconfig(UIContext *cx) {
+	GLXFBConfig *configs;
+	char key[1024];
+	int n= 0, fbconfig_id= 0;
+	int id_attrs[]= { GLX_FBCONFIG_ID, 0, None };
+	
+	cx->fbconfig= NULL;
+	if (cx->fbconfig_cache) {
+		UIContext_fbconfig_cache_key(cx, key, sizeof(key));
+		if ((id_attrs[1]= UIContext_fbconfig_cache_lookup(cx, key))) {
+			configs= glXChooseFBConfig(cx->dpy, DefaultScreen(cx->dpy), id_attrs, &n);
+			if (configs && n == 1)
+				cx->fbconfig= configs[0];
+			else
+				log_debug("Cached FBConfig 0x%.2X is not valid anymore", id_attrs[1]);
+			if (configs) XFree(configs);
+		}
+	}
+	if (!cx->fbconfig) {
+		cx->fbconfig= UIContext_glx_enumerate_fbconfig(cx);
+		if (cx->fbconfig_cache
+			&& Success == glXGetFBConfigAttrib(cx->dpy, cx->fbconfig, GLX_FBCONFIG_ID, &fbconfig_id))
+			UIContext_fbconfig_cache_store(cx, key, fbconfig_id);
+	}
+	cx->xvisi= glXGetVisualFromFBConfig(cx->dpy, cx->fbconfig);
+	if (!cx->xvisi)
+		croak("glXGetVisualFromFBConfig failed");
+	cx->glctx_srgb= cx->fb_prefs.srgb;
+	if (log_debug_enabled()) {
+		glXGetFBConfigAttrib(cx->dpy, cx->fbconfig, GLX_FBCONFIG_ID, &fbconfig_id);
+		log_debug("Selected FBConfig 0x%.2X%s, Visual 0x%.2X", fbconfig_id,
+			id_attrs[1] == fbconfig_id? " (cached)" : "", (int) cx->xvisi->visualid);
+	}
+}
+
 void UIContext_setup_glcontext(UIContext *cx, int direct, GLXContextID link_to) {
-	PFNGLXIMPORTCONTEXTEXTPROC    import_context_fn;
-	PFNGLXGETCONTEXTIDEXTPROC     get_context_id_fn;
-	PFNGLXQUERYCONTEXTINFOEXTPROC query_context_info_fn;
-	PFNGLXFREECONTEXTEXTPROC      free_context_fn;
 	int visual_id;
 	GLXContext remote_context;
+	double t;
 	
 	CROAK_IF_XLIB_FATAL();
 	CROAK_IF_NO_DISPLAY(cx);
 
 	UIContext_teardown_glcontext(cx);
+	UICONTEXT_LOG_REQUEST(cx);
+	if (cx->backend == UICONTEXT_BACKEND_EGL) {
+		if (link_to)
+			croak("Shared GL contexts are not supported by the EGL backend");
+		UIContext_setup_egl_glcontext(cx);
+		return;
+	}
+	if (cx->backend == UICONTEXT_BACKEND_OSMESA || cx->backend == UICONTEXT_BACKEND_XSHM) {
+		if (link_to)
+			croak("Shared GL contexts are not supported by software rendering");
+		if (cx->backend == UICONTEXT_BACKEND_XSHM)
+			UIContext_setup_xshm_glcontext(cx);
+		else
+			UIContext_setup_osmesa_glcontext(cx);
+		return;
+	}
+
+	UIContext_reset_phase_times(cx, UICONTEXT_PHASE_GLXCHOOSEVISUAL, UICONTEXT_PHASE_GLXCREATECONTEXT);
 
 	int en_debug= log_debug_enabled();
 	int en_trace= log_trace_enabled();
 
-	if (en_trace)
-		log_trace("calling glXChooseVisual");
-	int attrs[]= { GLX_USE_GL, GLX_RGBA,
-		GLX_RED_SIZE, 8, GLX_GREEN_SIZE, 8, GLX_BLUE_SIZE, 8, GLX_ALPHA_SIZE, 8,
-		GLX_DOUBLEBUFFER, None
-	};
-	cx->xvisi= glXChooseVisual(cx->dpy, DefaultScreen(cx->dpy), attrs);
-	if (!cx->xvisi)
-		croak("glXChooseVisual failed");
-	if (en_debug)
-		log_debug("Selected Visual 0x%.2X", (int) cx->xvisi->visualid);
+	t= UIContext_monotonic_now();
+	if (cx->glx_version_major > 1 || cx->glx_version_minor >= 3) {
+		UIContext_glx_choose_fbconfig(cx);
+	}
+	else {
+		// Pre-1.3 servers have no FBConfigs; get as close as glXChooseVisual can
+		int attrs[]= { GLX_USE_GL, GLX_RGBA,
+			GLX_RED_SIZE, 8, GLX_GREEN_SIZE, 8, GLX_BLUE_SIZE, 8, GLX_ALPHA_SIZE, 8,
+			GLX_DEPTH_SIZE, cx->fb_prefs.depth, GLX_STENCIL_SIZE, cx->fb_prefs.stencil,
+			cx->fb_prefs.single_buffer? None : GLX_DOUBLEBUFFER, None
+		};
+		if (en_trace)
+			log_trace("calling glXChooseVisual");
+		cx->xvisi= glXChooseVisual(cx->dpy, DefaultScreen(cx->dpy), attrs);
+		if (!cx->xvisi)
+			croak("glXChooseVisual failed");
+		if (en_debug)
+			log_debug("Selected Visual 0x%.2X", (int) cx->xvisi->visualid);
+	}
+	t= UIContext_phase_done(cx, UICONTEXT_PHASE_GLXCHOOSEVISUAL, t);
 
 	// Either create a new context, or connect to an indirect one
 	if (link_to) {
-		import_context_fn= (PFNGLXIMPORTCONTEXTEXTPROC) glXGetProcAddress("glXImportContextEXT");
-		free_context_fn=   (PFNGLXFREECONTEXTEXTPROC)   glXGetProcAddress("glXFreeContextEXT");
-		//query_context_info_fn= (PFNGLXQUERYCONTEXTINFOEXTPROC) glXGetProcAddress("glXQueryContextInfoEXT");
-		if (!import_context_fn || !free_context_fn)
+		if (!cx->glx.ImportContextEXT || !cx->glx.FreeContextEXT)
 			croak("Can't connect to shared GL context; extension not supported by this X server.");
 
 		if (en_trace)
 			log_trace("calling glXImportContextEXT");
-		remote_context= import_context_fn(cx->dpy, link_to);
+		remote_context= cx->glx.ImportContextEXT(cx->dpy, link_to);
 		if (!remote_context)
 			croak("Can't import remote GL context %d", link_to);
 		
 		// Get the visual ID used by the existing context
-		//if (Success != query_context_info_fn(cx->dpy, cx->glctx, GLX_VISUAL_ID_EXT, &visual_id)) {
-		//	free_context_fn(remote_context);
+		//if (Success != cx->glx.QueryContextInfoEXT(cx->dpy, cx->glctx, GLX_VISUAL_ID_EXT, &visual_id)) {
+		//	cx->glx.FreeContextEXT(cx->dpy, remote_context);
 		//	croak("Can't retrieve visual ID of existing GL context");
 		//}
 		//// Was going to look up the VisualInfo for this ID, but don't see a way to do that.
 		//// Instead, just make sure it is the same one as we created above.
 		//if (visual_id != cx->xvisi->visualid) {
-		//	free_context_fn(remote_context);
+		//	cx->glx.FreeContextEXT(cx->dpy, remote_context);
 		//	croak("Visual of shared GL context does not match the one returned by glXChooseVisual");
 		//}
-		cx->glctx= glXCreateContext(cx->dpy, cx->xvisi, remote_context, direct);
-		free_context_fn(cx->dpy, remote_context);
+		cx->glctx= UIContext_glx_create_context(cx, remote_context, direct);
+		cx->glx.FreeContextEXT(cx->dpy, remote_context);
 	}
 	else {
-		if (en_trace)
-			log_trace("calling glXCreateContext");
-		cx->glctx= glXCreateContext(cx->dpy, cx->xvisi, NULL, direct);
+		cx->glctx= UIContext_glx_create_context(cx, NULL, direct);
 	}
 	if (!cx->glctx)
 		croak("glXCreateContext failed");
+	UIContext_phase_done(cx, UICONTEXT_PHASE_GLXCREATECONTEXT, t);
 
-	get_context_id_fn= (PFNGLXGETCONTEXTIDEXTPROC) glXGetProcAddress("glXGetContextIDEXT");
-	cx->glctx_id= get_context_id_fn? get_context_id_fn(cx->glctx) : 0;
+	cx->glctx_id= cx->glx.GetContextIDEXT? cx->glx.GetContextIDEXT(cx->glctx) : 0;
+	UIContext_load_gl_fn(cx);
 }
 
-void UIContext_teardown_glcontext(UIContext *cx) {
-	PFNGLXFREECONTEXTEXTPROC free_context_fn;
-	
-	if (cx->target) {
-		glXMakeCurrent(cx->dpy, None, NULL);
-		cx->target= None;
-	}
-	
-	if (!UIContext_X_Fatal && cx->glctx) {
-		if (cx->glctx_is_imported) {
-			if (!(free_context_fn= (PFNGLXFREECONTEXTEXTPROC) glXGetProcAddress("glXFreeContextEXT")))
-				croak("Can't load glXFreeContextEXT"); // should never happen if we were able to import it
-			free_context_fn(cx->dpy, cx->glctx);
-		}
-		else
-			glXDestroyContext(cx->dpy, cx->glctx);
-	}
-	cx->glctx= NULL;
-	cx->glctx_id= 0;
-	cx->glctx_is_imported= 0;
-	
-	if (!UIContext_X_Fatal && cx->xvisi) XFree(cx->xvisi);
-	cx->xvisi= NULL;
-}
+/*
 
+EGL backend.  This renders without any X server at all, using the
+surfaceless platform (or else the first EGL device) and framebuffer
+objects in place of GLX pixmaps.  The context is made current as soon as
+it is created, and "targets" are just framebuffer bindings.
 
-Bool UIContext_wait_event(
-	UIContext *cx,
-	XEvent *event,
-	Bool (*callback)(Display*, XEvent*, XPointer),
-	XPointer callback_arg,
-	int max_wait_msec
-) {
-	struct timespec start_time, now;
-	start_time.tv_sec= 0;
-	start_time.tv_nsec= 0;
-	struct timeval tv;
+*/
 
-	while (!XCheckIfEvent(cx->dpy, event, callback, callback_arg)) {
-		if (0 != clock_gettime(CLOCK_MONOTONIC, &now))
-			croak("clock_gettime(CLOCK_MONOTONIC) failed");
-		if (!start_time.tv_sec && !start_time.tv_nsec) {
-			start_time.tv_sec=  now.tv_sec;
-			start_time.tv_nsec= now.tv_nsec;
-		}
-		tv.tv_sec  =  (max_wait_msec / 1000)  - (now.tv_sec  - start_time.tv_sec);
-		tv.tv_usec = ((max_wait_msec % 1000)*1000000 - (now.tv_nsec - start_time.tv_nsec));
-		if (tv.tv_usec < 0) { tv.tv_usec += 1000000000; tv.tv_sec--; }
-		if (tv.tv_sec  < 0) return 0;  // timeout
-		
-		if (UIContext_wait_xlib_socket(cx, tv) <= 0)
-			return 0; // timeout, interrupted by signal, or other error
+#ifdef UICONTEXT_HAVE_EGL
+static void UIContext_load_egl() {
+	void *lib;
+	if (UIContext_egl.lib) return;
+	if (!(lib= dlopen("libEGL.so.1", RTLD_NOW|RTLD_GLOBAL)))
+		croak("Can't load libEGL.so.1: %s", dlerror());
+	if (!(UIContext_egl.GetProcAddress= (PFNEGLGETPROCADDRESSPROC) dlsym(lib, "eglGetProcAddress"))) {
+		dlclose(lib);
+		croak("libEGL does not export eglGetProcAddress");
 	}
-	return 1;
+	#define LOADFN(name) if (!(UIContext_egl.name= (void*) UIContext_egl.GetProcAddress("egl" #name))) goto missing;
+	LOADFN(GetError)
+	LOADFN(QueryString)
+	LOADFN(Initialize)
+	LOADFN(Terminate)
+	LOADFN(BindAPI)
+	LOADFN(ChooseConfig)
+	LOADFN(CreateContext)
+	LOADFN(DestroyContext)
+	LOADFN(MakeCurrent)
+	#undef LOADFN
+	// These two are extensions, and checked at connect
+	UIContext_egl.GetPlatformDisplayEXT= (PFNEGLGETPLATFORMDISPLAYEXTPROC) UIContext_egl.GetProcAddress("eglGetPlatformDisplayEXT");
+	UIContext_egl.QueryDevicesEXT= (PFNEGLQUERYDEVICESEXTPROC) UIContext_egl.GetProcAddress("eglQueryDevicesEXT");
+	UIContext_egl.lib= lib;
+	return;
+	missing:
+	dlclose(lib);
+	croak("libEGL is missing core functions");
 }
+#endif
 
-void UIContext_glXMakeCurrent(UIContext *cx, int xid) {
-	CROAK_IF_XLIB_FATAL();
-	CROAK_IF_NO_DISPLAY(cx);
-	CROAK_IF_NO_GLCONTEXT(cx);
+void UIContext_connect_egl(UIContext *cx) {
+	#ifdef UICONTEXT_HAVE_EGL
+	const char *client_ext;
+	EGLDisplay dpy= EGL_NO_DISPLAY;
+	EGLDeviceEXT device;
+	EGLint num_devices= 0, major, minor;
+	double t;
 
-	if (!glXMakeCurrent(cx->dpy, xid, cx->glctx))
-		croak("glXMakeCurrent failed");
-	cx->target= xid;
+	UIContext_disconnect(cx);
+	UIContext_reset_phase_times(cx, 0, UICONTEXT_PHASE_COUNT-1);
+	UIContext_load_egl();
+
+	t= UIContext_monotonic_now();
+	client_ext= UIContext_egl.QueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (!client_ext || !UIContext_egl.GetPlatformDisplayEXT)
+		croak("EGL does not support eglGetPlatformDisplayEXT");
+	if (strstr(client_ext, "EGL_MESA_platform_surfaceless")) {
+		log_debug("Using EGL surfaceless platform");
+		dpy= UIContext_egl.GetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if (dpy == EGL_NO_DISPLAY && strstr(client_ext, "EGL_EXT_platform_device")
+		&& UIContext_egl.QueryDevicesEXT
+		&& UIContext_egl.QueryDevicesEXT(1, &device, &num_devices) && num_devices > 0
+	) {
+		log_debug("Using EGL device platform");
+		dpy= UIContext_egl.GetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, device, NULL);
+	}
+	if (dpy == EGL_NO_DISPLAY)
+		croak("No headless EGL platform available");
+	if (!UIContext_egl.Initialize(dpy, &major, &minor))
+		croak("eglInitialize failed (0x%X)", (int) UIContext_egl.GetError());
+	UIContext_egl.display_refs++;
+	cx->egl_dpy= dpy;
+	cx->backend= UICONTEXT_BACKEND_EGL;
+	UIContext_phase_done(cx, UICONTEXT_PHASE_XOPENDISPLAY, t);
+	log_debug("EGL Version %d.%d", (int) major, (int) minor);
+	#else
+	croak("Compiled without EGL support");
+	#endif
 }
 
-int UIContext_create_pixmap(UIContext *cx, int w, int h) {
-	int xid, gl_xid;
+void UIContext_disconnect_egl(UIContext *cx) {
+	#ifdef UICONTEXT_HAVE_EGL
+	if (cx->egl_dpy) {
+		if (--UIContext_egl.display_refs == 0)
+			UIContext_egl.Terminate(cx->egl_dpy);
+		cx->egl_dpy= NULL;
+	}
+	#endif
+}
 
-	CROAK_IF_XLIB_FATAL();
-	CROAK_IF_NO_DISPLAY(cx);
-	CROAK_IF_NO_GLCONTEXT(cx);
+void UIContext_setup_egl_glcontext(UIContext *cx) {
+	#ifdef UICONTEXT_HAVE_EGL
+	EGLConfig config;
+	EGLint num_config= 0;
+	double t;
+	EGLint attrs[]= {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+		EGL_NONE
+	};
+	EGLint ctx_attrs[16];
+	EGLint n= 0, flags= 0;
+	const char *ext;
+
+	UIContext_teardown_egl_glcontext(cx);
+	UIContext_reset_phase_times(cx, UICONTEXT_PHASE_GLXCHOOSEVISUAL, UICONTEXT_PHASE_GLXCREATECONTEXT);
+
+	if (!UIContext_egl.BindAPI(EGL_OPENGL_API))
+		croak("eglBindAPI(EGL_OPENGL_API) failed");
+	t= UIContext_monotonic_now();
+	if (!UIContext_egl.ChooseConfig(cx->egl_dpy, attrs, &config, 1, &num_config) || num_config < 1)
+		croak("eglChooseConfig failed");
+	t= UIContext_phase_done(cx, UICONTEXT_PHASE_GLXCHOOSEVISUAL, t);
+	// Same rules as UIContext_glx_create_context
+	if (UIContext_wants_context_attribs(cx)) {
+		ext= UIContext_egl.QueryString(cx->egl_dpy, EGL_EXTENSIONS);
+		if (!ext || !strstr(ext, "EGL_KHR_create_context")) {
+			if (cx->ctx_attrs.major || cx->ctx_attrs.profile || cx->ctx_attrs.robust)
+				croak("EGL_KHR_create_context is required for a specific GL version, profile, or robustness");
+			log_info("EGL_KHR_create_context not supported; creating a normal context");
+		}
+		else {
+			if (cx->ctx_attrs.major) {
+				ctx_attrs[n++]= EGL_CONTEXT_MAJOR_VERSION_KHR; ctx_attrs[n++]= cx->ctx_attrs.major;
+				ctx_attrs[n++]= EGL_CONTEXT_MINOR_VERSION_KHR; ctx_attrs[n++]= cx->ctx_attrs.minor;
+			}
+			if (cx->ctx_attrs.profile) {
+				ctx_attrs[n++]= EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR;
+				ctx_attrs[n++]= cx->ctx_attrs.profile == UICONTEXT_PROFILE_CORE
+					? EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR : EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT_KHR;
+			}
+			if (cx->ctx_attrs.robust) {
+				flags |= EGL_CONTEXT_OPENGL_ROBUST_ACCESS_BIT_KHR;
+				ctx_attrs[n++]= EGL_CONTEXT_OPENGL_RESET_NOTIFICATION_STRATEGY_KHR;
+				ctx_attrs[n++]= EGL_LOSE_CONTEXT_ON_RESET_KHR;
+			}
+			if (cx->gl_debug)
+				flags |= EGL_CONTEXT_OPENGL_DEBUG_BIT_KHR;
+			if (flags) {
+				ctx_attrs[n++]= EGL_CONTEXT_FLAGS_KHR; ctx_attrs[n++]= flags;
+			}
+			if (cx->ctx_attrs.no_error) {
+				if (strstr(ext, "EGL_KHR_create_context_no_error")) {
+					ctx_attrs[n++]= EGL_CONTEXT_OPENGL_NO_ERROR_KHR; ctx_attrs[n++]= EGL_TRUE;
+				}
+				else
+					log_info("EGL_KHR_create_context_no_error not supported; GL errors will still be checked");
+			}
+		}
+	}
+	ctx_attrs[n]= EGL_NONE;
+	cx->egl_ctx= UIContext_egl.CreateContext(cx->egl_dpy, config, EGL_NO_CONTEXT, ctx_attrs);
+	if (!cx->egl_ctx)
+		croak("eglCreateContext failed (0x%X)", (int) UIContext_egl.GetError());
+	// Requires EGL_KHR_surfaceless_context, which all the headless platforms have
+	if (!UIContext_egl.MakeCurrent(cx->egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, cx->egl_ctx)) {
+		UIContext_egl.DestroyContext(cx->egl_dpy, cx->egl_ctx);
+		cx->egl_ctx= NULL;
+		UIContext_forget_current();
+		croak("eglMakeCurrent failed (0x%X)", (int) UIContext_egl.GetError());
+	}
+	UIContext_set_current(cx, cx->egl_ctx, None, NULL, 0, 0);
+	UIContext_phase_done(cx, UICONTEXT_PHASE_GLXCREATECONTEXT, t);
+	UIContext_load_gl_fn(cx);
+	UIContext_load_fbo_fn(cx);
+	#else
+	croak("Compiled without EGL support");
+	#endif
+}
 
-	xid= XCreatePixmap(cx->dpy, DefaultRootWindow(cx->dpy),
-		w, h, cx->xvisi->depth);
-	if (!xid)
-		croak("XCreatePixmap failed");
-	gl_xid= glXCreateGLXPixmap(cx->dpy, cx->xvisi, xid);
-	XFreePixmap(cx->dpy, xid); // gl pixmap should hold its own reference?
-	if (!gl_xid)
-		croak("glXCreateGLXPixmap failed");
-	
-	return gl_xid;
+// Each UIContext has its own EGL context, but only one can be current.  The
+// target is just a framebuffer binding within the context, so switching
+// targets of the same UIContext never needs eglMakeCurrent.
+void UIContext_egl_make_current(UIContext *cx) {
+	#ifdef UICONTEXT_HAVE_EGL
+	if (UIContext_current.glctx == cx->egl_ctx)
+		return;
+	if (!UIContext_egl.MakeCurrent(cx->egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, cx->egl_ctx)) {
+		UIContext_forget_current();
+		croak("eglMakeCurrent failed (0x%X)", (int) UIContext_egl.GetError());
+	}
+	UIContext_set_current(cx, cx->egl_ctx, cx->target, NULL, 0, 0);
+	#endif
 }
 
-void UIContext_destroy_pixmap(UIContext *cx, Pixmap xid) {
-	CROAK_IF_XLIB_FATAL();
-	CROAK_IF_NO_DISPLAY(cx);
+// Framebuffer objects are created and destroyed with their context current.
+// Afterward, make the UIContext that was current before current again, so a
+// pixmap of one context doesn't change where the caller's rendering goes.
+static void UIContext_egl_restore_current(UIContext *prev, UIContext *cx) {
+	if (prev && prev != cx && prev->backend == UICONTEXT_BACKEND_EGL && prev->egl_ctx)
+		UIContext_egl_make_current(prev);
+}
 
-	glXDestroyGLXPixmap(cx->dpy, xid);
+void UIContext_teardown_egl_glcontext(UIContext *cx) {
+	#ifdef UICONTEXT_HAVE_EGL
+	cx->target= None;
+	if (cx->egl_ctx) {
+		// Another UIContext's context can stay current
+		if (UIContext_current.glctx == cx->egl_ctx) {
+			UIContext_egl.MakeCurrent(cx->egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			UIContext_forget_current();
+		}
+		UIContext_egl.DestroyContext(cx->egl_dpy, cx->egl_ctx);
+		cx->egl_ctx= NULL;
+	}
+	memset(&cx->fbo, 0, sizeof(cx->fbo));
+	#endif
 }
 
-Window UIContext_create_window(UIContext *cx, int x, int y, int w, int h) {
-	int en_debug, en_trace;
-	Window wnd;
-	XSetWindowAttributes wndAttrs;
-	Colormap cmap;
-	Screen *s;
+/*
 
-	CROAK_IF_XLIB_FATAL();
-	CROAK_IF_NO_DISPLAY(cx);
+OSMesa backend.  Mesa renders in-process into memory that this module
+owns, so the pixels of a "pixmap" are readable as soon as rendering
+finishes, with no X server and no glReadPixels.
 
-	en_debug= log_debug_enabled();
-	en_trace= log_trace_enabled();
+*/
 
-	if (en_trace)
-		log_trace("calling XCreateColormap");
-	cmap= XCreateColormap(cx->dpy, DefaultRootWindow(cx->dpy), cx->xvisi->visual, AllocNone);
-	if (!cmap)
-		croak("XCreateColormap failed");
+// Returns NULL on success, else a message saying why libOSMesa can't be used
+static const char * UIContext_load_osmesa() {
+	void *lib;
+	if (UIContext_osmesa.lib) return NULL;
+	if (!(lib= dlopen("libOSMesa.so.8", RTLD_NOW|RTLD_GLOBAL))
+		&& !(lib= dlopen("libOSMesa.so", RTLD_NOW|RTLD_GLOBAL)))
+		return "Can't load libOSMesa";
+	#define LOADFN(name) if (!(UIContext_osmesa.name= (void*) dlsym(lib, "OSMesa" #name))) goto missing;
+	LOADFN(CreateContextExt)
+	LOADFN(DestroyContext)
+	LOADFN(MakeCurrent)
+	LOADFN(GetProcAddress)
+	LOADFN(PixelStore)
+	#undef LOADFN
+	UIContext_osmesa.lib= lib;
+	return NULL;
+	missing:
+	dlclose(lib);
+	return "libOSMesa is missing required functions";
+}
 
-	memset(&wndAttrs, 0, sizeof(wndAttrs));
-	wndAttrs.background_pixel= 0;
-	wndAttrs.border_pixel= 0;
-	wndAttrs.colormap= cmap;
-	wndAttrs.event_mask= ExposureMask; // | KeyPressMask;
+void UIContext_connect_osmesa(UIContext *cx) {
+	double t;
+	const char *err;
 
-	if (en_debug)
-		log_debug("X11 screen is %dx%d", w, h);
+	UIContext_disconnect(cx);
+	UIContext_reset_phase_times(cx, 0, UICONTEXT_PHASE_COUNT-1);
+	t= UIContext_monotonic_now();
+	if ((err= UIContext_load_osmesa()))
+		croak("%s", err);
+	cx->backend= UICONTEXT_BACKEND_OSMESA;
+	UIContext_phase_done(cx, UICONTEXT_PHASE_XOPENDISPLAY, t);
+}
 
-	// Default missing window dimensions to screen size
-	if (w <= 0 || h <= 0) {
-		if (!(s= DefaultScreenOfDisplay(cx->dpy))) {
-			XFreeColormap(cx->dpy, cmap);
-			croak("DefaultScreenOfDisplay failed");
+void UIContext_setup_osmesa_glcontext(UIContext *cx) {
+	double t;
+
+	UIContext_teardown_osmesa_glcontext(cx);
+	UIContext_reset_phase_times(cx, UICONTEXT_PHASE_GLXCHOOSEVISUAL, UICONTEXT_PHASE_GLXCREATECONTEXT);
+	t= UIContext_monotonic_now();
+	// RGBA8 like the GLX visual, with whatever depth and stencil were requested
+	cx->osmesa_ctx= UIContext_osmesa.CreateContextExt(UICONTEXT_OSMESA_RGBA,
+		cx->fb_prefs.depth, cx->fb_prefs.stencil, 0, NULL);
+	if (!cx->osmesa_ctx)
+		croak("OSMesaCreateContextExt failed");
+	UIContext_phase_done(cx, UICONTEXT_PHASE_GLXCREATECONTEXT, t);
+	UIContext_load_gl_fn(cx);
+}
+
+void UIContext_teardown_osmesa_glcontext(UIContext *cx) {
+	cx->target= None;
+	if (cx->osmesa_ctx) {
+		if (UIContext_current.glctx == cx->osmesa_ctx) {
+			UIContext_osmesa.MakeCurrent(NULL, NULL, 0, 0, 0);
+			UIContext_forget_current();
 		}
-		
-		if (w <= 0) w= WidthOfScreen(s);
-		if (h <= 0) h= HeightOfScreen(s);
+		UIContext_osmesa.DestroyContext(cx->osmesa_ctx);
+		cx->osmesa_ctx= NULL;
 	}
-	
-	if (en_trace)
+}
+
+// Allocate a pixel buffer, optionally backed by a file so that other
+// processes can see the rendered image.  Returns the ID for the buffer.
+int UIContext_create_membuf(UIContext *cx, int w, int h, const char *mmap_path) {
+	UIContext_membuf *mb, *resized;
+	int id, fd;
+
+	if (w <= 0 || h <= 0)
+		croak("Invalid pixmap dimensions %dx%d", w, h);
+	// re-use a free slot, else grow the array
+	for (id= 1; id <= cx->membuf_count; id++)
+		if (!cx->membufs[id-1].pixels) break;
+	if (id > cx->membuf_count) {
+		if (!(resized= (UIContext_membuf*) realloc(cx->membufs, sizeof(UIContext_membuf) * (cx->membuf_count+1))))
+			croak("Out of memory");
+		cx->membufs= resized;
+		memset(cx->membufs + cx->membuf_count, 0, sizeof(UIContext_membuf));
+		cx->membuf_count++;
+	}
+	mb= &cx->membufs[id-1];
+	mb->size= (size_t) w * h * 4;
+	if (mmap_path) {
+		if ((fd= open(mmap_path, O_RDWR|O_CREAT, 0666)) < 0)
+			croak("Can't open %s: %s", mmap_path, strerror(errno));
+		if (ftruncate(fd, mb->size) < 0) {
+			close(fd);
+			croak("Can't resize %s: %s", mmap_path, strerror(errno));
+		}
+		mb->pixels= mmap(NULL, mb->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (mb->pixels == MAP_FAILED) {
+			mb->pixels= NULL;
+			croak("Can't mmap %s: %s", mmap_path, strerror(errno));
+		}
+		mb->is_mmap= 1;
+	}
+	else {
+		if (!(mb->pixels= calloc(1, mb->size)))
+			croak("Can't allocate %dx%d pixel buffer", w, h);
+		mb->is_mmap= 0;
+	}
+	mb->w= w;
+	mb->h= h;
+	return id;
+}
+
+UIContext_membuf *UIContext_get_membuf(UIContext *cx, int id) {
+	if (id < 1 || id > cx->membuf_count || !cx->membufs[id-1].pixels)
+		croak("No such pixel buffer %d", id);
+	return &cx->membufs[id-1];
+}
+
+// Run and clear the on_release hook, if any
+void UIContext_membuf_released(UIContext_membuf *mb) {
+	void (*fn)(void*)= mb->on_release;
+	mb->on_release= NULL;
+	if (fn) fn(mb->on_release_arg);
+	mb->on_release_arg= NULL;
+}
+
+void UIContext_destroy_membuf(UIContext *cx, int id) {
+	UIContext_membuf *mb;
+
+	if (id < 1 || id > cx->membuf_count || !cx->membufs[id-1].pixels)
+		return; // already freed by disconnect
+	mb= &cx->membufs[id-1];
+	// Mesa would otherwise keep rendering into the freed memory
+	if (cx->target == (Window) id && cx->osmesa_ctx) {
+		if (UIContext_current.glctx == cx->osmesa_ctx) {
+			UIContext_osmesa.MakeCurrent(NULL, NULL, 0, 0, 0);
+			UIContext_forget_current();
+		}
+		cx->target= None;
+	}
+	UIContext_membuf_released(mb);
+	if (mb->is_mmap)
+		munmap(mb->pixels, mb->size);
+	else
+		free(mb->pixels);
+	memset(mb, 0, sizeof(*mb));
+}
+
+void UIContext_free_membufs(UIContext *cx) {
+	int id;
+	for (id= 1; id <= cx->membuf_count; id++)
+		UIContext_destroy_membuf(cx, id);
+	free(cx->membufs);
+	cx->membufs= NULL;
+	cx->membuf_count= 0;
+}
+
+/*
+
+XShm backend.  This is the fallback for X servers without GLX.  OSMesa
+renders directly into a MIT-SHM shared memory XImage, and presenting a
+frame is an XShmPutImage of it to the window, which the server reads from
+shared memory without any copy over the socket.  There are two images, so
+the next frame can be rendered while the server is still reading the last.
+
+*/
+
+// Called after XOpenDisplay, to switch this connection to the XShm backend
+void UIContext_init_xshm(UIContext *cx) {
+	int major, minor, event_base, error_base;
+	Bool pixmaps;
+	const char *err;
+
+	if (!XShmQueryVersion(cx->dpy, &major, &minor, &pixmaps))
+		croak("Display supports neither GLX nor MIT-SHM");
+	if ((err= UIContext_load_osmesa()))
+		croak("Display does not support GLX, and software rendering is unavailable: %s", err);
+	cx->shm_event_base= XShmGetEventBase(cx->dpy);
+	if (!XQueryExtension(cx->dpy, "MIT-SHM", &cx->shm_opcode, &event_base, &error_base))
+		cx->shm_opcode= -1;
+	cx->shm_put_image= 0;
+	cx->backend= UICONTEXT_BACKEND_XSHM;
+	log_debug("MIT-SHM Version %d.%d", major, minor);
+}
+
+void UIContext_setup_xshm_glcontext(UIContext *cx) {
+	XVisualInfo tmpl;
+	int n= 0;
+	double t;
+
+	UIContext_teardown_xshm_glcontext(cx);
+	UIContext_reset_phase_times(cx, UICONTEXT_PHASE_GLXCHOOSEVISUAL, UICONTEXT_PHASE_GLXCREATECONTEXT);
+
+	// The window needs a 24-bit TrueColor visual to match OSMesa's BGRA output
+	t= UIContext_monotonic_now();
+	memset(&tmpl, 0, sizeof(tmpl));
+	tmpl.screen= DefaultScreen(cx->dpy);
+	tmpl.depth= 24;
+	tmpl.class= TrueColor;
+	cx->xvisi= XGetVisualInfo(cx->dpy, VisualScreenMask|VisualDepthMask|VisualClassMask, &tmpl, &n);
+	if (!cx->xvisi)
+		croak("No 24-bit TrueColor visual");
+	if (cx->xvisi->red_mask != 0xFF0000 || cx->xvisi->blue_mask != 0x0000FF) {
+		XFree(cx->xvisi);
+		cx->xvisi= NULL;
+		croak("Visual's pixel format doesn't match OSMesa's");
+	}
+	t= UIContext_phase_done(cx, UICONTEXT_PHASE_GLXCHOOSEVISUAL, t);
+
+	cx->osmesa_ctx= UIContext_osmesa.CreateContextExt(UICONTEXT_OSMESA_BGRA,
+		cx->fb_prefs.depth, cx->fb_prefs.stencil, 0, NULL);
+	if (!cx->osmesa_ctx)
+		croak("OSMesaCreateContextExt failed");
+	UIContext_phase_done(cx, UICONTEXT_PHASE_GLXCREATECONTEXT, t);
+	UIContext_load_gl_fn(cx);
+}
+
+static void UIContext_xshm_free_target(UIContext *cx) {
+	UIContext_shm_target *st= &cx->shm;
+	int i;
+
+	for (i= 0; i < 2; i++) {
+		if (!st->img[i]) continue;
+		if (st->put_image) {
+			XDestroyImage(st->img[i]); // also frees the malloc'd pixels
+			continue;
+		}
+		if (!UIContext_X_Fatal) {
+			XShmDetach(cx->dpy, &st->seg[i]);
+			st->img[i]->data= NULL; // else XDestroyImage would free() the shm segment
+			XDestroyImage(st->img[i]);
+		}
+		shmdt(st->seg[i].shmaddr);
+	}
+	if (st->gc && !UIContext_X_Fatal)
+		XFreeGC(cx->dpy, st->gc);
+	memset(st, 0, sizeof(*st));
+}
+
+void UIContext_teardown_xshm_glcontext(UIContext *cx) {
+	if (cx->osmesa_ctx && UIContext_current.glctx == cx->osmesa_ctx) {
+		UIContext_osmesa.MakeCurrent(NULL, NULL, 0, 0, 0);
+		UIContext_forget_current();
+	}
+	UIContext_xshm_free_target(cx);
+	UIContext_teardown_osmesa_glcontext(cx);
+	if (!UIContext_X_Fatal && cx->xvisi) XFree(cx->xvisi);
+	cx->xvisi= NULL;
+}
+
+// OSMesa renders BGRA with 4 bytes per pixel and no padding, so the
+// image has to be laid out exactly like that
+static int UIContext_xshm_image_ok(XImage *img, unsigned int w) {
+	return img->bits_per_pixel == 32 && img->byte_order == LSBFirst
+		&& img->bytes_per_line == (int) w * 4;
+}
+
+// Create both images in shared memory and attach them to the server.  A
+// remote server can't attach our memory, and only says so with an
+// asynchronous error, so this waits for the server's answer.  Returns 0,
+// with nothing left allocated, if shared memory can't be used.
+static int UIContext_xshm_attach_images(UIContext *cx, unsigned int w, unsigned int h) {
+	UIContext_shm_target *st= &cx->shm;
+	unsigned long serial;
+	void *addr;
+	int i, ok= 1;
+
+	for (i= 0; i < 2 && ok; i++) {
+		st->img[i]= XShmCreateImage(cx->dpy, cx->xvisi->visual, cx->xvisi->depth,
+			ZPixmap, NULL, &st->seg[i], w, h);
+		if (!st->img[i] || !UIContext_xshm_image_ok(st->img[i], w)
+			|| (st->seg[i].shmid= shmget(IPC_PRIVATE, st->img[i]->bytes_per_line * h, IPC_CREAT|0600)) < 0
+		) {
+			ok= 0;
+			break;
+		}
+		if ((addr= shmat(st->seg[i].shmid, NULL, 0)) == (void*) -1) {
+			shmctl(st->seg[i].shmid, IPC_RMID, NULL);
+			ok= 0;
+			break;
+		}
+		st->seg[i].shmaddr= st->img[i]->data= addr;
+		st->seg[i].readOnly= True;
+		#ifdef __linux__
+		// Linux lets a segment marked for deletion still be attached, so mark
+		// it now and it goes away even if we crash.  Elsewhere that would
+		// make XShmAttach fail, so it waits until the server has attached.
+		shmctl(st->seg[i].shmid, IPC_RMID, NULL);
+		#endif
+	}
+	if (ok) {
+		serial= NextRequest(cx->dpy);
+		for (i= 0; i < 2; i++)
+			XShmAttach(cx->dpy, &st->seg[i]);
+		XSync(cx->dpy, False);
+		if (UIContext_take_request_errors(cx->dpy, serial, cx->shm_opcode)) {
+			// Detach whichever one did attach; errors for the other are expected
+			serial= NextRequest(cx->dpy);
+			for (i= 0; i < 2; i++)
+				XShmDetach(cx->dpy, &st->seg[i]);
+			XSync(cx->dpy, False);
+			UIContext_take_request_errors(cx->dpy, serial, cx->shm_opcode);
+			ok= 0;
+		}
+	}
+	for (i= 0; i < 2; i++) {
+		#ifndef __linux__
+		if (st->seg[i].shmaddr)
+			shmctl(st->seg[i].shmid, IPC_RMID, NULL);
+		#endif
+		if (!ok && st->img[i]) {
+			st->img[i]->data= NULL;
+			XDestroyImage(st->img[i]);
+			if (st->seg[i].shmaddr)
+				shmdt(st->seg[i].shmaddr);
+		}
+	}
+	if (!ok)
+		memset(st, 0, sizeof(*st));
+	return ok;
+}
+
+// Create both images in client memory, for XPutImage
+static int UIContext_xshm_create_put_images(UIContext *cx, unsigned int w, unsigned int h) {
+	UIContext_shm_target *st= &cx->shm;
+	char *data;
+	int i;
+
+	st->put_image= 1;
+	for (i= 0; i < 2; i++) {
+		if (!(data= malloc((size_t) w * h * 4)))
+			return 0;
+		st->img[i]= XCreateImage(cx->dpy, cx->xvisi->visual, cx->xvisi->depth,
+			ZPixmap, 0, data, w, h, 32, w * 4);
+		if (!st->img[i]) {
+			free(data);
+			return 0;
+		}
+		if (!UIContext_xshm_image_ok(st->img[i], w))
+			return 0;
+	}
+	return 1;
+}
+
+// Allocate the pair of images for a window, at its current size.  Call
+// set_gl_target again after the window is resized.
+void UIContext_xshm_set_target(UIContext *cx, Window wnd) {
+	UIContext_shm_target *st= &cx->shm;
+	int x, y;
+	unsigned int w, h, border, depth;
+	Window root;
+
+	UICONTEXT_LOG_REQUEST(cx);
+	if (!XGetGeometry(cx->dpy, wnd, &root, &x, &y, &w, &h, &border, &depth))
+		croak("XGetGeometry failed");
+	if (st->wnd != wnd || st->w != (int) w || st->h != (int) h) {
+		UIContext_osmesa.MakeCurrent(NULL, NULL, 0, 0, 0);
+		UIContext_forget_current();
+		UIContext_xshm_free_target(cx);
+		if (!cx->shm_put_image && !UIContext_xshm_attach_images(cx, w, h)) {
+			log_info("Can't share memory with the X server; sending frames with XPutImage");
+			cx->shm_put_image= 1;
+		}
+		if (cx->shm_put_image && !UIContext_xshm_create_put_images(cx, w, h)) {
+			UIContext_xshm_free_target(cx);
+			croak("Can't create images for window");
+		}
+		if (!(st->gc= XCreateGC(cx->dpy, wnd, 0, NULL))) {
+			UIContext_xshm_free_target(cx);
+			croak("XCreateGC failed");
+		}
+		st->wnd= wnd;
+		st->w= w;
+		st->h= h;
+		st->back= 0;
+	}
+	if (!UIContext_osmesa.MakeCurrent(cx->osmesa_ctx, st->img[st->back]->data, GL_UNSIGNED_BYTE, w, h)) {
+		UIContext_forget_current();
+		croak("OSMesaMakeCurrent failed");
+	}
+	UIContext_set_current(cx, cx->osmesa_ctx, wnd, st->img[st->back]->data, w, h);
+	// XImages have the top row first
+	UIContext_osmesa.PixelStore(UICONTEXT_OSMESA_Y_UP, 0);
+}
+
+static Bool WaitForShmCompletion(Display *dpy, XEvent *event, XPointer arg) {
+	UIContext *cx= (UIContext*) arg;
+	return event->type == cx->shm_event_base + ShmCompletion
+		&& ((XShmCompletionEvent*) event)->shmseg == cx->shm.seg[cx->shm.back].shmseg;
+}
+
+// Copy part of the back image to the window (X coordinates)
+static void UIContext_xshm_put(UIContext *cx, int x, int y, int w, int h, Bool send_event) {
+	UIContext_shm_target *st= &cx->shm;
+	if (st->put_image)
+		XPutImage(cx->dpy, st->wnd, st->gc, st->img[st->back], x, y, x, y, w, h);
+	else
+		XShmPutImage(cx->dpy, st->wnd, st->gc, st->img[st->back], x, y, x, y, w, h, send_event);
+}
+
+// Show the rendered image, or only the 'n' rectangles of it in 'rects' (GL
+// coordinates, clipped to the window) if n > 0.  Only the last XShmPutImage
+// asks for a completion event, since the server handles them in order.
+void UIContext_xshm_present(UIContext *cx, const int *rects, int n) {
+	UIContext_shm_target *st= &cx->shm;
+	XEvent event;
+	int i, x, y, w, h, px= 0, py= 0, pw= 0, ph= 0, sent= 0;
+
+	UICONTEXT_LOG_REQUEST(cx);
+	cx->gl.Finish();
+	if (n <= 0)
+		UIContext_xshm_put(cx, 0, 0, st->w, st->h, True);
+	else {
+		// Each rectangle is sent once the next visible one is found, so that
+		// only the last one asks for a completion event
+		for (i= 0; i < n; i++) {
+			if (!UIContext_clip_rect(rects + i*4, st->w, st->h, &x, &y, &w, &h))
+				continue;
+			if (sent++)
+				UIContext_xshm_put(cx, px, st->h - py - ph, pw, ph, False);
+			px= x; py= y; pw= w; ph= h;
+		}
+		if (sent)
+			UIContext_xshm_put(cx, px, st->h - py - ph, pw, ph, True);
+		cx->present_partial_count++;
+	}
+	XFlush(cx->dpy);
+	// XPutImage has copied the pixels by the time it returns
+	st->pending[st->back]= !st->put_image && (sent || n <= 0);
+	st->presented[st->back]= ++st->frames;
+	st->back ^= 1;
+	// Can't render into the other image until the server is done reading it.
+	// If the window was destroyed, the completion never comes, so give up eventually.
+	if (st->pending[st->back]) {
+		if (!UIContext_wait_event(cx, &event, WaitForShmCompletion, (XPointer) cx, 1000))
+			log_debug("No ShmCompletion for previous frame");
+		st->pending[st->back]= 0;
+	}
+	if (!UIContext_osmesa.MakeCurrent(cx->osmesa_ctx, st->img[st->back]->data, GL_UNSIGNED_BYTE, st->w, st->h)) {
+		UIContext_forget_current();
+		croak("OSMesaMakeCurrent failed");
+	}
+	UIContext_set_current(cx, cx->osmesa_ctx, st->wnd, st->img[st->back]->data, st->w, st->h);
+}
+
+static int UIContext_has_glcontext(UIContext *cx) {
+	return cx->glctx || cx->egl_ctx || cx->osmesa_ctx;
+}
+
+void *UIContext_get_proc_address(UIContext *cx, const char *name) {
+	#ifdef UICONTEXT_HAVE_EGL
+	if (cx->backend == UICONTEXT_BACKEND_EGL)
+		return (void*) UIContext_egl.GetProcAddress(name);
+	#endif
+	if (cx->backend == UICONTEXT_BACKEND_OSMESA || cx->backend == UICONTEXT_BACKEND_XSHM)
+		return UIContext_osmesa.GetProcAddress(name);
+	return (void*) glXGetProcAddress((const GLubyte*) name);
+}
+
+// Framebuffer objects are core since GL 3.0, but need looked up like any
+// extension function.  Leaves the table zeroed if any of them are missing.
+void UIContext_load_fbo_fn(UIContext *cx) {
+	memset(&cx->fbo, 0, sizeof(cx->fbo));
+	#define LOADFN(name) if (!(cx->fbo.name= (void*) UIContext_get_proc_address(cx, "gl" #name))) goto missing;
+	LOADFN(GenFramebuffers)
+	LOADFN(DeleteFramebuffers)
+	LOADFN(BindFramebuffer)
+	LOADFN(CheckFramebufferStatus)
+	LOADFN(FramebufferRenderbuffer)
+	LOADFN(GetFramebufferAttachmentParameteriv)
+	LOADFN(GenRenderbuffers)
+	LOADFN(DeleteRenderbuffers)
+	LOADFN(BindRenderbuffer)
+	LOADFN(RenderbufferStorage)
+	#undef LOADFN
+	return;
+	missing:
+	memset(&cx->fbo, 0, sizeof(cx->fbo));
+}
+
+// Every GL has the core functions, so failing to find one means the backend
+// is broken.  The fixed-function ones are optional.
+void UIContext_load_gl_fn(UIContext *cx) {
+	const char *name;
+	memset(&cx->gl, 0, sizeof(cx->gl));
+	cx->gl_can_blit= -1;
+	cx->gl_read_buffer= cx->fb_prefs.single_buffer? GL_FRONT : GL_BACK;
+	cx->read_buffer_xid= None;
+	#define LOADFN(fn) if (!(cx->gl.fn= (void*) UIContext_get_proc_address(cx, name= "gl" #fn))) goto missing;
+	LOADFN(GetError)
+	LOADFN(GetString)
+	LOADFN(GetIntegerv)
+	LOADFN(Enable)
+	LOADFN(Disable)
+	LOADFN(Flush)
+	LOADFN(Finish)
+	LOADFN(Viewport)
+	LOADFN(ClearColor)
+	LOADFN(Clear)
+	LOADFN(FrontFace)
+	LOADFN(PixelStorei)
+	LOADFN(ReadPixels)
+	LOADFN(ReadBuffer)
+	#undef LOADFN
+	#define LOADFN(fn) cx->gl.fn= (void*) UIContext_get_proc_address(cx, "gl" #fn);
+	LOADFN(BlitFramebuffer)
+	LOADFN(MatrixMode)
+	LOADFN(LoadIdentity)
+	LOADFN(LoadMatrixd)
+	LOADFN(Frustum)
+	LOADFN(Translated)
+	LOADFN(PixelZoom)
+	LOADFN(WindowPos2i)
+	LOADFN(CopyPixels)
+	#undef LOADFN
+	return;
+	missing:
+	memset(&cx->gl, 0, sizeof(cx->gl));
+	croak("GL library has no %s", name);
+}
+
+UIContext_gl_fn *UIContext_get_current_gl() {
+	if (!UIContext_current.cx)
+		croak("No current GL context");
+	return &UIContext_current.cx->gl;
+}
+
+// Bytes per pixel that glReadPixels writes for this format and type, or 0
+// if the combination isn't one this module knows.
+size_t UIContext_gl_pixel_size(GLenum format, GLenum type) {
+	int components, bytes;
+	switch (format) {
+	case GL_RED: case GL_GREEN: case GL_BLUE: case GL_ALPHA: case GL_LUMINANCE:
+	case GL_DEPTH_COMPONENT: case GL_STENCIL_INDEX:
+		components= 1; break;
+	case GL_RG: case GL_LUMINANCE_ALPHA:
+		components= 2; break;
+	case GL_RGB: case GL_BGR:
+		components= 3; break;
+	case GL_RGBA: case GL_BGRA:
+		components= 4; break;
+	case GL_DEPTH_STENCIL:
+		return type == GL_UNSIGNED_INT_24_8? 4 : 0;
+	default:
+		return 0;
+	}
+	switch (type) {
+	case GL_BYTE: case GL_UNSIGNED_BYTE:
+		bytes= 1; break;
+	case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT:
+		bytes= 2; break;
+	case GL_INT: case GL_UNSIGNED_INT: case GL_FLOAT:
+		bytes= 4; break;
+	// whole pixel in one int
+	case GL_UNSIGNED_INT_8_8_8_8: case GL_UNSIGNED_INT_8_8_8_8_REV: case GL_UNSIGNED_INT_2_10_10_10_REV:
+		return components == 4? 4 : 0;
+	default:
+		return 0;
+	}
+	return components * bytes;
+}
+
+void UIContext_teardown_glcontext(UIContext *cx) {
+	// Pooled targets belong to this context (and its visual)
+	UIContext_flush_pixmap_pool(cx, 0);
+	UIContext_remove_debug_callback(cx);
+	UIContext_stream_free(cx);
+	memset(&cx->gl, 0, sizeof(cx->gl));
+	if (cx->backend == UICONTEXT_BACKEND_EGL) {
+		UIContext_teardown_egl_glcontext(cx);
+		return;
+	}
+	if (cx->backend == UICONTEXT_BACKEND_OSMESA) {
+		UIContext_teardown_osmesa_glcontext(cx);
+		return;
+	}
+	if (cx->backend == UICONTEXT_BACKEND_XSHM) {
+		UIContext_teardown_xshm_glcontext(cx);
+		return;
+	}
+	
+	UICONTEXT_LOG_REQUEST(cx);
+	// Another UIContext's context can stay current
+	if (cx->glctx && glXGetCurrentContext() == cx->glctx)
+		glXMakeCurrent(cx->dpy, None, NULL);
+	if (UIContext_current.cx == cx)
+		UIContext_forget_current();
+	cx->target= None;
+	
+	if (!UIContext_X_Fatal && cx->glctx) {
+		if (cx->glctx_is_imported) {
+			if (!cx->glx.FreeContextEXT)
+				croak("Can't load glXFreeContextEXT"); // should never happen if we were able to import it
+			cx->glx.FreeContextEXT(cx->dpy, cx->glctx);
+		}
+		else
+			glXDestroyContext(cx->dpy, cx->glctx);
+	}
+	cx->glctx= NULL;
+	cx->glctx_id= 0;
+	cx->glctx_is_imported= 0;
+	
+	if (!UIContext_X_Fatal && cx->xvisi) XFree(cx->xvisi);
+	cx->xvisi= NULL;
+	cx->fbconfig= NULL;
+	cx->pixmap_fbconfig= NULL;
+	cx->pixmap_fbconfig_id= 0;
+	cx->glctx_srgb= 0;
+}
+
+
+Bool UIContext_wait_event(
+	UIContext *cx,
+	XEvent *event,
+	Bool (*callback)(Display*, XEvent*, XPointer),
+	XPointer callback_arg,
+	int max_wait_msec
+) {
+	double deadline= 0, remaining;
+	struct timeval tv;
+
+	while (!XCheckIfEvent(cx->dpy, event, callback, callback_arg)) {
+		if (!deadline)
+			deadline= UIContext_monotonic_now() + max_wait_msec * 0.001;
+		remaining= deadline - UIContext_monotonic_now();
+		if (remaining < 0) return 0;  // timeout
+		tv.tv_sec=  (long) remaining;
+		tv.tv_usec= (long) ((remaining - tv.tv_sec) * 1000000);
+		
+		if (UIContext_wait_xlib_socket(cx, tv) <= 0)
+			return 0; // timeout, interrupted by signal, or other error
+	}
+	return 1;
+}
+
+// True if the context of cx is current in this thread, with target xid
+static int UIContext_target_is_current(UIContext *cx, Window xid) {
+	UIContext_membuf *mb;
+	switch (cx->backend) {
+	case UICONTEXT_BACKEND_EGL:
+		// The framebuffer binding might have been changed by other GL code
+		return 0;
+	case UICONTEXT_BACKEND_XSHM:
+		// set_gl_target is also how a resized window gets new images
+		return 0;
+	case UICONTEXT_BACKEND_OSMESA:
+		mb= UIContext_get_membuf(cx, xid);
+		return UIContext_current.glctx == cx->osmesa_ctx && UIContext_current.target == xid
+			&& UIContext_current.buffer == mb->pixels
+			&& UIContext_current.w == mb->w && UIContext_current.h == mb->h;
+	default:
+		// libGL tracks this per thread without asking the server, and it
+		// also sees make-current calls from code other than this module.
+		return glXGetCurrentContext() == cx->glctx && glXGetCurrentDrawable() == xid
+			&& glXGetCurrentReadDrawable() == xid && glXGetCurrentDisplay() == cx->dpy;
+	}
+}
+
+// GL objects of a UIContext must be deleted with its own context current,
+// and tearing one down must not touch whatever context the caller is using.
+// UIContext_gl_cleanup_begin makes cx's context current if it isn't, and
+// returns false if that isn't possible (then its objects just die with the
+// context).  UIContext_gl_cleanup_end puts the previous context back.
+typedef struct UIContext_gl_cleanup {
+	struct UIContext_current_state prev;
+	int switched;
+	Display *glx_dpy;  // GLX: what libGL had current, possibly set by other code
+	GLXDrawable glx_draw, glx_read;
+	GLXContext glx_ctx;
+} UIContext_gl_cleanup;
+
+static int UIContext_gl_cleanup_begin(UIContext *cx, UIContext_gl_cleanup *save) {
+	static uint32_t osmesa_pixel;
+	memset(save, 0, sizeof(*save));
+	save->prev= UIContext_current;
+	if (UIContext_X_Fatal)
+		return 0;
+	switch (cx->backend) {
+	case UICONTEXT_BACKEND_EGL:
+		#ifdef UICONTEXT_HAVE_EGL
+		if (!cx->egl_ctx) return 0;
+		if (UIContext_current.glctx == cx->egl_ctx) return 1;
+		if (!UIContext_egl.MakeCurrent(cx->egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, cx->egl_ctx))
+			return 0;
+		UIContext_set_current(cx, cx->egl_ctx, None, NULL, 0, 0);
+		break;
+		#else
+		return 0;
+		#endif
+	case UICONTEXT_BACKEND_OSMESA:
+	case UICONTEXT_BACKEND_XSHM:
+		if (!cx->osmesa_ctx) return 0;
+		if (UIContext_current.glctx == cx->osmesa_ctx) return 1;
+		// Any buffer will do for deleting objects
+		if (!UIContext_osmesa.MakeCurrent(cx->osmesa_ctx, &osmesa_pixel, GL_UNSIGNED_BYTE, 1, 1))
+			return 0;
+		UIContext_set_current(cx, cx->osmesa_ctx, None, &osmesa_pixel, 1, 1);
+		break;
+	default:
+		if (!cx->glctx) return 0;
+		save->glx_ctx= glXGetCurrentContext();
+		if (save->glx_ctx == cx->glctx) return 1;
+		// GLX needs a drawable; without one, leave the objects to the context
+		if (!cx->target) return 0;
+		save->glx_dpy= glXGetCurrentDisplay();
+		save->glx_draw= glXGetCurrentDrawable();
+		save->glx_read= glXGetCurrentReadDrawable();
+		if (!glXMakeCurrent(cx->dpy, cx->target, cx->glctx))
+			return 0;
+		UIContext_set_current(cx, cx->glctx, cx->target, NULL, 0, 0);
+		break;
+	}
+	save->switched= 1;
+	return 1;
+}
+
+static void UIContext_gl_cleanup_end(UIContext *cx, UIContext_gl_cleanup *save) {
+	void *glctx= save->prev.glctx;
+	if (!save->switched)
+		return;
+	switch (cx->backend) {
+	case UICONTEXT_BACKEND_EGL:
+		#ifdef UICONTEXT_HAVE_EGL
+		// Each EGL context keeps its own framebuffer bindings
+		if (glctx && save->prev.cx && save->prev.cx->egl_ctx == glctx)
+			UIContext_egl.MakeCurrent(save->prev.cx->egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, glctx);
+		else
+			UIContext_egl.MakeCurrent(cx->egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		#endif
+		break;
+	case UICONTEXT_BACKEND_OSMESA:
+	case UICONTEXT_BACKEND_XSHM:
+		if (glctx)
+			UIContext_osmesa.MakeCurrent(glctx, save->prev.buffer, GL_UNSIGNED_BYTE, save->prev.w, save->prev.h);
+		else
+			UIContext_osmesa.MakeCurrent(NULL, NULL, 0, 0, 0);
+		break;
+	default:
+		if (!save->glx_ctx)
+			glXMakeCurrent(cx->dpy, None, NULL);
+		else if (save->glx_draw == save->glx_read)
+			glXMakeCurrent(save->glx_dpy, save->glx_draw, save->glx_ctx);
+		else
+			glXMakeContextCurrent(save->glx_dpy, save->glx_draw, save->glx_read, save->glx_ctx);
+		break;
+	}
+	UIContext_current= save->prev;
+}
+
+// Pixmaps made by create_pixmap are single-buffered, so what was rendered
+// to them is in the front buffer; in a double-buffered window it is in the
+// back buffer until the swap.  Telling them apart asks the server, but only
+// once pixmaps exist, and only once in a row for the same drawable.
+static GLenum UIContext_glx_read_buffer(UIContext *cx, GLXDrawable read) {
+	unsigned int id= 0;
+	if (cx->fb_prefs.single_buffer)
+		return GL_FRONT;
+	if (!cx->pixmap_fbconfig_id)
+		return GL_BACK;
+	if (cx->read_buffer_xid != read) {
+		glXQueryDrawable(cx->dpy, read, GLX_FBCONFIG_ID, &id);
+		cx->read_buffer_xid= read;
+		cx->read_buffer_mode= id == (unsigned int) cx->pixmap_fbconfig_id? GL_FRONT : GL_BACK;
+	}
+	return cx->read_buffer_mode;
+}
+
+// Call after making 'read' current on GLX, to read from its rendered buffer
+static void UIContext_glx_set_read_buffer(UIContext *cx, GLXDrawable read) {
+	GLenum mode= UIContext_glx_read_buffer(cx, read);
+	if (mode != cx->gl_read_buffer) {
+		cx->gl.ReadBuffer(mode);
+		cx->gl_read_buffer= mode;
+	}
+}
+
+// The lookup cache must not outlive the drawable, since X reuses IDs
+static void UIContext_glx_forget_drawable(UIContext *cx, Window xid) {
+	if (cx->read_buffer_xid == xid)
+		cx->read_buffer_xid= None;
+}
+
+void UIContext_glXMakeCurrent(UIContext *cx, int xid) {
+	CROAK_IF_XLIB_FATAL();
+	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_GLCONTEXT(cx);
+
+	if (UIContext_target_is_current(cx, xid)) {
+		// libGL also knows of make-current calls by other code; record it
+		if (cx->backend == UICONTEXT_BACKEND_GLX)
+			UIContext_set_current(cx, cx->glctx, xid, NULL, 0, 0);
+		cx->make_current_skipped++;
+	}
+	// On EGL there are no drawables, and targets are framebuffer objects.
+	// The binding is cheap, and only the context switch is worth skipping.
+	else if (cx->backend == UICONTEXT_BACKEND_EGL) {
+		if (UIContext_current.glctx == cx->egl_ctx)
+			cx->make_current_skipped++;
+		else
+			cx->make_current_count++;
+		UIContext_egl_make_current(cx);
+		cx->fbo.BindFramebuffer(GL_FRAMEBUFFER, xid);
+		UIContext_current.target= UIContext_current.read= xid;
+	}
+	else if (cx->backend == UICONTEXT_BACKEND_XSHM) {
+		UIContext_xshm_set_target(cx, xid);
+		cx->make_current_count++;
+	}
+	else if (cx->backend == UICONTEXT_BACKEND_OSMESA) {
+		UIContext_membuf *mb= UIContext_get_membuf(cx, xid);
+		if (!UIContext_osmesa.MakeCurrent(cx->osmesa_ctx, mb->pixels, GL_UNSIGNED_BYTE, mb->w, mb->h)) {
+			UIContext_forget_current();
+			croak("OSMesaMakeCurrent failed");
+		}
+		UIContext_set_current(cx, cx->osmesa_ctx, xid, mb->pixels, mb->w, mb->h);
+		cx->make_current_count++;
+	}
+	else {
+		UICONTEXT_LOG_REQUEST(cx);
+		if (!glXMakeCurrent(cx->dpy, xid, cx->glctx)) {
+			UIContext_forget_current();
+			croak("glXMakeCurrent failed");
+		}
+		UIContext_set_current(cx, cx->glctx, xid, NULL, 0, 0);
+		UIContext_glx_set_read_buffer(cx, xid);
+		cx->make_current_count++;
+	}
+	cx->target= xid;
+	
+	if (cx->gl_debug && !cx->gl_debug_installed)
+		UIContext_install_debug_callback(cx);
+	if (cx->glctx_srgb) {
+		cx->gl.Enable(GL_FRAMEBUFFER_SRGB);
+		cx->glctx_srgb= 0;
+	}
+}
+
+// Render to 'draw' while glReadPixels, glCopyPixels and glBlitFramebuffer
+// read from 'read'.  On GLX this is glXMakeContextCurrent, which needs GLX
+// 1.3; on EGL the two FBOs are bound as the draw and read framebuffers.
+void UIContext_make_context_current(UIContext *cx, int draw, int read) {
+	if (draw == read) {
+		UIContext_glXMakeCurrent(cx, draw);
+		return;
+	}
+	CROAK_IF_XLIB_FATAL();
+	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_GLCONTEXT(cx);
+
+	if (cx->backend == UICONTEXT_BACKEND_EGL) {
+		if (UIContext_current.glctx == cx->egl_ctx)
+			cx->make_current_skipped++;
+		else
+			cx->make_current_count++;
+		UIContext_egl_make_current(cx);
+		cx->fbo.BindFramebuffer(GL_DRAW_FRAMEBUFFER, draw);
+		cx->fbo.BindFramebuffer(GL_READ_FRAMEBUFFER, read);
+		UIContext_current.target= draw;
+	}
+	else if (cx->backend != UICONTEXT_BACKEND_GLX) {
+		croak("Separate draw and read targets are not supported by the %s backend",
+			UIContext_backend_names[cx->backend]);
+	}
+	else if (glXGetCurrentContext() == cx->glctx && glXGetCurrentDrawable() == (GLXDrawable) draw
+		&& glXGetCurrentReadDrawable() == (GLXDrawable) read && glXGetCurrentDisplay() == cx->dpy
+	) {
+		UIContext_set_current(cx, cx->glctx, draw, NULL, 0, 0);
+		cx->make_current_skipped++;
+	}
+	else {
+		if (cx->glx_version_major == 1 && cx->glx_version_minor < 3)
+			croak("Separate draw and read targets need GLX 1.3 (server has %d.%d)",
+				cx->glx_version_major, cx->glx_version_minor);
+		UICONTEXT_LOG_REQUEST(cx);
+		if (!glXMakeContextCurrent(cx->dpy, draw, read, cx->glctx)) {
+			UIContext_forget_current();
+			croak("glXMakeContextCurrent failed");
+		}
+		UIContext_set_current(cx, cx->glctx, draw, NULL, 0, 0);
+		UIContext_glx_set_read_buffer(cx, read);
+		cx->make_current_count++;
+	}
+	UIContext_current.read= read;
+	cx->target= draw;
+
+	if (cx->gl_debug && !cx->gl_debug_installed)
+		UIContext_install_debug_callback(cx);
+	if (cx->glctx_srgb) {
+		cx->gl.Enable(GL_FRAMEBUFFER_SRGB);
+		cx->glctx_srgb= 0;
+	}
+}
+
+// Copy a rectangle of 'src' (a pixmap or FBO) into a rectangle of 'dst' (a
+// window or another pixmap), scaling it to fit, without the pixels leaving
+// the GPU.  Coordinates are GL ones, with the origin at the bottom left.
+// Uses glBlitFramebuffer if the context has it, else glCopyPixels with
+// glPixelZoom.  Afterward 'dst' is the target and 'src' the read target, so
+// the next show presents 'dst'.  The scissor test applies, and for
+// glCopyPixels so does the fragment state, as for any other drawing.
+void UIContext_blit(UIContext *cx, int src, int sx, int sy, int sw, int sh,
+	int dst, int dx, int dy, int dw, int dh, int linear
+) {
+	if (sw <= 0 || sh <= 0 || dw <= 0 || dh <= 0)
+		croak("Blit rectangles must have a positive size");
+	if (src == dst)
+		croak("Blit source and destination must be different targets");
+	UIContext_make_context_current(cx, dst, src);
+
+	if (cx->gl_can_blit < 0)
+		cx->gl_can_blit= cx->gl.BlitFramebuffer
+			&& (UIContext_gl_version_at_least(cx, 3, 0)
+			|| UIContext_has_gl_extension(cx, "GL_ARB_framebuffer_object"));
+	if (cx->gl_can_blit) {
+		// glBlitFramebuffer can only filter colors when the size changes
+		cx->gl.BlitFramebuffer(sx, sy, sx+sw, sy+sh, dx, dy, dx+dw, dy+dh, GL_COLOR_BUFFER_BIT,
+			linear && (sw != dw || sh != dh)? GL_LINEAR : GL_NEAREST);
+	}
+	else if (cx->gl.CopyPixels && cx->gl.PixelZoom && cx->gl.WindowPos2i) {
+		cx->gl.WindowPos2i(dx, dy);
+		cx->gl.PixelZoom((GLfloat) dw / sw, (GLfloat) dh / sh);
+		cx->gl.CopyPixels(sx, sy, sw, sh, GL_COLOR);
+		cx->gl.PixelZoom(1, 1);
+	}
+	else
+		croak("The GL has neither glBlitFramebuffer nor glCopyPixels");
+}
+
+// Pick a single-buffered FBConfig for pixmaps with the same color, depth and
+// stencil sizes as the context's config, so that the context can render to
+// it.  Falls back to the context's own config if that one supports pixmaps.
+static GLXFBConfig UIContext_glx_pixmap_fbconfig(UIContext *cx) {
+	GLXFBConfig *configs;
+	XVisualInfo *vis;
+	int i, n= 0, a= 0, attrs[32], drawable_type= 0;
+	static const int copy_attrs[]= { GLX_RED_SIZE, GLX_GREEN_SIZE, GLX_BLUE_SIZE,
+		GLX_ALPHA_SIZE, GLX_DEPTH_SIZE, GLX_STENCIL_SIZE };
+	
+	if (cx->pixmap_fbconfig)
+		return cx->pixmap_fbconfig;
+	attrs[a++]= GLX_DRAWABLE_TYPE; attrs[a++]= GLX_PIXMAP_BIT;
+	attrs[a++]= GLX_RENDER_TYPE;   attrs[a++]= GLX_RGBA_BIT;
+	attrs[a++]= GLX_DOUBLEBUFFER;  attrs[a++]= False;
+	for (i= 0; i < (int)(sizeof(copy_attrs)/sizeof(copy_attrs[0])); i++) {
+		attrs[a]= copy_attrs[i];
+		glXGetFBConfigAttrib(cx->dpy, cx->fbconfig, copy_attrs[i], &attrs[a+1]);
+		a += 2;
+	}
+	if (cx->glctx_srgb) {
+		attrs[a++]= GLX_FRAMEBUFFER_SRGB_CAPABLE_ARB; attrs[a++]= True;
+	}
+	attrs[a]= None;
+	configs= glXChooseFBConfig(cx->dpy, DefaultScreen(cx->dpy), attrs, &n);
+	if (configs && n) {
+		cx->pixmap_fbconfig= configs[0];
+		glXGetFBConfigAttrib(cx->dpy, cx->pixmap_fbconfig, GLX_FBCONFIG_ID, &cx->pixmap_fbconfig_id);
+	}
+	else {
+		glXGetFBConfigAttrib(cx->dpy, cx->fbconfig, GLX_DRAWABLE_TYPE, &drawable_type);
+		if (!(drawable_type & GLX_PIXMAP_BIT))
+			croak("No FBConfig compatible with the GL context can render to pixmaps");
+		log_debug("No single-buffered pixmap FBConfig; using the context's FBConfig");
+		cx->pixmap_fbconfig= cx->fbconfig;
+		cx->pixmap_fbconfig_id= 0;
+	}
+	if (configs) XFree(configs);
+	// The X pixmap must have the depth of the config's visual
+	vis= glXGetVisualFromFBConfig(cx->dpy, cx->pixmap_fbconfig);
+	cx->pixmap_depth= vis? vis->depth : cx->xvisi->depth;
+	if (vis) XFree(vis);
+	return cx->pixmap_fbconfig;
+}
+
+int UIContext_create_pixmap(UIContext *cx, int w, int h) {
+	int xid, gl_xid, i;
+	UIContext *prev;
+	GLXFBConfig config;
+
+	CROAK_IF_XLIB_FATAL();
+	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_GLCONTEXT(cx);
+
+	// Newest first, since it is the most likely to still be in a cache
+	for (i= cx->pixmap_pool.count - 1; i >= 0; i--) {
+		if (cx->pixmap_pool.ent[i].w == w && cx->pixmap_pool.ent[i].h == h) {
+			xid= cx->pixmap_pool.ent[i].xid;
+			cx->pixmap_pool.count--;
+			memmove(cx->pixmap_pool.ent + i, cx->pixmap_pool.ent + i + 1,
+				(cx->pixmap_pool.count - i) * sizeof(cx->pixmap_pool.ent[0]));
+			cx->pixmap_pool.hits++;
+			return xid;
+		}
+	}
+	if (cx->pixmap_pool.limit)
+		cx->pixmap_pool.misses++;
+
+	UICONTEXT_LOG_REQUEST(cx);
+	if (cx->backend == UICONTEXT_BACKEND_EGL) {
+		prev= UIContext_current.cx;
+		xid= UIContext_create_fbo(cx, w, h);
+		UIContext_egl_restore_current(prev, cx);
+		return xid;
+	}
+	if (cx->backend == UICONTEXT_BACKEND_OSMESA)
+		return UIContext_create_membuf(cx, w, h, NULL);
+	if (cx->backend == UICONTEXT_BACKEND_XSHM)
+		croak("Pixmaps are not supported by the XShm backend; use the osmesa backend for offscreen rendering");
+
+	if (cx->fbconfig) {
+		config= UIContext_glx_pixmap_fbconfig(cx);
+		xid= XCreatePixmap(cx->dpy, DefaultRootWindow(cx->dpy), w, h, cx->pixmap_depth);
+		if (!xid)
+			croak("XCreatePixmap failed");
+		gl_xid= glXCreatePixmap(cx->dpy, config, xid, NULL);
+	}
+	else {
+		xid= XCreatePixmap(cx->dpy, DefaultRootWindow(cx->dpy),
+			w, h, cx->xvisi->depth);
+		if (!xid)
+			croak("XCreatePixmap failed");
+		gl_xid= glXCreateGLXPixmap(cx->dpy, cx->xvisi, xid);
+	}
+	XFreePixmap(cx->dpy, xid); // gl pixmap should hold its own reference?
+	if (!gl_xid)
+		croak("Can't create GLX pixmap");
+	
+	return gl_xid;
+}
+
+void UIContext_destroy_pixmap(UIContext *cx, Pixmap xid) {
+	UIContext *prev;
+
+	CROAK_IF_XLIB_FATAL();
+	CROAK_IF_NO_DISPLAY(cx);
+	UICONTEXT_LOG_REQUEST(cx);
+
+	if (cx->backend == UICONTEXT_BACKEND_EGL) {
+		prev= UIContext_current.cx;
+		UIContext_destroy_fbo(cx, xid);
+		UIContext_egl_restore_current(prev, cx);
+		return;
+	}
+	if (cx->backend == UICONTEXT_BACKEND_OSMESA) {
+		UIContext_destroy_membuf(cx, xid);
+		return;
+	}
+
+	UIContext_glx_forget_drawable(cx, xid);
+	// Pixmaps are made with glXCreatePixmap whenever GLX 1.3 is available
+	if (cx->glx_version_major > 1 || cx->glx_version_minor >= 3)
+		glXDestroyPixmap(cx->dpy, xid);
+	else
+		glXDestroyGLXPixmap(cx->dpy, xid);
+}
+
+// Like destroy_pixmap, but if the pixmap pool is enabled, keep the target
+// for the next create_pixmap of the same size (w and h must be the ones it
+// was created with).  The oldest pooled target is destroyed to make room.
+// The contents of a recycled target are whatever was last rendered to it.
+// Memory-mapped osmesa buffers are always destroyed, since their file would
+// otherwise be shared with the next user.
+void UIContext_release_pixmap(UIContext *cx, Pixmap xid, int w, int h) {
+	UIContext_pixmap_pool *pool= &cx->pixmap_pool;
+
+	if (!pool->limit || UIContext_X_Fatal || !UIContext_has_glcontext(cx)
+		|| (cx->backend == UICONTEXT_BACKEND_OSMESA && UIContext_get_membuf(cx, xid)->is_mmap)
+	) {
+		UIContext_destroy_pixmap(cx, xid);
+		return;
+	}
+	// The next owner must not be visible through the last one's alias
+	if (cx->backend == UICONTEXT_BACKEND_OSMESA)
+		UIContext_membuf_released(UIContext_get_membuf(cx, xid));
+	if (pool->count >= pool->limit)
+		UIContext_flush_pixmap_pool(cx, pool->limit - 1);
+	pool->ent[pool->count].xid= xid;
+	pool->ent[pool->count].w= w;
+	pool->ent[pool->count].h= h;
+	pool->count++;
+}
+
+// Set the number of released targets to keep, 0 to disable the pool.
+void UIContext_set_pixmap_pool(UIContext *cx, int limit) {
+	if (limit < 0) limit= 0;
+	if (limit > UICONTEXT_PIXMAP_POOL_MAX) limit= UICONTEXT_PIXMAP_POOL_MAX;
+	UIContext_flush_pixmap_pool(cx, limit);
+	cx->pixmap_pool.limit= limit;
+}
+
+void UIContext_get_pixmap_pool_stats(UIContext *cx, int *count, int *limit, unsigned long *hits, unsigned long *misses) {
+	if (count)  *count= cx->pixmap_pool.count;
+	if (limit)  *limit= cx->pixmap_pool.limit;
+	if (hits)   *hits= cx->pixmap_pool.hits;
+	if (misses) *misses= cx->pixmap_pool.misses;
+}
+
+// Destroy the oldest pooled targets until at most 'keep' remain.  After a
+// fatal X error the server has already freed them.
+void UIContext_flush_pixmap_pool(UIContext *cx, int keep) {
+	UIContext_pixmap_pool *pool= &cx->pixmap_pool;
+	int n= pool->count - keep, i;
+	if (n <= 0) return;
+	if (!UIContext_X_Fatal)
+		for (i= 0; i < n; i++)
+			UIContext_destroy_pixmap(cx, pool->ent[i].xid);
+	pool->count= keep;
+	memmove(pool->ent, pool->ent + n, keep * sizeof(pool->ent[0]));
+}
+
+// Create a framebuffer object with one RGBA8 color renderbuffer, as the
+// headless equivalent of a GLX pixmap.  The FBO name is used as the "xid".
+int UIContext_create_fbo(UIContext *cx, int w, int h) {
+	GLuint fbo, rb, depth_rb= 0;
+	GLenum status;
+
+	UIContext_egl_make_current(cx);
+	if (!cx->fbo.GenFramebuffers)
+		croak("GL context does not support framebuffer objects");
+	cx->fbo.GenFramebuffers(1, &fbo);
+	cx->fbo.GenRenderbuffers(1, &rb);
+	cx->fbo.BindRenderbuffer(GL_RENDERBUFFER, rb);
+	cx->fbo.RenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+	cx->fbo.BindFramebuffer(GL_FRAMEBUFFER, fbo);
+	cx->fbo.FramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rb);
+	// Depth and stencil share one renderbuffer, as in the GLX visuals
+	if (cx->fb_prefs.depth || cx->fb_prefs.stencil) {
+		cx->fbo.GenRenderbuffers(1, &depth_rb);
+		cx->fbo.BindRenderbuffer(GL_RENDERBUFFER, depth_rb);
+		if (cx->fb_prefs.stencil) {
+			cx->fbo.RenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h);
+			cx->fbo.FramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
+		}
+		else {
+			cx->fbo.RenderbufferStorage(GL_RENDERBUFFER,
+				cx->fb_prefs.depth <= 16? GL_DEPTH_COMPONENT16
+				: cx->fb_prefs.depth <= 24? GL_DEPTH_COMPONENT24 : GL_DEPTH_COMPONENT32,
+				w, h);
+			cx->fbo.FramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
+		}
+	}
+	cx->fbo.BindRenderbuffer(GL_RENDERBUFFER, 0);
+	status= cx->fbo.CheckFramebufferStatus(GL_FRAMEBUFFER);
+	cx->fbo.BindFramebuffer(GL_FRAMEBUFFER, cx->target);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		cx->fbo.DeleteFramebuffers(1, &fbo);
+		cx->fbo.DeleteRenderbuffers(1, &rb);
+		if (depth_rb) cx->fbo.DeleteRenderbuffers(1, &depth_rb);
+		croak("Framebuffer object incomplete (0x%X)", (int) status);
+	}
+	return fbo;
+}
+
+void UIContext_destroy_fbo(UIContext *cx, GLuint fbo) {
+	GLint rb= 0, depth_rb= 0;
+	GLuint rb_name;
+	
+	if (!cx->egl_ctx) return; // destroyed along with the context
+	UIContext_egl_make_current(cx);
+	cx->fbo.BindFramebuffer(GL_FRAMEBUFFER, fbo);
+	cx->fbo.GetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &rb);
+	cx->fbo.GetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+		GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &depth_rb);
+	if (cx->target == fbo)
+		cx->target= None;
+	cx->fbo.BindFramebuffer(GL_FRAMEBUFFER, cx->target);
+	cx->fbo.DeleteFramebuffers(1, &fbo);
+	if (rb) {
+		rb_name= rb;
+		cx->fbo.DeleteRenderbuffers(1, &rb_name);
+	}
+	if (depth_rb) {
+		rb_name= depth_rb;
+		cx->fbo.DeleteRenderbuffers(1, &rb_name);
+	}
+}
+
+Window UIContext_create_window(UIContext *cx, int x, int y, int w, int h) {
+	int en_debug, en_trace;
+	Window wnd;
+	XSetWindowAttributes wndAttrs;
+	Colormap cmap;
+	Screen *s;
+	double t;
+
+	CROAK_IF_XLIB_FATAL();
+	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_X11(cx);
+	UICONTEXT_LOG_REQUEST(cx);
+
+	en_debug= log_debug_enabled();
+	en_trace= log_trace_enabled();
+
+	if (en_trace)
+		log_trace("calling XCreateColormap");
+	t= UIContext_monotonic_now();
+	cmap= XCreateColormap(cx->dpy, DefaultRootWindow(cx->dpy), cx->xvisi->visual, AllocNone);
+	if (!cmap)
+		croak("XCreateColormap failed");
+	UIContext_phase_done(cx, UICONTEXT_PHASE_XCREATECOLORMAP, t);
+
+	memset(&wndAttrs, 0, sizeof(wndAttrs));
+	wndAttrs.background_pixel= 0;
+	wndAttrs.border_pixel= 0;
+	wndAttrs.colormap= cmap;
+	wndAttrs.event_mask= ExposureMask; // | KeyPressMask;
+
+	if (en_debug)
+		log_debug("X11 screen is %dx%d", w, h);
+
+	// Default missing window dimensions to screen size
+	if (w <= 0 || h <= 0) {
+		if (!(s= DefaultScreenOfDisplay(cx->dpy))) {
+			XFreeColormap(cx->dpy, cmap);
+			croak("DefaultScreenOfDisplay failed");
+		}
+		
+		if (w <= 0) w= WidthOfScreen(s);
+		if (h <= 0) h= HeightOfScreen(s);
+	}
+	
+	if (en_trace)
 		log_trace("calling XCreateWindow( {%d,%d,%d,%d} )", x, y, w, h);
+	t= UIContext_monotonic_now();
 	wnd= XCreateWindow(cx->dpy, DefaultRootWindow(cx->dpy),
 		x, y, w, h, 0, cx->xvisi->depth,
 		InputOutput, cx->xvisi->visual,
@@ -389,6 +2754,7 @@ Window UIContext_create_window(UIContext *cx, int x, int y, int w, int h) {
 	XFreeColormap(cx->dpy, cmap);
 	if (!wnd)
 		croak("XCreateWindow failed");
+	UIContext_phase_done(cx, UICONTEXT_PHASE_XCREATEWINDOW, t);
 	
 	return wnd;
 }
@@ -396,7 +2762,10 @@ Window UIContext_create_window(UIContext *cx, int x, int y, int w, int h) {
 void UIContext_destroy_window(UIContext *cx, Window xid) {
 	CROAK_IF_XLIB_FATAL();
 	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_X11(cx);
+	UICONTEXT_LOG_REQUEST(cx);
 
+	UIContext_glx_forget_drawable(cx, xid);
 	XDestroyWindow(cx->dpy, xid);
 }
 
@@ -409,10 +2778,30 @@ void UIContext_get_window_rect(
 
 	CROAK_IF_XLIB_FATAL();
 	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_X11(cx);
+	UICONTEXT_LOG_REQUEST(cx);
 
 	XGetGeometry(cx->dpy, wnd, &root, x, y, width, height, &border, &depth);
 }
 
+// Read one pixel of what the X server shows in the window, which for a
+// 24-bit TrueColor visual is 0xRRGGBB.  One round trip; meant for tests.
+unsigned long UIContext_get_window_pixel(UIContext *cx, Window wnd, int x, int y) {
+	XImage *img;
+	unsigned long pixel;
+
+	CROAK_IF_XLIB_FATAL();
+	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_X11(cx);
+	UICONTEXT_LOG_REQUEST(cx);
+
+	if (!(img= XGetImage(cx->dpy, wnd, x, y, 1, 1, AllPlanes, ZPixmap)))
+		croak("XGetImage failed (is the window mapped, and the pixel inside it?)");
+	pixel= XGetPixel(img, 0, 0);
+	XDestroyImage(img);
+	return pixel;
+}
+
 void UIContext_window_set_blank_cursor(UIContext *cx, Window wnd) {
 	XColor black;
 	static char noData[] = { 0,0,0,0,0,0,0,0 };
@@ -421,6 +2810,8 @@ void UIContext_window_set_blank_cursor(UIContext *cx, Window wnd) {
 
 	CROAK_IF_XLIB_FATAL();
 	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_X11(cx);
+	UICONTEXT_LOG_REQUEST(cx);
 
 	black.red = black.green = black.blue = 0;
 	bitmapNoData= XCreateBitmapFromData(cx->dpy, wnd, noData, 8, 8);
@@ -434,36 +2825,13 @@ void UIContext_window_set_blank_cursor(UIContext *cx, Window wnd) {
 	XFreeCursor(cx->dpy, invisibleCursor);
 }
 
-void UIContext_XSetWMNormalHints(UIContext *cx, Window wnd, HV* hints) {
-	XSizeHints *sh;
-	SV** pval;
-	
-	sh= XAllocSizeHints();
-	if (!sh) croak("XAllocSizeHints failed");
-	#define LOADFIELD(field, bitflag) if (\
-		(pval= hv_fetch(hints, #field, strlen(#field), 0)) && SvOK(*pval) \
-		) { sh->flags |= bitflag; sh->field = SvIV(*pval); }
-	LOADFIELD(x,            PPosition);
-	LOADFIELD(y,            PPosition);
-	LOADFIELD(width,        PSize);
-	LOADFIELD(height,       PSize);
-	LOADFIELD(min_width,    PMinSize);
-	LOADFIELD(min_height,   PMinSize);
-	LOADFIELD(max_width,    PMaxSize);
-	LOADFIELD(max_height,   PMaxSize);
-	LOADFIELD(width_inc,    PResizeInc);
-	LOADFIELD(height_inc,   PResizeInc);
-	LOADFIELD(min_aspect.x, PAspect);
-	LOADFIELD(min_aspect.y, PAspect);
-	LOADFIELD(max_aspect.x, PAspect);
-	LOADFIELD(max_aspect.y, PAspect);
-	LOADFIELD(base_width,   PBaseSize);
-	LOADFIELD(base_height,  PBaseSize);
-	LOADFIELD(win_gravity,  PWinGravity);
-	#undef LOADFIELD
-	XSetWMNormalHints(cx->dpy, wnd, sh);
+void UIContext_XSetWMNormalHints(UIContext *cx, Window wnd, XSizeHints *hints) {
+	CROAK_IF_XLIB_FATAL();
+	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_X11(cx);
+	UICONTEXT_LOG_REQUEST(cx);
+	XSetWMNormalHints(cx->dpy, wnd, hints);
 	// any error is asynchronous
-	XFree(sh);
 }
 
 static Bool WaitForWndMapped( Display *dpy, XEvent *event, XPointer arg ) {
@@ -474,74 +2842,649 @@ static Bool WaitForWndMapped( Display *dpy, XEvent *event, XPointer arg ) {
 }
 void UIContext_XMapWindow(UIContext *cx, Window wnd, int wait_msec) {
 	XEvent event;
+	double t;
 	
 	CROAK_IF_XLIB_FATAL();
 	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_X11(cx);
 	CROAK_IF_NO_GLCONTEXT(cx);
+	UICONTEXT_LOG_REQUEST(cx);
 	
+	t= UIContext_monotonic_now();
 	XMapWindow(cx->dpy, wnd);
 	if (wait_msec) {
 		if (!UIContext_wait_event(cx, &event, WaitForWndMapped, (XPointer) wnd, wait_msec))
 			croak("Did not receive X11 MapNotify event");
 	}
+	UIContext_phase_done(cx, UICONTEXT_PHASE_XMAPWINDOW, t);
 }
 
 void UIContext_glXSwapBuffers(UIContext *cx) {
 	CROAK_IF_XLIB_FATAL();
 	CROAK_IF_NO_DISPLAY(cx);
 	CROAK_IF_NO_TARGET(cx);
+	UICONTEXT_LOG_REQUEST(cx);
+
+	UIContext_stream_frame_end(cx);
+	// Nothing to present on a framebuffer object; just push the commands out
+	if (cx->backend == UICONTEXT_BACKEND_EGL) {
+		cx->gl.Flush();
+		return;
+	}
+	// The pixels are the output, so they need to be complete when this returns
+	if (cx->backend == UICONTEXT_BACKEND_OSMESA) {
+		cx->gl.Finish();
+		return;
+	}
+	if (cx->backend == UICONTEXT_BACKEND_XSHM) {
+		UIContext_xshm_present(cx, NULL, 0);
+		return;
+	}
+
+	// A single-buffered window is already showing what was drawn
+	if (cx->fb_prefs.single_buffer)
+		cx->gl.Flush();
+	else {
+		glXSwapBuffers(cx->dpy, cx->target);
+		UIContext_damage_note_present(cx, 1);
+	}
+}
+
+// Like glXSwapBuffers, but only the 'n' rectangles (x, y, w, h in GL
+// coordinates, origin at the bottom left) in 'rects' have changed.  GLX
+// copies just those from the back buffer with glXCopySubBufferMESA, which
+// leaves the back buffer as it is, and XShm sends just those parts of the
+// image.  Without GLX_MESA_copy_sub_buffer, or with n == 0, the whole frame
+// is presented.  Use UIContext_buffer_age to find what has to be redrawn.
+void UIContext_swap_buffers_damage(UIContext *cx, const int *rects, int n) {
+	int i;
+
+	if (n <= 0 || cx->backend == UICONTEXT_BACKEND_EGL || cx->backend == UICONTEXT_BACKEND_OSMESA
+		|| (cx->backend == UICONTEXT_BACKEND_GLX && (cx->fb_prefs.single_buffer || !cx->glx.CopySubBufferMESA))
+	) {
+		UIContext_glXSwapBuffers(cx);
+		return;
+	}
+	CROAK_IF_XLIB_FATAL();
+	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_TARGET(cx);
+
+	UIContext_stream_frame_end(cx);
+	if (cx->backend == UICONTEXT_BACKEND_XSHM) {
+		UIContext_xshm_present(cx, rects, n);
+		return;
+	}
+	UICONTEXT_LOG_REQUEST(cx);
+	for (i= 0; i < n; i++)
+		if (rects[i*4+2] > 0 && rects[i*4+3] > 0)
+			cx->glx.CopySubBufferMESA(cx->dpy, cx->target, rects[i*4], rects[i*4+1], rects[i*4+2], rects[i*4+3]);
+	UIContext_damage_note_present(cx, 0);
+	cx->present_partial_count++;
+}
+
+// Intersect the x, y, w, h in 'rect' with a max_w x max_h target, and return
+// whether anything is left
+static int UIContext_clip_rect(const int *rect, int max_w, int max_h, int *x, int *y, int *w, int *h) {
+	int x1= rect[0] + rect[2], y1= rect[1] + rect[3];
+	*x= rect[0] < 0? 0 : rect[0];
+	*y= rect[1] < 0? 0 : rect[1];
+	*w= (x1 > max_w? max_w : x1) - *x;
+	*h= (y1 > max_h? max_h : y1) - *y;
+	return *w > 0 && *h > 0;
+}
+
+// Record a full swap or a partial copy of the target window, for buffer_age
+static void UIContext_damage_note_present(UIContext *cx, int full) {
+	UIContext_damage_state *d= &cx->damage;
+	if (d->wnd != cx->target) {
+		memset(d, 0, sizeof(*d));
+		d->wnd= cx->target;
+	}
+	d->frames++;
+	d->partial= !full;
+	if (full)
+		d->swap_frame[++d->swaps % UICONTEXT_SWAP_HISTORY]= d->frames;
+}
+
+// How many presents ago the current contents of the target's back buffer
+// were presented: 1 if it holds the last frame, 2 if the one before, etc.
+// Everything damaged in that many frames (this one included) has to be
+// redrawn.  0 means the contents are unknown and all of it must be drawn.
+int UIContext_buffer_age(UIContext *cx) {
+	UIContext_damage_state *d= &cx->damage;
+	unsigned int age= 0;
+	unsigned long swap;
+
+	CROAK_IF_XLIB_FATAL();
+	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_TARGET(cx);
+	switch (cx->backend) {
+	case UICONTEXT_BACKEND_EGL:
+	case UICONTEXT_BACKEND_OSMESA:
+		// Offscreen targets are never swapped
+		return 1;
+	case UICONTEXT_BACKEND_XSHM:
+		if (!cx->shm.presented[cx->shm.back])
+			return 0;
+		return cx->shm.frames - cx->shm.presented[cx->shm.back] + 1;
+	}
+	if (cx->fb_prefs.single_buffer)
+		return 1;
+	if (d->wnd != cx->target || !d->frames)
+		return 0;
+	if (d->partial)
+		return 1;
+	if (!UIContext_has_glx_ext(cx, UICONTEXT_GLX_EXT_buffer_age))
+		return 0;
+	UICONTEXT_LOG_REQUEST(cx);
+	glXQueryDrawable(cx->dpy, cx->target, GLX_BACK_BUFFER_AGE_EXT, &age);
+	// GLX counts full swaps; the buffer was last shown 'age'-1 swaps ago
+	if (!age || age > d->swaps || age >= UICONTEXT_SWAP_HISTORY)
+		return 0;
+	swap= d->swaps - (age - 1);
+	return d->frames - d->swap_frame[swap % UICONTEXT_SWAP_HISTORY] + 1;
+}
 
-	glXSwapBuffers(cx->dpy, cx->target);
-}
-
-void UIContext_get_xlib_error_codes(HV* dest) {
-	#define E(x) hv_stores(dest, #x, newSViv(x));
-	E(BadAccess)
-	E(BadAlloc)
-	E(BadAtom)
-	E(BadColor)
-	E(BadCursor)
-	E(BadDrawable)
-	E(BadFont)
-	E(BadGC)
-	E(BadIDChoice)
-	E(BadImplementation)
-	E(BadLength)
-	E(BadMatch)
-	E(BadName)
-	E(BadPixmap)
-	E(BadRequest)
-	E(BadValue)
-	E(BadWindow)
-	#undef E
+// End a frame in one call: swap, optionally collect GL errors and flush the
+// X11 connection, and record the timing.  Returns the UICONTEXT_PRESENT_ERR_*
+// bits of any GL errors seen, so the caller only has more work to do when
+// something went wrong.
+int UIContext_present(UIContext *cx, int flags) {
+	return UIContext_present_damage(cx, flags, NULL, 0);
+}
+
+// UIContext_present, showing only the damaged rectangles (see
+// UIContext_swap_buffers_damage)
+int UIContext_present_damage(UIContext *cx, int flags, const int *rects, int n) {
+	double start, end;
+	int status= 0;
+	GLenum err;
+	
+	start= UIContext_monotonic_now();
+	UIContext_swap_buffers_damage(cx, rects, n);
+	if (flags & UICONTEXT_PRESENT_CHECK_ERRORS) {
+		while ((err= cx->gl.GetError()) != GL_NO_ERROR) {
+			switch (err) {
+			case GL_INVALID_ENUM:      status |= UICONTEXT_PRESENT_ERR_INVALID_ENUM; break;
+			case GL_INVALID_VALUE:     status |= UICONTEXT_PRESENT_ERR_INVALID_VALUE; break;
+			case GL_INVALID_OPERATION: status |= UICONTEXT_PRESENT_ERR_INVALID_OPERATION; break;
+			case GL_STACK_OVERFLOW:    status |= UICONTEXT_PRESENT_ERR_STACK_OVERFLOW; break;
+			case GL_STACK_UNDERFLOW:   status |= UICONTEXT_PRESENT_ERR_STACK_UNDERFLOW; break;
+			case GL_OUT_OF_MEMORY:     status |= UICONTEXT_PRESENT_ERR_OUT_OF_MEMORY; break;
+			case GL_INVALID_FRAMEBUFFER_OPERATION:
+			                           status |= UICONTEXT_PRESENT_ERR_INVALID_FRAMEBUFFER_OPERATION; break;
+			// A lost context can return this forever; don't spin on it
+			default:                   status |= UICONTEXT_PRESENT_ERR_OTHER; goto errors_done;
+			}
+		}
+		errors_done: ;
+	}
+	if ((flags & UICONTEXT_PRESENT_FLUSH) && cx->dpy)
+		XFlush(cx->dpy);
+	if (cx->debug_ring && UIContext_debug_pending(cx))
+		status |= UICONTEXT_PRESENT_DEBUG_PENDING;
+	if (UIContext_x_errors_pending())
+		status |= UICONTEXT_PRESENT_X_ERRORS;
+	end= UIContext_monotonic_now();
+	
+	cx->present_interval= cx->present_count? start - cx->present_start : 0;
+	cx->present_start= start;
+	cx->present_duration= end - start;
+	cx->present_count++;
+	return status;
+}
+
+/*
+
+Projection.  The viewport and frustum defaults are resolved, and the
+equivalent of glFrustum followed by glTranslated is computed here, so that
+project_frustum loads it with one glLoadMatrixd, or hands it to a shader.
+
+*/
+
+// Resolve the defaults in 'p' against the size of the target, and store the
+// column-major projection matrix in 'm'
+void UIContext_frustum_matrix(UIContext_projection *p, int target_w, int target_h, double m[16]) {
+	double l, r, b, t, n, f;
+
+	if (!p->w) p->w= target_w - p->x;
+	if (!p->h) p->h= target_h - p->y;
+	if (p->w <= 0 || p->h <= 0)
+		croak("Viewport has no area (%dx%d)", p->w, p->h);
+	// Measure the viewport from the opposite side of the target if mirrored
+	if (p->x && p->mirror_x) p->x= target_w - p->w - p->x;
+	if (p->y && p->mirror_y) p->y= target_h - p->h - p->y;
+	
+	// Missing dimensions of the frustum come from the viewport's aspect ratio
+	if (!p->fw) {
+		if (!p->fh) p->fh= 1;
+		p->fw= p->pixel_aspect * p->fh * ((double) p->w / p->h);
+	}
+	else if (!p->fh)
+		p->fh= p->fw * ((double) p->h / p->w) / p->pixel_aspect;
+	if (isnan(p->fx)) p->fx= p->fw * -.5;
+	if (isnan(p->fy)) p->fy= p->fh * -.5;
+	
+	l= p->mirror_x? p->fx + p->fw : p->fx;
+	r= p->mirror_x? p->fx : p->fx + p->fw;
+	b= p->mirror_y? p->fy + p->fh : p->fy;
+	t= p->mirror_y? p->fy : p->fy + p->fh;
+	n= 1;
+	f= p->depth * 2;
+	
+	// glFrustum(l, r, b, t, n, f) * glTranslated(0, 0, -depth)
+	memset(m, 0, sizeof(double) * 16);
+	m[0]=  2 * n / (r - l);
+	m[5]=  2 * n / (t - b);
+	m[8]=  (r + l) / (r - l);
+	m[9]=  (t + b) / (t - b);
+	m[10]= -(f + n) / (f - n);
+	m[11]= -1;
+	m[12]= -p->depth * m[8];
+	m[13]= -p->depth * m[9];
+	m[14]= -p->depth * m[10] - 2 * f * n / (f - n);
+	m[15]= p->depth;
+}
+
+// Apply the viewport, projection and winding order from UIContext_frustum_matrix.
+// Core profiles have no matrix stack, so only the viewport and winding are set.
+void UIContext_project_frustum(UIContext *cx, UIContext_projection *p, const double m[16]) {
+	CROAK_IF_NO_GLCONTEXT(cx);
+	CROAK_IF_NO_TARGET(cx);
+	
+	cx->gl.Viewport(p->x, p->y, p->w, p->h);
+	if (!UIContext_gl_is_core(cx) && cx->gl.LoadMatrixd) {
+		cx->gl.MatrixMode(GL_PROJECTION);
+		cx->gl.LoadMatrixd(m);
+		cx->gl.MatrixMode(GL_MODELVIEW);
+	}
+	// If mirror is in effect, need to tell OpenGL which way the camera is
+	cx->gl.FrontFace(p->mirror_x == p->mirror_y? GL_CCW : GL_CW);
+}
+
+/*
+
+GL debug output.  Instead of polling glGetError every frame, the GL reports
+errors (and warnings about performance or deprecated usage) to a callback,
+which copies them into a ring buffer.  UIContext_present only has to look
+at the ring to know if there is anything to report, and the Perl side then
+drains the messages to Log::Any in one batch.
+
+*/
+
+const char *UIContext_debug_source_name(GLenum source) {
+	switch (source) {
+	case GL_DEBUG_SOURCE_API:             return "API";
+	case GL_DEBUG_SOURCE_WINDOW_SYSTEM:   return "Window System";
+	case GL_DEBUG_SOURCE_SHADER_COMPILER: return "Shader Compiler";
+	case GL_DEBUG_SOURCE_THIRD_PARTY:     return "Third Party";
+	case GL_DEBUG_SOURCE_APPLICATION:     return "Application";
+	default:                              return "Other";
+	}
+}
+
+const char *UIContext_debug_type_name(GLenum type) {
+	switch (type) {
+	case GL_DEBUG_TYPE_ERROR:               return "Error";
+	case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "Deprecated Behavior";
+	case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  return "Undefined Behavior";
+	case GL_DEBUG_TYPE_PORTABILITY:         return "Portability";
+	case GL_DEBUG_TYPE_PERFORMANCE:         return "Performance";
+	case GL_DEBUG_TYPE_MARKER:              return "Marker";
+	case GL_DEBUG_TYPE_PUSH_GROUP:          return "Push Group";
+	case GL_DEBUG_TYPE_POP_GROUP:           return "Pop Group";
+	default:                                return "Other";
+	}
+}
+
+const char *UIContext_debug_severity_name(GLenum severity) {
+	switch (severity) {
+	case GL_DEBUG_SEVERITY_HIGH:   return "high";
+	case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+	case GL_DEBUG_SEVERITY_LOW:    return "low";
+	default:                       return "notification";
+	}
+}
+
+// Called by the GL, possibly from a driver thread.  Must not touch Perl.
+static void APIENTRY UIContext_debug_callback(
+	GLenum source, GLenum type, GLuint id, GLenum severity,
+	GLsizei length, const GLchar *message, const void *userParam
+) {
+	UIContext_debug_ring *ring= (UIContext_debug_ring*) userParam;
+	UIContext_debug_msg *slot;
+	unsigned pos, seq;
+	
+	pos= __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	for (;;) {
+		slot= &ring->msg[pos & (UICONTEXT_DEBUG_RING_SIZE-1)];
+		seq= __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&ring->head, &pos, pos+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if ((int)(seq - pos) < 0) {
+			// Full; the reader hasn't released this slot yet
+			__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		else
+			pos= __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	}
+	slot->source= source;
+	slot->type= type;
+	slot->id= id;
+	slot->severity= severity;
+	if (length < 0) length= strlen(message);
+	if (length >= UICONTEXT_DEBUG_MSG_MAX) length= UICONTEXT_DEBUG_MSG_MAX-1;
+	memcpy(slot->text, message, length);
+	slot->text[length]= '\0';
+	__atomic_store_n(&slot->seq, pos+1, __ATOMIC_RELEASE);
+}
+
+void UIContext_set_gl_debug(UIContext *cx, int enable) {
+	int i;
+	if (enable && !cx->debug_ring) {
+		if (!(cx->debug_ring= (UIContext_debug_ring*) calloc(1, sizeof(UIContext_debug_ring))))
+			croak("Can't allocate GL debug message buffer");
+		for (i= 0; i < UICONTEXT_DEBUG_RING_SIZE; i++)
+			cx->debug_ring->msg[i].seq= i;
+	}
+	cx->gl_debug= enable;
+	// Takes effect at the next make-current if the context is not current.
+	// Removing it switches to this context for a moment if needed.
+	if (enable && !cx->gl_debug_installed) {
+		if (cx->target && UIContext_current.cx == cx)
+			UIContext_install_debug_callback(cx);
+	}
+	else if (!enable)
+		UIContext_remove_debug_callback(cx);
+}
+
+// Parse GL_VERSION of the current context, which starts with "major.minor"
+int UIContext_gl_version_at_least(UIContext *cx, int major, int minor) {
+	const char *version= (const char*) cx->gl.GetString(GL_VERSION);
+	int have_major= 0, have_minor= 0;
+	if (!version || sscanf(version, "%d.%d", &have_major, &have_minor) < 2)
+		return 0;
+	return have_major > major || (have_major == major && have_minor >= minor);
+}
+
+// Whether the current context is a core profile.  Asking for version 3.2 or
+// later without naming a profile gets a core one too, so ask the context.
+int UIContext_gl_is_core(UIContext *cx) {
+	GLint mask= 0;
+	if (cx->ctx_attrs.profile == UICONTEXT_PROFILE_CORE)
+		return 1;
+	if (cx->ctx_attrs.profile || !UIContext_gl_version_at_least(cx, 3, 2))
+		return 0;
+	cx->gl.GetIntegerv(GL_CONTEXT_PROFILE_MASK, &mask);
+	return (mask & GL_CONTEXT_CORE_PROFILE_BIT) != 0;
+}
+
+// Core profiles can only list extensions one at a time, with glGetStringi
+int UIContext_has_gl_extension(UIContext *cx, const char *name) {
+	PFNGLGETSTRINGIPROC get_stringi;
+	const char *ext, *p;
+	size_t len= strlen(name);
+	GLint i, n= 0;
+	
+	if (UIContext_gl_is_core(cx)) {
+		if (!(get_stringi= (PFNGLGETSTRINGIPROC) UIContext_get_proc_address(cx, "glGetStringi")))
+			return 0;
+		cx->gl.GetIntegerv(GL_NUM_EXTENSIONS, &n);
+		for (i= 0; i < n; i++)
+			if ((ext= (const char*) get_stringi(GL_EXTENSIONS, i)) && strcmp(ext, name) == 0)
+				return 1;
+		return 0;
+	}
+	if (!(ext= (const char*) cx->gl.GetString(GL_EXTENSIONS)))
+		return 0;
+	for (p= ext; (p= strstr(p, name)); p+= len)
+		if ((p == ext || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+			return 1;
+	return 0;
+}
+
+// Requires the context to be current
+void UIContext_install_debug_callback(UIContext *cx) {
+	PFNGLDEBUGMESSAGECALLBACKPROC debug_message_callback= NULL;
+	
+	if (UIContext_gl_version_at_least(cx, 4, 3) || UIContext_has_gl_extension(cx, "GL_KHR_debug"))
+		debug_message_callback= (PFNGLDEBUGMESSAGECALLBACKPROC) UIContext_get_proc_address(cx, "glDebugMessageCallback");
+	// Only try once per context either way
+	cx->gl_debug_installed= 1;
+	if (!debug_message_callback) {
+		log_info("GL_KHR_debug is not supported; GL debug messages are unavailable");
+		return;
+	}
+	debug_message_callback(UIContext_debug_callback, cx->debug_ring);
+	cx->gl.Enable(GL_DEBUG_OUTPUT);
+	log_debug("Installed GL debug message callback");
+}
+
+void UIContext_remove_debug_callback(UIContext *cx) {
+	PFNGLDEBUGMESSAGECALLBACKPROC debug_message_callback;
+	
+	UIContext_gl_cleanup save;
+	
+	// Only ever on this context, even if another one is current
+	if (cx->gl_debug_installed && UIContext_gl_cleanup_begin(cx, &save)) {
+		debug_message_callback= (PFNGLDEBUGMESSAGECALLBACKPROC) UIContext_get_proc_address(cx, "glDebugMessageCallback");
+		if (debug_message_callback) {
+			cx->gl.Disable(GL_DEBUG_OUTPUT);
+			debug_message_callback(NULL, NULL);
+		}
+		UIContext_gl_cleanup_end(cx, &save);
+	}
+	cx->gl_debug_installed= 0;
+}
+
+int UIContext_debug_pending(UIContext *cx) {
+	UIContext_debug_ring *ring= cx->debug_ring;
+	return __atomic_load_n(&ring->msg[ring->tail & (UICONTEXT_DEBUG_RING_SIZE-1)].seq, __ATOMIC_ACQUIRE) == ring->tail+1
+		|| __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
+
+// Copy the oldest message out of the ring, and free its slot.  Returns 0 if
+// there are none.
+int UIContext_next_debug_message(UIContext *cx, UIContext_debug_msg *msg) {
+	UIContext_debug_ring *ring= cx->debug_ring;
+	UIContext_debug_msg *slot;
+	
+	if (!ring) return 0;
+	slot= &ring->msg[ring->tail & (UICONTEXT_DEBUG_RING_SIZE-1)];
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring->tail+1)
+		return 0;
+	memcpy(msg, slot, sizeof(*msg));
+	// Hand the slot back to the producers for the next lap of the ring
+	__atomic_store_n(&slot->seq, ring->tail + UICONTEXT_DEBUG_RING_SIZE, __ATOMIC_RELEASE);
+	ring->tail++;
+	return 1;
+}
+
+// Number of messages dropped because the ring was full, since the last call
+unsigned UIContext_debug_dropped(UIContext *cx) {
+	return cx->debug_ring? __atomic_exchange_n(&cx->debug_ring->dropped, 0, __ATOMIC_RELAXED) : 0;
 }
 
 int UIContext_X_error_handler(Display *d, XErrorEvent *e) {
-	log_debug("XLib non-fatal error handler triggered");
-	dSP;
-	ENTER;
-	SAVETMPS;
-	PUSHMARK(SP);
-	EXTEND(SP, 1);
-	
-	// Convert the XErrorEvent to a hashref
-	HV* err= newHV();
-	hv_stores(err, "type",         newSViv((int) e->type));
-	hv_stores(err, "display",      newSVpvf("%p", (void*) e->display));
-	hv_stores(err, "serial",       newSViv((int) e->serial));
-	hv_stores(err, "error_code",   newSViv((int) e->error_code));
-	hv_stores(err, "request_code", newSViv((int) e->request_code));
-	hv_stores(err, "minor_code",   newSViv((int) e->minor_code));
-	hv_stores(err, "resourceid",   newSViv((int) e->resourceid));
-	
-	PUSHs(sv_2mortal(newRV_noinc((SV*)err)));
-	PUTBACK;
-	call_pv("X11::MinimalOpenGLContext::_X11_error", G_VOID|G_DISCARD|G_EVAL|G_KEEPERR);
-	FREETMPS;
-	LEAVE;
+	UIContext_x_error *q= UIContext_x_errors.err;
+	int i, n= UIContext_x_errors.count;
+	
+	const char *op= UIContext_request_op(e->display, e->serial);
+	
+	for (i= 0; i < n; i++) {
+		if (q[i].dpy == e->display && q[i].op == op && q[i].error_code == e->error_code
+			&& q[i].request_code == e->request_code && q[i].minor_code == e->minor_code
+		) {
+			q[i].serial= e->serial;
+			q[i].resourceid= e->resourceid;
+			q[i].count++;
+			return 0;
+		}
+	}
+	if (n >= UICONTEXT_X_ERROR_QUEUE_SIZE) {
+		UIContext_x_errors.dropped++;
+		return 0;
+	}
+	q[n].dpy=          e->display;
+	q[n].op=           op;
+	q[n].first_serial= e->serial;
+	q[n].serial=       e->serial;
+	q[n].error_code=   e->error_code;
+	q[n].request_code= e->request_code;
+	q[n].minor_code=   e->minor_code;
+	q[n].resourceid=   e->resourceid;
+	q[n].count=        1;
+	UIContext_x_errors.count= n+1;
 	return 0;
 }
 
+int UIContext_x_errors_pending() {
+	return UIContext_x_errors.count || UIContext_x_errors.dropped;
+}
+
+// Move the queued X errors into 'dest' (which has room for
+// UICONTEXT_X_ERROR_QUEUE_SIZE), oldest first, and return how many there
+// were.  'dropped' receives the number lost because the queue was full.
+int UIContext_take_x_errors(UIContext_x_error *dest, unsigned *dropped) {
+	int n= UIContext_x_errors.count;
+	memcpy(dest, UIContext_x_errors.err, n * sizeof(*dest));
+	UIContext_x_errors.count= 0;
+	*dropped= UIContext_x_errors.dropped;
+	UIContext_x_errors.dropped= 0;
+	return n;
+}
+
+// Remove the queued errors of requests with major opcode 'major' sent since
+// 'serial', and return how many there were.  For requests whose failure is
+// expected and handled, after an XSync.
+int UIContext_take_request_errors(Display *dpy, unsigned long serial, int major) {
+	UIContext_x_error *q= UIContext_x_errors.err;
+	int i, n= 0, found= 0;
+	for (i= 0; i < UIContext_x_errors.count; i++) {
+		if (q[i].dpy == dpy && q[i].request_code == major && q[i].serial >= serial)
+			found += q[i].count;
+		else
+			q[n++]= q[i];
+	}
+	UIContext_x_errors.count= n;
+	return found;
+}
+
+// Forget errors for a display that is being closed, so they can't be
+// mistaken for errors of a later connection at the same address.
+void UIContext_discard_x_errors(Display *dpy) {
+	UIContext_x_error *q= UIContext_x_errors.err;
+	int i, n= 0;
+	for (i= 0; i < UIContext_x_errors.count; i++)
+		if (q[i].dpy != dpy)
+			q[n++]= q[i];
+	UIContext_x_errors.count= n;
+}
+
+void UIContext_log_request(Display *dpy, const char *op) {
+	struct UIContext_request_log *log= &UIContext_requests;
+	unsigned long serial= NextRequest(dpy);
+	UIContext_request_ent *prev= &log->ent[(log->next - 1) % UICONTEXT_REQUEST_LOG_SIZE];
+	// Nothing was sent since the last entry, so it can't be blamed for anything
+	if (prev->dpy == dpy && prev->serial == serial) {
+		prev->op= op;
+		return;
+	}
+	prev= &log->ent[log->next++ % UICONTEXT_REQUEST_LOG_SIZE];
+	prev->dpy= dpy;
+	prev->serial= serial;
+	prev->op= op;
+}
+
+// Find the function that sent request 'serial', or NULL if it has fallen
+// out of the log.  Serials only increase per display, so the newest entry
+// at or below it is the one.
+const char *UIContext_request_op(Display *dpy, unsigned long serial) {
+	struct UIContext_request_log *log= &UIContext_requests;
+	UIContext_request_ent *ent;
+	unsigned i;
+	for (i= 1; i <= UICONTEXT_REQUEST_LOG_SIZE; i++) {
+		ent= &log->ent[(log->next - i) % UICONTEXT_REQUEST_LOG_SIZE];
+		if (!ent->dpy) break;
+		if (ent->dpy == dpy && ent->serial <= serial)
+			return ent->op;
+	}
+	return NULL;
+}
+
+static size_t UIContext_dpy_hash(Display *dpy) {
+	// allocations are at least 16-byte aligned, and the high bits mix better
+	return (size_t) ((((uintptr_t) dpy) >> 4) * (uintptr_t) 0x9E3779B97F4A7C15ULL >> 16);
+}
+
+UIContext *UIContext_dpy_map_get(Display *dpy) {
+	UIContext_dpy_map_ent *ent= UIContext_dpy_map.ent;
+	size_t i;
+	if (!ent) return NULL;
+	for (i= UIContext_dpy_hash(dpy) & UIContext_dpy_map.mask; ent[i].dpy; i= (i+1) & UIContext_dpy_map.mask)
+		if (ent[i].dpy == dpy)
+			return ent[i].cx;
+	return NULL;
+}
+
+void UIContext_dpy_map_put(Display *dpy, UIContext *cx) {
+	struct UIContext_dpy_map *m= &UIContext_dpy_map;
+	UIContext_dpy_map_ent *old= m->ent, *ent;
+	size_t i, j, old_cap= old? m->mask+1 : 0;
+	
+	if ((m->count+1) * 2 > old_cap) {
+		size_t cap= old_cap? old_cap * 2 : 16;
+		if (!(ent= (UIContext_dpy_map_ent*) calloc(cap, sizeof(*ent))))
+			croak("Out of memory");
+		m->ent= ent;
+		m->mask= cap-1;
+		for (j= 0; j < old_cap; j++) {
+			if (!old[j].dpy) continue;
+			for (i= UIContext_dpy_hash(old[j].dpy) & m->mask; ent[i].dpy; i= (i+1) & m->mask);
+			ent[i]= old[j];
+		}
+		free(old);
+	}
+	for (i= UIContext_dpy_hash(dpy) & m->mask; m->ent[i].dpy; i= (i+1) & m->mask) {
+		if (m->ent[i].dpy == dpy) {
+			m->ent[i].cx= cx;
+			return;
+		}
+	}
+	m->ent[i].dpy= dpy;
+	m->ent[i].cx= cx;
+	m->count++;
+}
+
+void UIContext_dpy_map_del(Display *dpy) {
+	struct UIContext_dpy_map *m= &UIContext_dpy_map;
+	size_t i, j, home;
+	if (!m->ent) return;
+	for (i= UIContext_dpy_hash(dpy) & m->mask; m->ent[i].dpy != dpy; i= (i+1) & m->mask)
+		if (!m->ent[i].dpy)
+			return;
+	// Shift back any later entries of the probe run that the gap would hide
+	for (j= (i+1) & m->mask; m->ent[j].dpy; j= (j+1) & m->mask) {
+		home= UIContext_dpy_hash(m->ent[j].dpy) & m->mask;
+		if (((j - home) & m->mask) >= ((j - i) & m->mask)) {
+			m->ent[i]= m->ent[j];
+			i= j;
+		}
+	}
+	m->ent[i].dpy= NULL;
+	m->ent[i].cx= NULL;
+	m->count--;
+}
+
+// Called from the Xlib I/O error handler, before croak.  Xlib can't be used
+// again after that, so this should arrange for the program to shut down.
+void UIContext_set_fatal_handler(void (*handler)(void)) {
+	UIContext_X_fatal_handler= handler;
+}
+
 /*
 
 What a mess.   So XLib has a stupid design where they forcibly abort the
@@ -560,9 +3503,8 @@ int UIContext_X_IO_error_handler(Display *d) {
 	int i;
 	UIContext_X_Fatal= 1; // prevent UIContexts from calling back into XLib
 	log_debug("XLib fatal error handler triggered");
-	dSP;
-	PUSHMARK(SP);
-	call_pv("X11::MinimalOpenGLContext::_X11_error_fatal", G_VOID|G_DISCARD|G_NOARGS|G_EVAL|G_KEEPERR);
+	if (UIContext_X_fatal_handler)
+		UIContext_X_fatal_handler();
 	croak("Fatal X11 I/O Error"); // longjmp past XLib, which wants to kill us
 	return 0;
 }
@@ -0,0 +1,167 @@
+// Public interface of uicontext.c, for using it as a C library without perl.
+//
+// The .xs includes uicontext.c (and with it, this file) directly, and
+// provides perl's croak and Log::Any for the log_* functions.  When built on
+// its own (see libuicontext.c), errors print to stderr and exit, logging goes
+// to stderr when UICONTEXT_DEBUG is set in the environment, and fatal X11
+// errors can be observed with UIContext_set_fatal_handler.
+
+#ifndef UICONTEXT_H
+#define UICONTEXT_H
+
+#include <stddef.h>
+#include <GL/gl.h>
+#include <GL/glx.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+typedef struct UIContext UIContext;
+
+// A UIContext renders through one of these, chosen at connect time.
+enum UIContext_backend {
+	UICONTEXT_BACKEND_GLX= 0, // X11 display with GLX windows and pixmaps
+	UICONTEXT_BACKEND_EGL,    // headless EGL with framebuffer objects as targets
+	UICONTEXT_BACKEND_OSMESA, // software rendering directly into process memory
+	UICONTEXT_BACKEND_XSHM,   // OSMesa rendering, presented to X11 windows with MIT-SHM
+	UICONTEXT_BACKEND_COUNT
+};
+
+// OpenGL profile requested by set_context_attribs
+enum UIContext_profile {
+	UICONTEXT_PROFILE_DEFAULT= 0,
+	UICONTEXT_PROFILE_CORE,
+	UICONTEXT_PROFILE_COMPAT,
+	UICONTEXT_PROFILE_COUNT
+};
+
+// Parameters of project_frustum.  Unset fields are filled in with the
+// defaults by UIContext_frustum_matrix.
+typedef struct UIContext_projection {
+	int          x, y, w, h;     // viewport; w and h of 0 extend to the edge of the target
+	double       fx, fy;         // frustum corner at the focal plane; NAN to center it
+	double       fw, fh;         // frustum size at the focal plane; 0 to match the viewport aspect
+	double       pixel_aspect;   // physical width / height of a screen pixel
+	double       depth;          // distance from the camera to the focal plane
+	int          mirror_x, mirror_y;
+} UIContext_projection;
+
+// Flags for UIContext_present
+#define UICONTEXT_PRESENT_CHECK_ERRORS 0x01 // drain glGetError after the swap
+#define UICONTEXT_PRESENT_FLUSH        0x02 // XFlush so the swap request reaches the server now
+
+// Also set in the return value of UIContext_present if GL debug messages
+// or X errors are waiting
+#define UICONTEXT_PRESENT_DEBUG_PENDING 0x100
+#define UICONTEXT_PRESENT_X_ERRORS      0x200
+
+// UIContext_present returns 0, or a bit for each distinct GL error seen
+#define UICONTEXT_PRESENT_ERR_INVALID_ENUM      0x01
+#define UICONTEXT_PRESENT_ERR_INVALID_VALUE     0x02
+#define UICONTEXT_PRESENT_ERR_INVALID_OPERATION 0x04
+#define UICONTEXT_PRESENT_ERR_STACK_OVERFLOW    0x08
+#define UICONTEXT_PRESENT_ERR_STACK_UNDERFLOW   0x10
+#define UICONTEXT_PRESENT_ERR_OUT_OF_MEMORY     0x20
+#define UICONTEXT_PRESENT_ERR_INVALID_FRAMEBUFFER_OPERATION 0x40
+#define UICONTEXT_PRESENT_ERR_OTHER             0x80
+
+// A message from glDebugMessageCallback, as returned by
+// UIContext_next_debug_message
+#define UICONTEXT_DEBUG_MSG_MAX   248
+typedef struct UIContext_debug_msg {
+	unsigned     seq;     // internal to the queue
+	GLenum       source, type, severity;
+	GLuint       id;
+	char         text[UICONTEXT_DEBUG_MSG_MAX];
+} UIContext_debug_msg;
+
+// A non-fatal X error, as returned by UIContext_take_x_errors.  Repeats of
+// the same error from the same operation are counted in one of these.
+#define UICONTEXT_X_ERROR_QUEUE_SIZE 64
+typedef struct UIContext_x_error {
+	Display       *dpy;
+	const char    *op; // UIContext function that sent the failing request
+	unsigned long  first_serial, serial;
+	unsigned char  error_code, request_code, minor_code;
+	XID            resourceid; // of the most recent one
+	unsigned       count;
+} UIContext_x_error;
+
+// A count of one type of server-side resource, from UIContext_client_resources
+#define UICONTEXT_RESOURCE_TYPES_MAX 64
+typedef struct UIContext_resource_count {
+	char          name[32]; // X atom naming the type, like "WINDOW" or "PIXMAP"
+	unsigned int  count;
+} UIContext_resource_count;
+
+// Lifecycle
+UIContext *UIContext_new();
+void UIContext_free(UIContext *cx);
+void UIContext_set_user_data(UIContext *cx, void *data);
+void *UIContext_get_user_data(UIContext *cx);
+void UIContext_connect(UIContext *cx, const char* dispName, int software);
+void UIContext_connect_egl(UIContext *cx);
+void UIContext_connect_osmesa(UIContext *cx);
+void UIContext_disconnect(UIContext *cx);
+int UIContext_get_backend(UIContext *cx);
+int UIContext_has_glx_extension(UIContext *cx, const char *name);
+void UIContext_get_screen_metrics(UIContext *cx, int *w, int *h, int *w_mm, int *h_mm);
+int UIContext_client_resources(UIContext *cx, UIContext_resource_count *dest, int max);
+double UIContext_monotonic_now();
+
+// GL context
+void UIContext_set_context_attribs(UIContext *cx, int major, int minor, int profile, int no_error, int robust);
+void UIContext_set_fb_prefs(UIContext *cx, int depth, int stencil, int samples, int srgb, int single_buffer);
+void UIContext_set_fbconfig_cache(UIContext *cx, const char *path);
+int UIContext_get_fbconfig_attrib(UIContext *cx, int for_pixmaps, int attr);
+int UIContext_profile_by_name(const char *name);
+void UIContext_setup_glcontext(UIContext *cx, int direct, GLXContextID link_to);
+void UIContext_teardown_glcontext(UIContext *cx);
+void *UIContext_get_proc_address(UIContext *cx, const char *name);
+int UIContext_gl_version_at_least(UIContext *cx, int major, int minor);
+int UIContext_gl_is_core(UIContext *cx);
+int UIContext_has_gl_extension(UIContext *cx, const char *name);
+
+// Windows and offscreen targets
+Window UIContext_create_window(UIContext *cx, int x, int y, int w, int h);
+void UIContext_destroy_window(UIContext *cx, Window xid);
+void UIContext_get_window_rect(UIContext *cx, Window wnd, int *x, int *y, unsigned int *width, unsigned int *height);
+unsigned long UIContext_get_window_pixel(UIContext *cx, Window wnd, int x, int y);
+void UIContext_XSetWMNormalHints(UIContext *cx, Window wnd, XSizeHints *hints);
+void UIContext_XMapWindow(UIContext *cx, Window wnd, int wait_msec);
+void UIContext_window_set_blank_cursor(UIContext *cx, Window wnd);
+int UIContext_create_pixmap(UIContext *cx, int w, int h);
+void UIContext_destroy_pixmap(UIContext *cx, Pixmap xid);
+void UIContext_release_pixmap(UIContext *cx, Pixmap xid, int w, int h);
+void UIContext_set_pixmap_pool(UIContext *cx, int limit);
+void UIContext_get_pixmap_pool_stats(UIContext *cx, int *count, int *limit, unsigned long *hits, unsigned long *misses);
+
+// Rendering
+void UIContext_glXMakeCurrent(UIContext *cx, int xid);
+void UIContext_make_context_current(UIContext *cx, int draw, int read);
+void UIContext_blit(UIContext *cx, int src, int sx, int sy, int sw, int sh,
+	int dst, int dx, int dy, int dw, int dh, int linear);
+void UIContext_glXSwapBuffers(UIContext *cx);
+void UIContext_swap_buffers_damage(UIContext *cx, const int *rects, int n);
+int UIContext_buffer_age(UIContext *cx);
+int UIContext_present(UIContext *cx, int flags);
+int UIContext_present_damage(UIContext *cx, int flags, const int *rects, int n);
+void UIContext_frustum_matrix(UIContext_projection *p, int target_w, int target_h, double m[16]);
+void UIContext_project_frustum(UIContext *cx, UIContext_projection *p, const double m[16]);
+int UIContext_draw_vertices(UIContext *cx, GLenum mode, const char *format, const void *data, size_t len);
+void *UIContext_stream_reserve(UIContext *cx, size_t len, void (*on_release)(void *arg), void *arg);
+int UIContext_draw_reserved(UIContext *cx, GLenum mode, const char *format, const void *data, size_t len);
+
+// Errors and debug output
+void UIContext_set_gl_debug(UIContext *cx, int enable);
+int UIContext_debug_pending(UIContext *cx);
+int UIContext_next_debug_message(UIContext *cx, UIContext_debug_msg *msg);
+unsigned UIContext_debug_dropped(UIContext *cx);
+const char *UIContext_debug_source_name(GLenum source);
+const char *UIContext_debug_type_name(GLenum type);
+const char *UIContext_debug_severity_name(GLenum severity);
+int UIContext_x_errors_pending();
+int UIContext_take_x_errors(UIContext_x_error *dest, unsigned *dropped);
+UIContext *UIContext_dpy_map_get(Display *dpy);
+void UIContext_set_fatal_handler(void (*handler)(void));
+
+#endif
@@ -0,0 +1,506 @@
+// Vertex submission from packed buffers.
+//
+// The .xs includes this right after uicontext.c.  Perl hands over a string of
+// packed vertices and a short format description, and the bytes are copied
+// straight from the SV's buffer into a GL buffer object and drawn with one
+// glDrawArrays, instead of one XS call per glVertex/glColor.
+//
+// The buffer object is used as a stream: each draw is appended after the
+// previous one.  With GL_ARB_buffer_storage, the buffer is mapped once,
+// persistently, and split into regions that are filled in turn; a fence
+// after the last draw in a region tells when the GPU is done reading it, and
+// the CPU only waits on that when it comes back around to the region.
+// Vertices are then copied straight into the mapping (or written there by
+// the caller, with stream_reserve), with no GL call per upload.
+// Otherwise, when the buffer fills up its storage is orphaned (glBufferData
+// with NULL) so that the driver can hand out fresh memory without waiting for
+// the GPU to finish reading the old contents.
+
+#define UICONTEXT_STREAM_MIN_SIZE  (1024*1024)
+#define UICONTEXT_STREAM_REGIONS   3  // frames the GPU may be behind before the CPU waits
+#define UICONTEXT_STREAM_MAP_FLAGS (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+#define UICONTEXT_STREAM_MAX_ATTRS 8
+#define UICONTEXT_STREAM_FORMAT_MAX 64
+
+// Which fixed-function array an attribute feeds.  In a core profile, the
+// attributes are generic ones, numbered in the order they appear.
+enum UIContext_attr_kind {
+	UICONTEXT_ATTR_VERTEX= 0,
+	UICONTEXT_ATTR_COLOR,
+	UICONTEXT_ATTR_TEXCOORD,
+	UICONTEXT_ATTR_NORMAL,
+};
+
+typedef struct UIContext_vertex_attr {
+	int          kind;    // UICONTEXT_ATTR_*
+	int          size;    // number of components
+	GLenum       type;
+	int          offset;  // from the start of the vertex
+} UIContext_vertex_attr;
+
+typedef struct UIContext_vertex_format {
+	int          stride;
+	int          attr_count;
+	UIContext_vertex_attr attr[UICONTEXT_STREAM_MAX_ATTRS];
+} UIContext_vertex_format;
+
+struct UIContext_stream {
+	GLuint       vbo;
+	GLuint       vao;     // only for core profiles, which have no default
+	size_t       size;    // allocated size of the buffer object
+	size_t       offset;  // where the next draw's vertices go
+	int          core;    // use generic attributes instead of client state
+	int          vao_attrs; // generic attributes enabled in the VAO
+
+	// The format is usually the same from one draw to the next, so the last
+	// one parsed is kept.
+	char         format_str[UICONTEXT_STREAM_FORMAT_MAX];
+	UIContext_vertex_format format;
+
+	unsigned long draws, bytes, orphans, fence_waits;
+
+	// Persistent mapping of the whole buffer, or NULL if orphaning instead
+	char        *map;
+	size_t       region_size;
+	int          region;  // region being filled; 'offset' is relative to it
+	GLsync       fence[UICONTEXT_STREAM_REGIONS];
+
+	// Space handed out by stream_reserve (reserved_ptr is NULL without a
+	// mapping), and who to tell when it stops being writable
+	int          reserved;
+	char        *reserved_ptr;
+	size_t       reserved_offset, reserved_len;
+	void       (*reserved_release)(void *arg);
+	void        *reserved_arg;
+
+	PFNGLGENBUFFERSPROC              GenBuffers;
+	PFNGLDELETEBUFFERSPROC           DeleteBuffers;
+	PFNGLBINDBUFFERPROC              BindBuffer;
+	PFNGLBUFFERDATAPROC              BufferData;
+	PFNGLBUFFERSUBDATAPROC           BufferSubData;
+	void (APIENTRY *DrawArrays)(GLenum mode, GLint first, GLsizei count);
+	// persistent mapping
+	PFNGLBUFFERSTORAGEPROC           BufferStorage;
+	PFNGLMAPBUFFERRANGEPROC          MapBufferRange;
+	PFNGLFENCESYNCPROC               FenceSync;
+	PFNGLCLIENTWAITSYNCPROC          ClientWaitSync;
+	PFNGLDELETESYNCPROC              DeleteSync;
+	// core
+	PFNGLGENVERTEXARRAYSPROC         GenVertexArrays;
+	PFNGLDELETEVERTEXARRAYSPROC      DeleteVertexArrays;
+	PFNGLBINDVERTEXARRAYPROC         BindVertexArray;
+	PFNGLENABLEVERTEXATTRIBARRAYPROC EnableVertexAttribArray;
+	PFNGLDISABLEVERTEXATTRIBARRAYPROC DisableVertexAttribArray;
+	PFNGLVERTEXATTRIBPOINTERPROC     VertexAttribPointer;
+	// compatibility
+	void (APIENTRY *EnableClientState)(GLenum array);
+	void (APIENTRY *DisableClientState)(GLenum array);
+	void (APIENTRY *VertexPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *ptr);
+	void (APIENTRY *ColorPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *ptr);
+	void (APIENTRY *TexCoordPointer)(GLint size, GLenum type, GLsizei stride, const GLvoid *ptr);
+	void (APIENTRY *NormalPointer)(GLenum type, GLsizei stride, const GLvoid *ptr);
+};
+
+static const GLenum UIContext_attr_client_state[]= {
+	GL_VERTEX_ARRAY, GL_COLOR_ARRAY, GL_TEXTURE_COORD_ARRAY, GL_NORMAL_ARRAY
+};
+
+// Parse a format like "v2f c4ub": one item per attribute, each a letter for
+// what it is (v=vertex, c=color, t=texcoord, n=normal), the number of
+// components, and the type (f, d, b, ub, s, us, i, ui).
+void UIContext_parse_vertex_format(const char *str, UIContext_vertex_format *fmt) {
+	const char *p= str;
+	UIContext_vertex_attr *a;
+	int type_size, has_vertex= 0;
+
+	memset(fmt, 0, sizeof(*fmt));
+	while (*p) {
+		if (*p == ' ' || *p == ',') { p++; continue; }
+		if (fmt->attr_count >= UICONTEXT_STREAM_MAX_ATTRS)
+			croak("Too many attributes in vertex format '%s'", str);
+		a= &fmt->attr[fmt->attr_count++];
+		switch (*p++) {
+		case 'v': a->kind= UICONTEXT_ATTR_VERTEX; has_vertex= 1; break;
+		case 'c': a->kind= UICONTEXT_ATTR_COLOR; break;
+		case 't': a->kind= UICONTEXT_ATTR_TEXCOORD; break;
+		case 'n': a->kind= UICONTEXT_ATTR_NORMAL; break;
+		default: croak("Unknown attribute '%c' in vertex format '%s'", p[-1], str);
+		}
+		if (*p < '1' || *p > '4')
+			croak("Expected component count 1..4 in vertex format '%s'", str);
+		a->size= *p++ - '0';
+		if      (p[0] == 'f')                 { a->type= GL_FLOAT;          type_size= 4; p+= 1; }
+		else if (p[0] == 'd')                 { a->type= GL_DOUBLE;         type_size= 8; p+= 1; }
+		else if (p[0] == 'b')                 { a->type= GL_BYTE;           type_size= 1; p+= 1; }
+		else if (p[0] == 'u' && p[1] == 'b')  { a->type= GL_UNSIGNED_BYTE;  type_size= 1; p+= 2; }
+		else if (p[0] == 's')                 { a->type= GL_SHORT;          type_size= 2; p+= 1; }
+		else if (p[0] == 'u' && p[1] == 's')  { a->type= GL_UNSIGNED_SHORT; type_size= 2; p+= 2; }
+		else if (p[0] == 'i')                 { a->type= GL_INT;            type_size= 4; p+= 1; }
+		else if (p[0] == 'u' && p[1] == 'i')  { a->type= GL_UNSIGNED_INT;   type_size= 4; p+= 2; }
+		else croak("Unknown component type in vertex format '%s'", str);
+		// Limits of the fixed-function arrays
+		if ((a->kind == UICONTEXT_ATTR_VERTEX && a->size < 2)
+			|| (a->kind == UICONTEXT_ATTR_COLOR && a->size < 3)
+			|| (a->kind == UICONTEXT_ATTR_NORMAL && a->size != 3))
+			croak("Invalid component count in vertex format '%s'", str);
+		a->offset= fmt->stride;
+		fmt->stride += a->size * type_size;
+	}
+	if (!has_vertex)
+		croak("Vertex format '%s' has no vertex position", str);
+}
+
+static void UIContext_stream_map(UIContext *cx, size_t need);
+
+static void UIContext_stream_init(UIContext *cx) {
+	UIContext_stream *s;
+	const char *name;
+
+	if (!(s= (UIContext_stream*) calloc(1, sizeof(UIContext_stream))))
+		croak("Can't allocate vertex stream");
+	#define LOADFN(fn) if (!(s->fn= (void*) UIContext_get_proc_address(cx, name= "gl" #fn))) goto missing;
+	LOADFN(GenBuffers)
+	LOADFN(DeleteBuffers)
+	LOADFN(BindBuffer)
+	LOADFN(BufferData)
+	LOADFN(BufferSubData)
+	LOADFN(DrawArrays)
+	// Core profiles have no client state arrays, and need a vertex array object
+	s->core= UIContext_gl_is_core(cx);
+	if (s->core) {
+		LOADFN(GenVertexArrays)
+		LOADFN(DeleteVertexArrays)
+		LOADFN(BindVertexArray)
+		LOADFN(EnableVertexAttribArray)
+		LOADFN(DisableVertexAttribArray)
+		LOADFN(VertexAttribPointer)
+	}
+	else {
+		LOADFN(EnableClientState)
+		LOADFN(DisableClientState)
+		LOADFN(VertexPointer)
+		LOADFN(ColorPointer)
+		LOADFN(TexCoordPointer)
+		LOADFN(NormalPointer)
+	}
+	#undef LOADFN
+	// These are optional; any missing means no persistent mapping
+	#define LOADFN(fn) s->fn= (void*) UIContext_get_proc_address(cx, "gl" #fn);
+	if (!cx->stream_orphan
+		&& (UIContext_gl_version_at_least(cx, 4, 4) || UIContext_has_gl_extension(cx, "GL_ARB_buffer_storage"))
+	) {
+		LOADFN(BufferStorage)
+		LOADFN(MapBufferRange)
+		LOADFN(FenceSync)
+		LOADFN(ClientWaitSync)
+		LOADFN(DeleteSync)
+	}
+	#undef LOADFN
+	s->GenBuffers(1, &s->vbo);
+	if (s->core)
+		s->GenVertexArrays(1, &s->vao);
+	cx->stream= s;
+	if (s->BufferStorage && s->MapBufferRange && s->FenceSync && s->ClientWaitSync && s->DeleteSync) {
+		s->BindBuffer(GL_ARRAY_BUFFER, s->vbo);
+		UIContext_stream_map(cx, 0);
+		s->BindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	log_debug("Vertex stream uses %s", s->map? "a persistent mapping" : "buffer orphaning");
+	return;
+	missing:
+	free(s);
+	croak("GL library has no %s", name);
+}
+
+// End the reservation from stream_reserve, telling the caller so that it
+// won't write into the mapping after it belongs to the GPU again
+static void UIContext_stream_release_reserved(UIContext_stream *s) {
+	void (*release)(void *arg)= s->reserved_release;
+	void *arg= s->reserved_arg;
+	if (!s->reserved) return;
+	s->reserved= 0;
+	s->reserved_ptr= NULL;
+	s->reserved_len= 0;
+	s->reserved_release= NULL;
+	s->reserved_arg= NULL;
+	if (release)
+		release(arg);
+}
+
+static void UIContext_stream_delete_fences(UIContext_stream *s) {
+	int i;
+	for (i= 0; i < UICONTEXT_STREAM_REGIONS; i++)
+		if (s->fence[i]) {
+			s->DeleteSync(s->fence[i]);
+			s->fence[i]= NULL;
+		}
+}
+
+// (Re)create the persistently mapped storage, with regions of at least
+// 'need' bytes.  The buffer must be bound to GL_ARRAY_BUFFER.
+static void UIContext_stream_map(UIContext *cx, size_t need) {
+	UIContext_stream *s= cx->stream;
+
+	// Storage is immutable, so growing it means a new buffer object.  The GL
+	// keeps the old one alive until pending draws are done with it.
+	if (s->map) {
+		UIContext_stream_release_reserved(s);
+		UIContext_stream_delete_fences(s);
+		s->DeleteBuffers(1, &s->vbo);
+		s->map= NULL;
+		s->GenBuffers(1, &s->vbo);
+		s->BindBuffer(GL_ARRAY_BUFFER, s->vbo);
+		s->orphans++;
+	}
+	s->region_size= need > UICONTEXT_STREAM_MIN_SIZE? (need + 0xFFFF) & ~(size_t)0xFFFF : UICONTEXT_STREAM_MIN_SIZE;
+	s->size= s->region_size * UICONTEXT_STREAM_REGIONS;
+	s->BufferStorage(GL_ARRAY_BUFFER, s->size, NULL, UICONTEXT_STREAM_MAP_FLAGS);
+	if (!(s->map= (char*) s->MapBufferRange(GL_ARRAY_BUFFER, 0, s->size, UICONTEXT_STREAM_MAP_FLAGS)))
+		croak("glMapBufferRange failed for %ld byte vertex stream", (long) s->size);
+	s->region= 0;
+	s->offset= 0;
+}
+
+// Fence the region being filled, and move on to the next one
+static void UIContext_stream_next_region(UIContext_stream *s) {
+	s->fence[s->region]= s->FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	s->region= (s->region + 1) % UICONTEXT_STREAM_REGIONS;
+	s->offset= 0;
+}
+
+static void UIContext_stream_wait_region(UIContext_stream *s, int region) {
+	GLenum status;
+	int tries= 0;
+
+	status= s->ClientWaitSync(s->fence[region], 0, 0);
+	if (status == GL_TIMEOUT_EXPIRED) {
+		s->fence_waits++;
+		// Flush, or the fence might never be reached
+		while ((status= s->ClientWaitSync(s->fence[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000)) == GL_TIMEOUT_EXPIRED
+			&& ++tries < 10
+		) {}
+	}
+	if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+		log_error("Vertex stream fence wait failed (0x%X); overwriting region anyway", (int) status);
+	s->DeleteSync(s->fence[region]);
+	s->fence[region]= NULL;
+}
+
+// Called as each frame is presented.  The next frame's vertices start in a
+// fresh region, so a region holds at most one frame.
+void UIContext_stream_frame_end(UIContext *cx) {
+	UIContext_stream *s= cx->stream;
+	if (!s) return;
+	UIContext_stream_release_reserved(s);
+	if (s->map && s->offset)
+		UIContext_stream_next_region(s);
+}
+
+void UIContext_stream_free(UIContext *cx) {
+	UIContext_stream *s= cx->stream;
+	UIContext_gl_cleanup save;
+	if (!s) return;
+	UIContext_stream_release_reserved(s);
+	// The names belong to this context, which might not be the current one.
+	// If it can't be made current, they die with the context anyway.
+	if (UIContext_gl_cleanup_begin(cx, &save)) {
+		UIContext_stream_delete_fences(s);
+		s->DeleteBuffers(1, &s->vbo);
+		if (s->vao)
+			s->DeleteVertexArrays(1, &s->vao);
+		UIContext_gl_cleanup_end(cx, &save);
+	}
+	free(s);
+	cx->stream= NULL;
+}
+
+// Create the stream on first use, and parse the vertex format if it changed
+// (or if no format has been parsed successfully yet).  The buffer and vertex
+// array names belong to cx's GL context, so that has to be the current one.
+static UIContext_stream *UIContext_stream_prepare(UIContext *cx, const char *format) {
+	UIContext_stream *s;
+	UIContext_vertex_format fmt;
+
+	CROAK_IF_NO_GLCONTEXT(cx);
+	CROAK_IF_NO_TARGET(cx);
+	if (UIContext_current.cx != cx)
+		croak("GL context of this viewport is not current; call set_gl_target first");
+	if (!cx->stream)
+		UIContext_stream_init(cx);
+	s= cx->stream;
+	if (format && (!s->format.stride || strncmp(format, s->format_str, sizeof(s->format_str)) != 0)) {
+		// If parsing croaks, the next call must not match the stale format
+		s->format_str[0]= '\0';
+		s->format.stride= 0;
+		UIContext_parse_vertex_format(format, &fmt);
+		s->format= fmt;
+		if (strlen(format) < sizeof(s->format_str))
+			strcpy(s->format_str, format);
+	}
+	return s;
+}
+
+// Find room for 'len' bytes, and return its offset in the buffer object.
+// The buffer must be bound to GL_ARRAY_BUFFER.
+static size_t UIContext_stream_space(UIContext *cx, size_t len) {
+	UIContext_stream *s= cx->stream;
+	size_t start;
+
+	// Keep each draw's data aligned, whatever the previous vertex size was
+	s->offset= (s->offset + 15) & ~(size_t)15;
+	if (s->map) {
+		if (len > s->region_size)
+			UIContext_stream_map(cx, len);
+		else if (s->offset + len > s->region_size)
+			UIContext_stream_next_region(s);
+		// First use of the region since the GPU was given it
+		if (s->fence[s->region])
+			UIContext_stream_wait_region(s, s->region);
+		start= s->region * s->region_size + s->offset;
+	}
+	else {
+		if (s->offset + len > s->size) {
+			if (len > s->size)
+				s->size= len > UICONTEXT_STREAM_MIN_SIZE? len : UICONTEXT_STREAM_MIN_SIZE;
+			s->BufferData(GL_ARRAY_BUFFER, s->size, NULL, GL_STREAM_DRAW);
+			s->offset= 0;
+			s->orphans++;
+		}
+		start= s->offset;
+	}
+	s->offset += len;
+	return start;
+}
+
+// Draw 'count' vertices starting at byte 'start' of the bound buffer.
+// Attributes that aren't in the format are disabled, so that they can't
+// source stale (or the caller's) arrays.  In a compatibility profile, that
+// leaves all the client arrays disabled afterward.
+static void UIContext_stream_draw(UIContext_stream *s, GLenum mode, size_t start, int count) {
+	UIContext_vertex_format *fmt= &s->format;
+	UIContext_vertex_attr *a;
+	const char *ptr= (const char*) (uintptr_t) start;
+	int i, used= 0;
+
+	if (s->core) {
+		s->BindVertexArray(s->vao);
+		for (i= 0; i < fmt->attr_count; i++) {
+			a= &fmt->attr[i];
+			s->EnableVertexAttribArray(i);
+			// colors in integer types are 0..1, like glColorPointer does
+			s->VertexAttribPointer(i, a->size, a->type,
+				a->kind == UICONTEXT_ATTR_COLOR && a->type != GL_FLOAT && a->type != GL_DOUBLE,
+				fmt->stride, ptr + a->offset);
+		}
+		// Left on by an earlier format with more attributes
+		for (; i < s->vao_attrs; i++)
+			s->DisableVertexAttribArray(i);
+		s->vao_attrs= fmt->attr_count;
+		s->DrawArrays(mode, 0, count);
+		s->BindVertexArray(0);
+	}
+	else {
+		for (i= 0; i < fmt->attr_count; i++)
+			used |= 1 << fmt->attr[i].kind;
+		for (i= 0; i < (int) (sizeof(UIContext_attr_client_state) / sizeof(GLenum)); i++)
+			if (!(used & (1 << i)))
+				s->DisableClientState(UIContext_attr_client_state[i]);
+		for (i= 0; i < fmt->attr_count; i++) {
+			a= &fmt->attr[i];
+			s->EnableClientState(UIContext_attr_client_state[a->kind]);
+			switch (a->kind) {
+			case UICONTEXT_ATTR_VERTEX:   s->VertexPointer(a->size, a->type, fmt->stride, ptr + a->offset); break;
+			case UICONTEXT_ATTR_COLOR:    s->ColorPointer(a->size, a->type, fmt->stride, ptr + a->offset); break;
+			case UICONTEXT_ATTR_TEXCOORD: s->TexCoordPointer(a->size, a->type, fmt->stride, ptr + a->offset); break;
+			case UICONTEXT_ATTR_NORMAL:   s->NormalPointer(a->type, fmt->stride, ptr + a->offset); break;
+			}
+		}
+		s->DrawArrays(mode, 0, count);
+		// Don't leave client arrays pointing into the stream buffer
+		for (i= 0; i < fmt->attr_count; i++)
+			s->DisableClientState(UIContext_attr_client_state[fmt->attr[i].kind]);
+	}
+	s->draws++;
+	s->bytes += (size_t) count * fmt->stride;
+}
+
+// Copy 'len' bytes of vertices into the stream buffer and draw them.
+// Returns the number of vertices drawn.
+int UIContext_draw_vertices(UIContext *cx, GLenum mode, const char *format, const void *data, size_t len) {
+	UIContext_stream *s= UIContext_stream_prepare(cx, format);
+	size_t start;
+	int count;
+
+	if (!s->format.stride)
+		croak("No vertex format given");
+	if (len % s->format.stride)
+		croak("Vertex data length %ld is not a multiple of the vertex size %d", (long) len, s->format.stride);
+	if (!(count= len / s->format.stride))
+		return 0;
+
+	s->BindBuffer(GL_ARRAY_BUFFER, s->vbo);
+	start= UIContext_stream_space(cx, len);
+	if (s->map)
+		memcpy(s->map + start, data, len);
+	else
+		s->BufferSubData(GL_ARRAY_BUFFER, start, len, data);
+	UIContext_stream_draw(s, mode, start, count);
+	s->BindBuffer(GL_ARRAY_BUFFER, 0);
+	return count;
+}
+
+// Hand out 'len' bytes of the stream for the caller to fill in.  With a
+// persistent mapping this is the mapped memory itself; otherwise it returns
+// NULL, and the caller passes its own copy of the vertices to
+// draw_reserved.  Either way the reservation ends at the next
+// stream_reserve or draw_reserved, or at the end of the frame, and
+// 'on_release' (if given) is called with 'arg' then.
+void *UIContext_stream_reserve(UIContext *cx, size_t len, void (*on_release)(void *arg), void *arg) {
+	UIContext_stream *s= UIContext_stream_prepare(cx, NULL);
+
+	UIContext_stream_release_reserved(s);
+	if (s->map) {
+		s->BindBuffer(GL_ARRAY_BUFFER, s->vbo);
+		s->reserved_offset= UIContext_stream_space(cx, len);
+		s->BindBuffer(GL_ARRAY_BUFFER, 0);
+		s->reserved_ptr= s->map + s->reserved_offset;
+	}
+	s->reserved= 1;
+	s->reserved_len= len;
+	s->reserved_release= on_release;
+	s->reserved_arg= arg;
+	return s->reserved_ptr;
+}
+
+// Draw the reserved vertices.  'data' is where the caller wrote them, which
+// may be the reserved memory itself.
+int UIContext_draw_reserved(UIContext *cx, GLenum mode, const char *format, const void *data, size_t len) {
+	UIContext_stream *s= UIContext_stream_prepare(cx, format);
+	size_t start;
+	int count;
+
+	if (!s->reserved)
+		croak("No vertices reserved; call stream_reserve first");
+	if (!s->format.stride)
+		croak("No vertex format given");
+	if (len % s->format.stride)
+		croak("Reserved length %ld is not a multiple of the vertex size %d", (long) len, s->format.stride);
+	if (len != s->reserved_len)
+		croak("Reserved vertices changed length (%ld, not %ld)", (long) len, (long) s->reserved_len);
+
+	s->BindBuffer(GL_ARRAY_BUFFER, s->vbo);
+	if (s->reserved_ptr) {
+		if (data != s->reserved_ptr)
+			memcpy(s->reserved_ptr, data, len);
+		start= s->reserved_offset;
+	}
+	else {
+		start= UIContext_stream_space(cx, len);
+		s->BufferSubData(GL_ARRAY_BUFFER, start, len, data);
+	}
+	if ((count= len / s->format.stride))
+		UIContext_stream_draw(s, mode, start, count);
+	s->BindBuffer(GL_ARRAY_BUFFER, 0);
+	UIContext_stream_release_reserved(s);
+	return count;
+}
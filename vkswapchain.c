@@ -0,0 +1,653 @@
+// Optional Vulkan presentation for windows created by UIContext_create_window.
+//
+// The .xs includes this right after uicontext.c.  It is only compiled in if
+// the Vulkan headers are available, and libvulkan is loaded at runtime, so
+// Vulkan is never a requirement of the module.
+//
+// Frames are handed over as BGRA pixels, either from a buffer supplied by the
+// caller or read back from the current GL target, and copied into the next
+// swapchain image through a per-frame staging buffer.  The caller controls
+// the present mode, the number of swapchain images, and how many frames may
+// be queued before vk_present blocks.
+//
+// This is a copy path, not a fast path: a GL frame goes through host memory
+// (glReadPixels into the mapped staging buffer) before Vulkan uploads it, so
+// it costs more than glXSwapBuffers.  It exists for the present-mode and
+// frame-pacing control, and for CPU-rendered frames.
+
+#if defined(__has_include)
+ #if __has_include(<vulkan/vulkan.h>)
+  #define VK_NO_PROTOTYPES
+  #define VK_USE_PLATFORM_XLIB_KHR
+  #include <vulkan/vulkan.h>
+  #define UICONTEXT_HAVE_VULKAN 1
+ #endif
+#endif
+
+static const char *UIContext_vk_present_mode_names[]= {
+	"immediate",    // VK_PRESENT_MODE_IMMEDIATE_KHR
+	"mailbox",      // VK_PRESENT_MODE_MAILBOX_KHR
+	"fifo",         // VK_PRESENT_MODE_FIFO_KHR
+	"fifo_relaxed", // VK_PRESENT_MODE_FIFO_RELAXED_KHR
+	NULL
+};
+
+int UIContext_vk_present_mode_by_name(const char *name) {
+	int i;
+	for (i= 0; UIContext_vk_present_mode_names[i]; i++)
+		if (strcmp(name, UIContext_vk_present_mode_names[i]) == 0)
+			return i;
+	croak("Unknown present mode '%s'", name);
+	return -1;
+}
+
+#ifdef UICONTEXT_HAVE_VULKAN
+
+#define UICONTEXT_VK_INSTANCE_FN(X) \
+	X(DestroyInstance) \
+	X(EnumeratePhysicalDevices) \
+	X(GetPhysicalDeviceQueueFamilyProperties) \
+	X(GetPhysicalDeviceMemoryProperties) \
+	X(GetPhysicalDeviceSurfaceSupportKHR) \
+	X(GetPhysicalDeviceSurfaceCapabilitiesKHR) \
+	X(GetPhysicalDeviceSurfaceFormatsKHR) \
+	X(GetPhysicalDeviceSurfacePresentModesKHR) \
+	X(CreateXlibSurfaceKHR) \
+	X(DestroySurfaceKHR) \
+	X(CreateDevice) \
+	X(GetDeviceProcAddr)
+
+#define UICONTEXT_VK_DEVICE_FN(X) \
+	X(DestroyDevice) \
+	X(DeviceWaitIdle) \
+	X(GetDeviceQueue) \
+	X(CreateSwapchainKHR) \
+	X(DestroySwapchainKHR) \
+	X(GetSwapchainImagesKHR) \
+	X(AcquireNextImageKHR) \
+	X(QueuePresentKHR) \
+	X(QueueSubmit) \
+	X(CreateCommandPool) \
+	X(DestroyCommandPool) \
+	X(AllocateCommandBuffers) \
+	X(ResetCommandBuffer) \
+	X(BeginCommandBuffer) \
+	X(EndCommandBuffer) \
+	X(CmdPipelineBarrier) \
+	X(CmdCopyBufferToImage) \
+	X(CreateSemaphore) \
+	X(DestroySemaphore) \
+	X(CreateFence) \
+	X(DestroyFence) \
+	X(WaitForFences) \
+	X(ResetFences) \
+	X(CreateBuffer) \
+	X(DestroyBuffer) \
+	X(GetBufferMemoryRequirements) \
+	X(AllocateMemory) \
+	X(FreeMemory) \
+	X(BindBufferMemory) \
+	X(MapMemory)
+
+#define UICONTEXT_VK_DECLARE_FN(name) PFN_vk##name name;
+
+typedef struct UIContext_vk_frame {
+	VkCommandBuffer cmd;
+	VkSemaphore     acquired;  // signalled when the swapchain image is ready
+	VkFence         done;      // signalled when the copy has finished
+	VkBuffer        staging;
+	VkDeviceMemory  staging_mem;
+	void           *staging_ptr;
+} UIContext_vk_frame;
+
+struct UIContext_vk {
+	void *lib;
+	PFN_vkGetInstanceProcAddr GetInstanceProcAddr;
+	PFN_vkCreateInstance      CreateInstance;
+	UICONTEXT_VK_INSTANCE_FN(UICONTEXT_VK_DECLARE_FN)
+	UICONTEXT_VK_DEVICE_FN(UICONTEXT_VK_DECLARE_FN)
+
+	VkInstance       instance;
+	VkSurfaceKHR     surface;
+	VkPhysicalDevice phys;
+	uint32_t         queue_family;
+	VkDevice         device;
+	VkQueue          queue;
+	VkCommandPool    cmd_pool;
+	Window           wnd;
+
+	// Swapchain, recreated whenever the window size changes
+	VkSwapchainKHR   swapchain;
+	VkFormat         format;
+	VkExtent2D       extent;
+	VkPresentModeKHR present_mode;
+	uint32_t         image_count;
+	VkImage         *images;
+	VkSemaphore     *rendered;  // one per swapchain image
+	int              need_rebuild;
+
+	// Settings requested by the caller
+	VkPresentModeKHR want_present_mode;
+	uint32_t         want_image_count;
+
+	uint32_t         frames_in_flight;
+	uint32_t         frame;
+	UIContext_vk_frame *frames;
+	VkBufferImageCopy  *row_regions; // for flipping GL's bottom-up rows
+};
+
+static void UIContext_vk_free_swapchain(UIContext_vk *vk) {
+	uint32_t i;
+
+	if (vk->device && vk->DeviceWaitIdle)
+		vk->DeviceWaitIdle(vk->device);
+	if (vk->frames && vk->DestroyBuffer) {
+		for (i= 0; i < vk->frames_in_flight; i++) {
+			if (vk->frames[i].staging)     vk->DestroyBuffer(vk->device, vk->frames[i].staging, NULL);
+			if (vk->frames[i].staging_mem) vk->FreeMemory(vk->device, vk->frames[i].staging_mem, NULL);
+			vk->frames[i].staging= VK_NULL_HANDLE;
+			vk->frames[i].staging_mem= VK_NULL_HANDLE;
+			vk->frames[i].staging_ptr= NULL;
+		}
+	}
+	if (vk->rendered && vk->DestroySemaphore) {
+		for (i= 0; i < vk->image_count; i++)
+			if (vk->rendered[i]) vk->DestroySemaphore(vk->device, vk->rendered[i], NULL);
+		free(vk->rendered);
+		vk->rendered= NULL;
+	}
+	free(vk->images);
+	vk->images= NULL;
+	free(vk->row_regions);
+	vk->row_regions= NULL;
+	if (vk->swapchain && vk->DestroySwapchainKHR)
+		vk->DestroySwapchainKHR(vk->device, vk->swapchain, NULL);
+	vk->swapchain= VK_NULL_HANDLE;
+	vk->image_count= 0;
+}
+
+void UIContext_vk_teardown(UIContext *cx) {
+	UIContext_vk *vk= cx->vk;
+	uint32_t i;
+
+	if (!vk) return;
+	// Any of the functions might be missing, if setup failed while loading them
+	if (vk->device && vk->DestroyDevice) {
+		UIContext_vk_free_swapchain(vk);
+		if (vk->frames && vk->DestroyFence) {
+			for (i= 0; i < vk->frames_in_flight; i++) {
+				if (vk->frames[i].acquired) vk->DestroySemaphore(vk->device, vk->frames[i].acquired, NULL);
+				if (vk->frames[i].done)     vk->DestroyFence(vk->device, vk->frames[i].done, NULL);
+			}
+		}
+		if (vk->cmd_pool && vk->DestroyCommandPool)
+			vk->DestroyCommandPool(vk->device, vk->cmd_pool, NULL);
+		vk->DestroyDevice(vk->device, NULL);
+	}
+	free(vk->frames);
+	if (vk->surface)
+		vk->DestroySurfaceKHR(vk->instance, vk->surface, NULL);
+	if (vk->instance && vk->DestroyInstance)
+		vk->DestroyInstance(vk->instance, NULL);
+	if (vk->lib)
+		dlclose(vk->lib);
+	free(vk);
+	cx->vk= NULL;
+}
+
+static uint32_t UIContext_vk_find_memory(UIContext_vk *vk, uint32_t type_bits, VkMemoryPropertyFlags flags) {
+	VkPhysicalDeviceMemoryProperties props;
+	uint32_t i;
+
+	vk->GetPhysicalDeviceMemoryProperties(vk->phys, &props);
+	for (i= 0; i < props.memoryTypeCount; i++)
+		if ((type_bits & (1 << i)) && (props.memoryTypes[i].propertyFlags & flags) == flags)
+			return i;
+	croak("No host-visible Vulkan memory type");
+	return 0;
+}
+
+// (Re)create the swapchain at the window's current size, along with the
+// staging buffers that feed it.
+static void UIContext_vk_build_swapchain(UIContext *cx) {
+	UIContext_vk *vk= cx->vk;
+	VkSurfaceCapabilitiesKHR caps;
+	VkSurfaceFormatKHR *formats;
+	VkPresentModeKHR modes[16];
+	VkSwapchainCreateInfoKHR sci;
+	VkSemaphoreCreateInfo semci;
+	VkBufferCreateInfo bci;
+	VkMemoryRequirements req;
+	VkMemoryAllocateInfo mai;
+	uint32_t n, i;
+	int x, y;
+	unsigned int w, h, border, depth;
+	Window root;
+
+	UIContext_vk_free_swapchain(vk);
+
+	if (vk->GetPhysicalDeviceSurfaceCapabilitiesKHR(vk->phys, vk->surface, &caps) != VK_SUCCESS)
+		croak("vkGetPhysicalDeviceSurfaceCapabilitiesKHR failed");
+	if (!(caps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+		croak("Vulkan surface images can't be a transfer destination");
+	if (caps.currentExtent.width == 0xFFFFFFFF) {
+		XGetGeometry(cx->dpy, vk->wnd, &root, &x, &y, &w, &h, &border, &depth);
+		vk->extent.width= w;
+		vk->extent.height= h;
+	}
+	else
+		vk->extent= caps.currentExtent;
+	if (!vk->extent.width || !vk->extent.height)
+		croak("Window has no area");
+
+	// Frames are supplied as BGRA
+	n= 0;
+	vk->GetPhysicalDeviceSurfaceFormatsKHR(vk->phys, vk->surface, &n, NULL);
+	if (!(formats= (VkSurfaceFormatKHR*) calloc(n? n : 1, sizeof(VkSurfaceFormatKHR))))
+		croak("Out of memory");
+	vk->GetPhysicalDeviceSurfaceFormatsKHR(vk->phys, vk->surface, &n, formats);
+	for (i= 0; i < n; i++)
+		if (formats[i].format == VK_FORMAT_B8G8R8A8_UNORM) break;
+	if (i == n)
+		for (i= 0; i < n; i++)
+			if (formats[i].format == VK_FORMAT_B8G8R8A8_SRGB) break;
+	if (i == n) {
+		free(formats);
+		croak("Vulkan surface doesn't support a BGRA8 format");
+	}
+	vk->format= formats[i].format;
+	memset(&sci, 0, sizeof(sci));
+	sci.imageColorSpace= formats[i].colorSpace;
+	free(formats);
+
+	// FIFO is the only mode guaranteed to exist, so it is the fallback
+	n= sizeof(modes)/sizeof(*modes);
+	vk->GetPhysicalDeviceSurfacePresentModesKHR(vk->phys, vk->surface, &n, modes);
+	vk->present_mode= VK_PRESENT_MODE_FIFO_KHR;
+	for (i= 0; i < n; i++)
+		if (modes[i] == vk->want_present_mode)
+			vk->present_mode= vk->want_present_mode;
+	if (vk->present_mode != vk->want_present_mode)
+		log_debug("Vulkan present mode %s unavailable, using fifo",
+			UIContext_vk_present_mode_names[vk->want_present_mode]);
+
+	n= vk->want_image_count;
+	if (n < caps.minImageCount) n= caps.minImageCount;
+	if (caps.maxImageCount && n > caps.maxImageCount) n= caps.maxImageCount;
+
+	sci.sType= VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+	sci.surface= vk->surface;
+	sci.minImageCount= n;
+	sci.imageFormat= vk->format;
+	sci.imageExtent= vk->extent;
+	sci.imageArrayLayers= 1;
+	sci.imageUsage= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	sci.imageSharingMode= VK_SHARING_MODE_EXCLUSIVE;
+	sci.preTransform= caps.currentTransform;
+	sci.compositeAlpha= VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+	sci.presentMode= vk->present_mode;
+	sci.clipped= VK_TRUE;
+	if (vk->CreateSwapchainKHR(vk->device, &sci, NULL, &vk->swapchain) != VK_SUCCESS)
+		croak("vkCreateSwapchainKHR failed");
+
+	vk->GetSwapchainImagesKHR(vk->device, vk->swapchain, &vk->image_count, NULL);
+	vk->images= (VkImage*) calloc(vk->image_count, sizeof(VkImage));
+	vk->rendered= (VkSemaphore*) calloc(vk->image_count, sizeof(VkSemaphore));
+	vk->row_regions= (VkBufferImageCopy*) calloc(vk->extent.height, sizeof(VkBufferImageCopy));
+	if (!vk->images || !vk->rendered || !vk->row_regions)
+		croak("Out of memory");
+	vk->GetSwapchainImagesKHR(vk->device, vk->swapchain, &vk->image_count, vk->images);
+
+	memset(&semci, 0, sizeof(semci));
+	semci.sType= VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	for (i= 0; i < vk->image_count; i++)
+		if (vk->CreateSemaphore(vk->device, &semci, NULL, &vk->rendered[i]) != VK_SUCCESS)
+			croak("vkCreateSemaphore failed");
+
+	// Copying row by row flips the image, since GL's rows are bottom-up
+	for (i= 0; i < vk->extent.height; i++) {
+		vk->row_regions[i].bufferOffset= (VkDeviceSize) (vk->extent.height - 1 - i) * vk->extent.width * 4;
+		vk->row_regions[i].imageSubresource.aspectMask= VK_IMAGE_ASPECT_COLOR_BIT;
+		vk->row_regions[i].imageSubresource.layerCount= 1;
+		vk->row_regions[i].imageOffset.y= i;
+		vk->row_regions[i].imageExtent.width= vk->extent.width;
+		vk->row_regions[i].imageExtent.height= 1;
+		vk->row_regions[i].imageExtent.depth= 1;
+	}
+
+	// Staging buffers stay mapped for their whole lifetime
+	memset(&bci, 0, sizeof(bci));
+	bci.sType= VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bci.size= (VkDeviceSize) vk->extent.width * vk->extent.height * 4;
+	bci.usage= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bci.sharingMode= VK_SHARING_MODE_EXCLUSIVE;
+	for (i= 0; i < vk->frames_in_flight; i++) {
+		UIContext_vk_frame *f= &vk->frames[i];
+		if (vk->CreateBuffer(vk->device, &bci, NULL, &f->staging) != VK_SUCCESS)
+			croak("vkCreateBuffer failed");
+		vk->GetBufferMemoryRequirements(vk->device, f->staging, &req);
+		memset(&mai, 0, sizeof(mai));
+		mai.sType= VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		mai.allocationSize= req.size;
+		mai.memoryTypeIndex= UIContext_vk_find_memory(vk, req.memoryTypeBits,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		if (vk->AllocateMemory(vk->device, &mai, NULL, &f->staging_mem) != VK_SUCCESS)
+			croak("vkAllocateMemory failed");
+		vk->BindBufferMemory(vk->device, f->staging, f->staging_mem, 0);
+		if (vk->MapMemory(vk->device, f->staging_mem, 0, bci.size, 0, &f->staging_ptr) != VK_SUCCESS)
+			croak("vkMapMemory failed");
+	}
+	vk->need_rebuild= 0;
+	log_debug("Vulkan swapchain %ux%u, %u images, present mode %s",
+		vk->extent.width, vk->extent.height, vk->image_count,
+		UIContext_vk_present_mode_names[vk->present_mode]);
+}
+
+void UIContext_vk_setup(UIContext *cx, Window wnd, int present_mode, int image_count, int frames_in_flight) {
+	UIContext_vk *vk;
+	const char *inst_ext[]= { VK_KHR_SURFACE_EXTENSION_NAME, VK_KHR_XLIB_SURFACE_EXTENSION_NAME };
+	const char *dev_ext[]= { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+	VkApplicationInfo app;
+	VkInstanceCreateInfo ici;
+	VkXlibSurfaceCreateInfoKHR xci;
+	VkPhysicalDevice devs[8];
+	VkQueueFamilyProperties qf[16];
+	VkDeviceQueueCreateInfo qci;
+	VkDeviceCreateInfo dci;
+	VkCommandPoolCreateInfo pci;
+	VkCommandBufferAllocateInfo cai;
+	VkSemaphoreCreateInfo semci;
+	VkFenceCreateInfo fci;
+	VkBool32 can_present;
+	float priority= 1.0;
+	uint32_t n_devs, n_qf, d, q, i;
+
+	CROAK_IF_XLIB_FATAL();
+	CROAK_IF_NO_DISPLAY(cx);
+	CROAK_IF_NO_X11(cx);
+
+	UIContext_vk_teardown(cx);
+	if (!(vk= cx->vk= (UIContext_vk*) calloc(1, sizeof(UIContext_vk))))
+		croak("Out of memory");
+	vk->wnd= wnd;
+	vk->want_present_mode= present_mode;
+	vk->want_image_count= image_count > 0? image_count : 2;
+	vk->frames_in_flight= frames_in_flight > 0? frames_in_flight : 2;
+
+	if (!(vk->lib= dlopen("libvulkan.so.1", RTLD_NOW|RTLD_LOCAL))) {
+		UIContext_vk_teardown(cx);
+		croak("Can't load libvulkan.so.1");
+	}
+	vk->GetInstanceProcAddr= (PFN_vkGetInstanceProcAddr) dlsym(vk->lib, "vkGetInstanceProcAddr");
+	if (!vk->GetInstanceProcAddr
+		|| !(vk->CreateInstance= (PFN_vkCreateInstance) vk->GetInstanceProcAddr(NULL, "vkCreateInstance"))
+	) {
+		UIContext_vk_teardown(cx);
+		croak("libvulkan is missing vkGetInstanceProcAddr");
+	}
+
+	memset(&app, 0, sizeof(app));
+	app.sType= VK_STRUCTURE_TYPE_APPLICATION_INFO;
+	app.pApplicationName= "X11::MinimalOpenGLContext";
+	app.apiVersion= VK_API_VERSION_1_0;
+	memset(&ici, 0, sizeof(ici));
+	ici.sType= VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	ici.pApplicationInfo= &app;
+	ici.enabledExtensionCount= 2;
+	ici.ppEnabledExtensionNames= inst_ext;
+	if (vk->CreateInstance(&ici, NULL, &vk->instance) != VK_SUCCESS) {
+		UIContext_vk_teardown(cx);
+		croak("vkCreateInstance failed (is VK_KHR_xlib_surface supported?)");
+	}
+	#define LOADFN(name) if (!(vk->name= (PFN_vk##name) vk->GetInstanceProcAddr(vk->instance, "vk" #name))) goto missing;
+	UICONTEXT_VK_INSTANCE_FN(LOADFN)
+	#undef LOADFN
+
+	memset(&xci, 0, sizeof(xci));
+	xci.sType= VK_STRUCTURE_TYPE_XLIB_SURFACE_CREATE_INFO_KHR;
+	xci.dpy= cx->dpy;
+	xci.window= wnd;
+	if (vk->CreateXlibSurfaceKHR(vk->instance, &xci, NULL, &vk->surface) != VK_SUCCESS) {
+		UIContext_vk_teardown(cx);
+		croak("vkCreateXlibSurfaceKHR failed");
+	}
+
+	// First device with a queue that can both copy and present to the window
+	n_devs= sizeof(devs)/sizeof(*devs);
+	vk->EnumeratePhysicalDevices(vk->instance, &n_devs, devs);
+	for (d= 0; d < n_devs && !vk->phys; d++) {
+		n_qf= sizeof(qf)/sizeof(*qf);
+		vk->GetPhysicalDeviceQueueFamilyProperties(devs[d], &n_qf, qf);
+		for (q= 0; q < n_qf; q++) {
+			can_present= VK_FALSE;
+			vk->GetPhysicalDeviceSurfaceSupportKHR(devs[d], q, vk->surface, &can_present);
+			if (can_present && (qf[q].queueFlags & (VK_QUEUE_GRAPHICS_BIT|VK_QUEUE_TRANSFER_BIT))) {
+				vk->phys= devs[d];
+				vk->queue_family= q;
+				break;
+			}
+		}
+	}
+	if (!vk->phys) {
+		UIContext_vk_teardown(cx);
+		croak("No Vulkan device can present to this window");
+	}
+
+	memset(&qci, 0, sizeof(qci));
+	qci.sType= VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	qci.queueFamilyIndex= vk->queue_family;
+	qci.queueCount= 1;
+	qci.pQueuePriorities= &priority;
+	memset(&dci, 0, sizeof(dci));
+	dci.sType= VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	dci.queueCreateInfoCount= 1;
+	dci.pQueueCreateInfos= &qci;
+	dci.enabledExtensionCount= 1;
+	dci.ppEnabledExtensionNames= dev_ext;
+	if (vk->CreateDevice(vk->phys, &dci, NULL, &vk->device) != VK_SUCCESS) {
+		UIContext_vk_teardown(cx);
+		croak("vkCreateDevice failed");
+	}
+	#define LOADFN(name) if (!(vk->name= (PFN_vk##name) vk->GetDeviceProcAddr(vk->device, "vk" #name))) goto missing;
+	UICONTEXT_VK_DEVICE_FN(LOADFN)
+	#undef LOADFN
+	vk->GetDeviceQueue(vk->device, vk->queue_family, 0, &vk->queue);
+
+	memset(&pci, 0, sizeof(pci));
+	pci.sType= VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pci.flags= VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	pci.queueFamilyIndex= vk->queue_family;
+	if (vk->CreateCommandPool(vk->device, &pci, NULL, &vk->cmd_pool) != VK_SUCCESS) {
+		UIContext_vk_teardown(cx);
+		croak("vkCreateCommandPool failed");
+	}
+
+	if (!(vk->frames= (UIContext_vk_frame*) calloc(vk->frames_in_flight, sizeof(UIContext_vk_frame)))) {
+		UIContext_vk_teardown(cx);
+		croak("Out of memory");
+	}
+	memset(&cai, 0, sizeof(cai));
+	cai.sType= VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cai.commandPool= vk->cmd_pool;
+	cai.level= VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cai.commandBufferCount= 1;
+	memset(&semci, 0, sizeof(semci));
+	semci.sType= VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	memset(&fci, 0, sizeof(fci));
+	fci.sType= VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fci.flags= VK_FENCE_CREATE_SIGNALED_BIT;
+	for (i= 0; i < vk->frames_in_flight; i++) {
+		if (vk->AllocateCommandBuffers(vk->device, &cai, &vk->frames[i].cmd) != VK_SUCCESS
+			|| vk->CreateSemaphore(vk->device, &semci, NULL, &vk->frames[i].acquired) != VK_SUCCESS
+			|| vk->CreateFence(vk->device, &fci, NULL, &vk->frames[i].done) != VK_SUCCESS
+		) {
+			UIContext_vk_teardown(cx);
+			croak("Can't allocate Vulkan frame resources");
+		}
+	}
+
+	UIContext_vk_build_swapchain(cx);
+	return;
+	missing:
+	UIContext_vk_teardown(cx);
+	croak("Vulkan driver is missing required functions");
+}
+
+static void UIContext_vk_image_barrier(UIContext_vk *vk, VkCommandBuffer cmd, VkImage img,
+	VkImageLayout from, VkImageLayout to, VkAccessFlags src_access, VkAccessFlags dst_access,
+	VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage
+) {
+	VkImageMemoryBarrier b;
+	memset(&b, 0, sizeof(b));
+	b.sType= VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	b.srcAccessMask= src_access;
+	b.dstAccessMask= dst_access;
+	b.oldLayout= from;
+	b.newLayout= to;
+	b.srcQueueFamilyIndex= VK_QUEUE_FAMILY_IGNORED;
+	b.dstQueueFamilyIndex= VK_QUEUE_FAMILY_IGNORED;
+	b.image= img;
+	b.subresourceRange.aspectMask= VK_IMAGE_ASPECT_COLOR_BIT;
+	b.subresourceRange.levelCount= 1;
+	b.subresourceRange.layerCount= 1;
+	vk->CmdPipelineBarrier(cmd, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &b);
+}
+
+// Present one frame.  If 'pixels' is NULL, the frame is read from the current
+// GL target with glReadPixels, else it must be width*height*4 bytes of BGRA,
+// top row first.  Returns false if the frame was dropped because the window
+// changed size (the swapchain is rebuilt, and vk_extent has the new size).
+int UIContext_vk_present(UIContext *cx, const void *pixels, size_t len) {
+	UIContext_vk *vk= cx->vk;
+	UIContext_vk_frame *f;
+	VkCommandBufferBeginInfo cbi;
+	VkSubmitInfo si;
+	VkPresentInfoKHR pi;
+	VkBufferImageCopy whole;
+	VkPipelineStageFlags wait_stage= VK_PIPELINE_STAGE_TRANSFER_BIT;
+	VkResult res;
+	uint32_t idx;
+	size_t size;
+
+	CROAK_IF_XLIB_FATAL();
+	if (!vk || !vk->device)
+		croak("No Vulkan swapchain; call vk_setup first");
+	if (vk->need_rebuild)
+		UIContext_vk_build_swapchain(cx);
+	size= (size_t) vk->extent.width * vk->extent.height * 4;
+	if (pixels && len != size)
+		croak("Expected %ld bytes of pixels for %ux%u swapchain, got %ld",
+			(long) size, vk->extent.width, vk->extent.height, (long) len);
+	if (!pixels)
+		CROAK_IF_NO_TARGET(cx);
+
+	// Blocks here only if 'frames_in_flight' frames are already queued
+	f= &vk->frames[vk->frame % vk->frames_in_flight];
+	vk->WaitForFences(vk->device, 1, &f->done, VK_TRUE, UINT64_MAX);
+
+	res= vk->AcquireNextImageKHR(vk->device, vk->swapchain, UINT64_MAX, f->acquired, VK_NULL_HANDLE, &idx);
+	if (res == VK_ERROR_OUT_OF_DATE_KHR) {
+		vk->need_rebuild= 1;
+		return 0;
+	}
+	if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR)
+		croak("vkAcquireNextImageKHR failed (%d)", (int) res);
+
+	if (pixels)
+		memcpy(f->staging_ptr, pixels, size);
+	else {
+		cx->gl.PixelStorei(GL_PACK_ALIGNMENT, 4);
+		cx->gl.ReadPixels(0, 0, vk->extent.width, vk->extent.height, GL_BGRA, GL_UNSIGNED_BYTE, f->staging_ptr);
+	}
+
+	vk->ResetFences(vk->device, 1, &f->done);
+	vk->ResetCommandBuffer(f->cmd, 0);
+	memset(&cbi, 0, sizeof(cbi));
+	cbi.sType= VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cbi.flags= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vk->BeginCommandBuffer(f->cmd, &cbi);
+	UIContext_vk_image_barrier(vk, f->cmd, vk->images[idx],
+		VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		0, VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+	if (pixels) {
+		memset(&whole, 0, sizeof(whole));
+		whole.imageSubresource.aspectMask= VK_IMAGE_ASPECT_COLOR_BIT;
+		whole.imageSubresource.layerCount= 1;
+		whole.imageExtent.width= vk->extent.width;
+		whole.imageExtent.height= vk->extent.height;
+		whole.imageExtent.depth= 1;
+		vk->CmdCopyBufferToImage(f->cmd, f->staging, vk->images[idx],
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &whole);
+	}
+	else
+		vk->CmdCopyBufferToImage(f->cmd, f->staging, vk->images[idx],
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, vk->extent.height, vk->row_regions);
+	UIContext_vk_image_barrier(vk, f->cmd, vk->images[idx],
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+		VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+	vk->EndCommandBuffer(f->cmd);
+
+	memset(&si, 0, sizeof(si));
+	si.sType= VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	si.waitSemaphoreCount= 1;
+	si.pWaitSemaphores= &f->acquired;
+	si.pWaitDstStageMask= &wait_stage;
+	si.commandBufferCount= 1;
+	si.pCommandBuffers= &f->cmd;
+	si.signalSemaphoreCount= 1;
+	si.pSignalSemaphores= &vk->rendered[idx];
+	if (vk->QueueSubmit(vk->queue, 1, &si, f->done) != VK_SUCCESS)
+		croak("vkQueueSubmit failed");
+
+	memset(&pi, 0, sizeof(pi));
+	pi.sType= VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	pi.waitSemaphoreCount= 1;
+	pi.pWaitSemaphores= &vk->rendered[idx];
+	pi.swapchainCount= 1;
+	pi.pSwapchains= &vk->swapchain;
+	pi.pImageIndices= &idx;
+	res= vk->QueuePresentKHR(vk->queue, &pi);
+	vk->frame++;
+	if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR)
+		vk->need_rebuild= 1;
+	else if (res != VK_SUCCESS)
+		croak("vkQueuePresentKHR failed (%d)", (int) res);
+	return 1;
+}
+
+void UIContext_vk_get_info(UIContext *cx, int *w, int *h, int *image_count, int *frames_in_flight, const char **present_mode) {
+	UIContext_vk *vk= cx->vk;
+	if (!vk || !vk->swapchain)
+		croak("No Vulkan swapchain; call vk_setup first");
+	*w= vk->extent.width;
+	*h= vk->extent.height;
+	*image_count= vk->image_count;
+	*frames_in_flight= vk->frames_in_flight;
+	*present_mode= UIContext_vk_present_mode_names[vk->present_mode];
+}
+
+#else /* no Vulkan headers */
+
+void UIContext_vk_teardown(UIContext *cx) {
+	(void) cx;
+}
+
+void UIContext_vk_setup(UIContext *cx, Window wnd, int present_mode, int image_count, int frames_in_flight) {
+	(void) cx; (void) wnd; (void) present_mode; (void) image_count; (void) frames_in_flight;
+	croak("Compiled without Vulkan support");
+}
+
+int UIContext_vk_present(UIContext *cx, const void *pixels, size_t len) {
+	(void) cx; (void) pixels; (void) len;
+	croak("Compiled without Vulkan support");
+	return 0;
+}
+
+void UIContext_vk_get_info(UIContext *cx, int *w, int *h, int *image_count, int *frames_in_flight, const char **present_mode) {
+	(void) cx; (void) w; (void) h; (void) image_count; (void) frames_in_flight; (void) present_mode;
+	croak("Compiled without Vulkan support");
+}
+
+#endif